@@ -0,0 +1,100 @@
+/*=========================================================================================
+ * bench_batch.c
+ *
+ * HashMap_getBatch / HashMap_insertBatch against a loop of single calls.
+ * The table is larger than the cache so that every lookup misses.
+ *
+ *   gcc -O2 -I.. ../hashmap.c bench_batch.c -o bench_batch -lpthread
+ *   ./bench_batch [key_num] [batch]
+ =========================================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "hashmap.h"
+
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, char **argv)
+{
+	int key_num = (1 < argc) ? atoi(argv[1]) : 2000000;
+	int batch = (2 < argc) ? atoi(argv[2]) : 128;
+	int lookups = 4000000 / batch * batch;
+	char (*keys)[16] = malloc(sizeof(*keys) * key_num);
+	char **query = malloc(sizeof(char *) * lookups);
+	void **data = malloc(sizeof(void *) * key_num);
+	void **results = malloc(sizeof(void *) * batch);
+	int *values = malloc(sizeof(int) * key_num);
+	uint64_t x = 88172645463325252ull;
+	int e, i, j;
+
+	for (i=0; i<key_num; i++) {
+		sprintf(keys[i], "key:%08d", i);
+		values[i] = i;
+		data[i] = &values[i];
+	}
+	for (i=0; i<lookups; i++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		query[i] = keys[x % key_num];
+	}
+
+	printf("keys=%d batch=%d (ns/key)\n", key_num, batch);
+	printf("engine   insert  insertBatch      get  getBatch\n");
+	for (e=0; e<2; e++) {
+		HashMapOption option = {(0 == e) ? HASHMAP_ENGINE_LINEAR : HASHMAP_ENGINE_SWISS, NULL};
+		HashMapHandle map;
+		double t, ins, ins_b, get, get_b;
+		long sum = 0;
+
+		/* insert: one by one */
+		map = HashMap_makeEx(sizeof(int), key_num * 4 / 3, NULL, &option);
+		t = now_sec();
+		for (i=0; i<key_num; i++) { HashMap_insert(map, keys[i], data[i]); }
+		ins = now_sec() - t;
+		HashMap_free(map);
+
+		/* insert: batch */
+		map = HashMap_makeEx(sizeof(int), key_num * 4 / 3, NULL, &option);
+		t = now_sec();
+		for (i=0; i<key_num; i+=batch) {
+			char *k[batch];
+			int n = (key_num - i < batch) ? (key_num - i) : (batch);
+			for (j=0; j<n; j++) { k[j] = keys[i + j]; }
+			HashMap_insertBatch(map, k, &data[i], n);
+		}
+		ins_b = now_sec() - t;
+
+		/* get: one by one */
+		t = now_sec();
+		for (i=0; i<lookups; i++) { sum += *(int *)HashMap_get(map, query[i]); }
+		get = now_sec() - t;
+
+		/* get: batch */
+		t = now_sec();
+		for (i=0; i<lookups; i+=batch) {
+			HashMap_getBatch(map, &query[i], batch, results);
+			for (j=0; j<batch; j++) { sum -= *(int *)results[j]; }
+		}
+		get_b = now_sec() - t;
+		HashMap_free(map);
+
+		printf("%-6s %8.1f %12.1f %8.1f %9.1f %s\n", (0 == e) ? "linear" : "swiss",
+		       ins / key_num * 1e9, ins_b / key_num * 1e9, get / lookups * 1e9, get_b / lookups * 1e9,
+		       (0 == sum) ? "" : "(mismatch)");
+	}
+
+	free(keys);
+	free(query);
+	free(data);
+	free(results);
+	free(values);
+	return 0;
+}
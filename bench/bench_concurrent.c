@@ -0,0 +1,145 @@
+/*=========================================================================================
+ * bench_concurrent.c
+ *
+ * Throughput of HashMapConcurrent against one HashMap guarded by one mutex,
+ * from 1 to N threads. Each thread runs a mixed workload on a shared key space.
+ *
+ *   gcc -O2 -I.. ../hashmap.c ../hashmap_concurrent.c bench_concurrent.c -o bench_concurrent -lpthread
+ *   ./bench_concurrent [max_threads] [read_percent]
+ =========================================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashmap.h"
+#include "hashmap_concurrent.h"
+
+
+#define KEY_NUM     (100000)
+#define OPS_THREAD  (1000000)
+
+
+typedef struct {
+	int id;
+	int read_percent;
+	HashMapConcurrent cmap;               /* NULL: use map and lock */
+	HashMapHandle map;
+	pthread_mutex_t *lock;
+} BenchArg;
+
+
+static char keys[KEY_NUM][16];
+
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void *bench_thread(void *p)
+{
+	BenchArg *arg = (BenchArg *)p;
+	uint64_t x = 0x9E3779B97F4A7C15ull * (arg->id + 1);
+	int i, value;
+
+	for (i=0; i<OPS_THREAD; i++) {
+		int k, op;
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		k = (int)(x % KEY_NUM);
+		op = (int)((x >> 32) % 100);
+		if (NULL != arg->cmap) {
+			if (op < arg->read_percent) {
+				HashMap_concurrentGet(arg->cmap, keys[k], &value);
+			} else if (op & 1) {
+				HashMap_concurrentInsert(arg->cmap, keys[k], &k);
+			} else {
+				HashMap_concurrentErase(arg->cmap, keys[k]);
+			}
+		} else {
+			pthread_mutex_lock(arg->lock);
+			if (op < arg->read_percent) {
+				HashMap_peek(arg->map, keys[k], &value, NULL, NULL);
+			} else if (op & 1) {
+				HashMap_tryInsert(arg->map, keys[k], &k);
+			} else {
+				HashMap_tryErase(arg->map, keys[k]);
+			}
+			pthread_mutex_unlock(arg->lock);
+		}
+	}
+
+	return NULL;
+}
+
+
+static double bench_run(int threads, int read_percent, bool concurrent)
+{
+	pthread_t tid[threads];
+	BenchArg arg[threads];
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	HashMapConcurrent cmap = NULL;
+	HashMapHandle map = NULL;
+	double start, elapsed;
+	int i;
+
+	if (concurrent) {
+		cmap = HashMap_concurrentMake(sizeof(int), KEY_NUM * 2, 0, NULL, NULL);
+	} else {
+		map = HashMap_make(sizeof(int), KEY_NUM * 2, NULL);
+		HashMap_setAutoResize(map, true, 0.75f, 2.0f);
+	}
+	for (i=0; i<KEY_NUM; i+=2) {
+		if (concurrent) { HashMap_concurrentInsert(cmap, keys[i], &i); }
+		else            { HashMap_insert(map, keys[i], &i); }
+	}
+
+	start = now_sec();
+	for (i=0; i<threads; i++) {
+		arg[i].id = i;
+		arg[i].read_percent = read_percent;
+		arg[i].cmap = cmap;
+		arg[i].map = map;
+		arg[i].lock = &lock;
+		pthread_create(&tid[i], NULL, bench_thread, &arg[i]);
+	}
+	for (i=0; i<threads; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	elapsed = now_sec() - start;
+
+	if (concurrent) { HashMap_concurrentFree(cmap); }
+	else            { HashMap_free(map); }
+
+	return (double)threads * OPS_THREAD / elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+	int max_threads = (1 < argc) ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int read_percent = (2 < argc) ? atoi(argv[2]) : 90;
+	int i, n;
+
+	/* duplicate insert / missing erase are expected; silence the library log */
+	if (NULL == freopen("/dev/null", "w", stderr)) { return 1; }
+
+	for (i=0; i<KEY_NUM; i++) {
+		sprintf(keys[i], "key:%08d", i);
+	}
+
+	printf("threads  mutex(Mops/s)  concurrent(Mops/s)  (read %d%%)\n", read_percent);
+	for (n=1; n<=max_threads; n*=2) {
+		double m = bench_run(n, read_percent, false);
+		double c = bench_run(n, read_percent, true);
+		printf("%7d  %13.2f  %18.2f\n", n, m / 1e6, c / 1e6);
+		if ((n < max_threads) && (max_threads < n * 2)) { n = max_threads / 2; }
+	}
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*=========================================================================================
+ * bench_cpp.cpp
+ *
+ * hashmap::HashMap (hashmap.hpp) against the C API (swiss engine) and std::unordered_map.
+ * Keys are uint64_t (C API: *Bytes with 8 bytes) and std::string (C API: nul terminated).
+ * Data is int.
+ *
+ *   make bench
+ *   ./bench/bench_cpp [key_num]
+ =========================================================================================*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hashmap.h"
+#include "hashmap.hpp"
+
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+
+static volatile long sink;
+
+
+static void report(const char *key, const char *impl, const double t[4], int n)
+{
+	printf("%-7s %-15s insert %7.1f  get_hit %7.1f  get_miss %7.1f  erase %7.1f  (ns/op)\n",
+	       key, impl, t[0] * 1e9 / n, t[1] * 1e9 / n, t[2] * 1e9 / n, t[3] * 1e9 / n);
+}
+
+
+/* hit[] is inserted, miss[] is not. All maps grow from their default size. */
+static void bench_c_u64(const std::vector<uint64_t> &hit, const std::vector<uint64_t> &miss)
+{
+	HashMapOption option = {HASHMAP_ENGINE_SWISS, NULL};
+	HashMapHandle map = HashMap_makeEx(sizeof(int), 16, NULL, &option);
+	int n = (int)hit.size();
+	double t[4], s;
+	long sum = 0;
+
+	HashMap_setAutoResize(map, true, 0.875f, 2.0f);
+	s = now_sec();
+	for (int i=0; i<n; i++) { HashMap_insertBytes(map, &hit[i], sizeof(uint64_t), &i); }
+	t[0] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) {
+		int *p = (int *)HashMap_getBytes(map, &hit[n - 1 - i], sizeof(uint64_t));
+		if (NULL != p) { sum += *p; }
+	}
+	t[1] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { sum += (HASHMAP_OK == HashMap_tryGetBytes(map, &miss[i], sizeof(uint64_t), NULL)); }
+	t[2] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { HashMap_eraseBytes(map, &hit[i], sizeof(uint64_t)); }
+	t[3] = now_sec() - s;
+	HashMap_free(map);
+	sink = sum;
+	report("u64", "C API (swiss)", t, n);
+}
+
+
+static void bench_c_str(const std::vector<std::string> &hit, const std::vector<std::string> &miss)
+{
+	HashMapOption option = {HASHMAP_ENGINE_SWISS, NULL};
+	HashMapHandle map = HashMap_makeEx(sizeof(int), 16, NULL, &option);
+	int n = (int)hit.size();
+	double t[4], s;
+	long sum = 0;
+
+	HashMap_setAutoResize(map, true, 0.875f, 2.0f);
+	s = now_sec();
+	for (int i=0; i<n; i++) { HashMap_insert(map, (char *)hit[i].c_str(), &i); }
+	t[0] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) {
+		int *p = (int *)HashMap_get(map, (char *)hit[n - 1 - i].c_str());
+		if (NULL != p) { sum += *p; }
+	}
+	t[1] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { sum += (HASHMAP_OK == HashMap_tryGet(map, (char *)miss[i].c_str(), NULL)); }
+	t[2] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { HashMap_erase(map, (char *)hit[i].c_str()); }
+	t[3] = now_sec() - s;
+	HashMap_free(map);
+	sink = sum;
+	report("string", "C API (swiss)", t, n);
+}
+
+
+template <class K>
+static void bench_hpp(const char *key, const std::vector<K> &hit, const std::vector<K> &miss)
+{
+	hashmap::HashMap<K, int> map;
+	int n = (int)hit.size();
+	double t[4], s;
+	long sum = 0;
+
+	s = now_sec();
+	for (int i=0; i<n; i++) { map.insert(hit[i], i); }
+	t[0] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) {
+		int *p = map.get(hit[n - 1 - i]);
+		if (nullptr != p) { sum += *p; }
+	}
+	t[1] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { sum += (nullptr != map.get(miss[i])); }
+	t[2] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { map.erase(hit[i]); }
+	t[3] = now_sec() - s;
+	sink = sum;
+	report(key, "hashmap.hpp", t, n);
+}
+
+
+template <class K>
+static void bench_std(const char *key, const std::vector<K> &hit, const std::vector<K> &miss)
+{
+	std::unordered_map<K, int> map;
+	int n = (int)hit.size();
+	double t[4], s;
+	long sum = 0;
+
+	s = now_sec();
+	for (int i=0; i<n; i++) { map.emplace(hit[i], i); }
+	t[0] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) {
+		auto it = map.find(hit[n - 1 - i]);
+		if (it != map.end()) { sum += it->second; }
+	}
+	t[1] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { sum += (map.find(miss[i]) != map.end()); }
+	t[2] = now_sec() - s;
+	s = now_sec();
+	for (int i=0; i<n; i++) { map.erase(hit[i]); }
+	t[3] = now_sec() - s;
+	sink = sum;
+	report(key, "unordered_map", t, n);
+}
+
+
+int main(int argc, char **argv)
+{
+	int key_num = (1 < argc) ? atoi(argv[1]) : 1000000;
+	std::vector<uint64_t> hit_u64(key_num), miss_u64(key_num);
+	std::vector<std::string> hit_str(key_num), miss_str(key_num);
+
+	for (int i=0; i<key_num; i++) {
+		hit_u64[i] = mix64((uint64_t)i << 1);
+		miss_u64[i] = mix64(((uint64_t)i << 1) | 1);
+		hit_str[i] = "user:" + std::to_string(hit_u64[i]);
+		miss_str[i] = "user:" + std::to_string(miss_u64[i]);
+	}
+
+	printf("keys=%d \n", key_num);
+	bench_c_u64(hit_u64, miss_u64);
+	bench_hpp("u64", hit_u64, miss_u64);
+	bench_std("u64", hit_u64, miss_u64);
+	bench_c_str(hit_str, miss_str);
+	bench_hpp("string", hit_str, miss_str);
+	bench_std("string", hit_str, miss_str);
+	return 0;
+}
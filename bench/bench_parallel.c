@@ -0,0 +1,113 @@
+/*=========================================================================================
+ * bench_parallel.c
+ *
+ * HashMap_bulkLoad build time and HashMap_parallelForeach scan bandwidth,
+ * from 1 to N threads, against HashMap_insert and HashMap_foreach.
+ * Keys are random so that every part of the table gets its share.
+ *
+ *   gcc -O2 -I.. ../hashmap.c bench_parallel.c -o bench_parallel -lpthread
+ *   ./bench_parallel [key_num] [max_threads]
+ =========================================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashmap.h"
+
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static bool sum_value(const char *key, size_t len, void *data, void *arg)
+{
+	(void)key;
+	__atomic_fetch_add((long *)arg, (long)len + *(int *)data, __ATOMIC_RELAXED);
+	return true;
+}
+
+
+static bool sum_local(const char *key, size_t len, void *data, void *arg)
+{
+	(void)key;
+	*(long *)arg += (long)len + *(int *)data;
+	return true;
+}
+
+
+int main(int argc, char **argv)
+{
+	int key_num = (1 < argc) ? atoi(argv[1]) : 4000000;
+	int max_threads = (2 < argc) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	char (*keys)[24] = malloc(sizeof(*keys) * key_num);
+	char **key_ptr = malloc(sizeof(char *) * key_num);
+	void **data = malloc(sizeof(void *) * key_num);
+	int *values = malloc(sizeof(int) * key_num);
+	uint64_t x = 88172645463325252ull;
+	HashMapHandle map;
+	double t, base_build, base_scan;
+	long expect = 0, sum;
+	int e, i, threads;
+
+	for (i=0; i<key_num; i++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		sprintf(keys[i], "key:%016llx", (unsigned long long)x);
+		key_ptr[i] = keys[i];
+		values[i] = i;
+		data[i] = &values[i];
+		expect += (long)strlen(keys[i]) + i;
+	}
+
+	printf("keys=%d\n", key_num);
+	printf("engine threads build(ms) speedup  scan(ms) Mkeys/s speedup\n");
+	for (e=0; e<3; e++) {
+		HashMapOption option = {(EHashMapEngine)e, NULL};
+		const char *name = (0 == e) ? "linear" : (1 == e) ? "swiss" : "robin";
+
+		/* baseline: one by one */
+		map = HashMap_makeEx(sizeof(int), 1024, NULL, &option);
+		HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+		t = now_sec();
+		for (i=0; i<key_num; i++) { HashMap_insert(map, keys[i], data[i]); }
+		base_build = now_sec() - t;
+		sum = 0;
+		t = now_sec();
+		HashMap_foreach(map, sum_local, &sum);
+		base_scan = now_sec() - t;
+		printf("%-6s %7s %10.1f %7s %9.1f %7.1f %7s %s\n", name, "-", base_build * 1e3, "", base_scan * 1e3,
+		       key_num / base_scan * 1e-6, "", (expect == sum) ? "" : "(mismatch)");
+		HashMap_free(map);
+
+		for (threads=1; threads<=max_threads; threads*=2) {
+			double build, scan;
+
+			map = HashMap_makeEx(sizeof(int), 1024, NULL, &option);
+			HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+			t = now_sec();
+			HashMap_bulkLoad(map, key_ptr, data, key_num, threads);
+			build = now_sec() - t;
+
+			sum = 0;
+			t = now_sec();
+			HashMap_parallelForeach(map, sum_value, &sum, threads);
+			scan = now_sec() - t;
+
+			printf("%-6s %7d %10.1f %6.2fx %9.1f %7.1f %6.2fx %s\n", name, threads, build * 1e3, base_build / build,
+			       scan * 1e3, key_num / scan * 1e-6, base_scan / scan,
+			       ((expect == sum) && (key_num == HashMap_size(map))) ? "" : "(mismatch)");
+			HashMap_free(map);
+		}
+	}
+
+	free(keys);
+	free(key_ptr);
+	free(data);
+	free(values);
+	return 0;
+}
@@ -0,0 +1,292 @@
+/*=========================================================================================
+ * bench_suite.c
+ *
+ * Benchmark suite for regression tracking. Writes one JSON document to stdout.
+ * Progress goes to stderr.
+ *
+ * Workloads: insert, get_hit, get_miss, erase, iterate, mixed (80% get, 20% insert/erase)
+ * Axes:      engine x hash (built-in / user hook) x key length x keys x load factor
+ *
+ * The table is made with a fixed size (keys / load) and without auto resize,
+ * so the load factor is what is measured. Swiss rounds the size up to a power of two,
+ * so the real load is reported as "real_load".
+ *
+ *   make bench-json                        (writes bench_result.json)
+ *   ./bench/bench_suite [-q] [-k keys,...] [-l load,...]
+ *     -q   quick run (small key counts, one load factor)
+ =========================================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "hashmap.h"
+
+
+#define MAX_AXIS    (8)
+#define MIN_OPS     (2000000)             /* Operations measured at least per result. */
+#define MIN_OPS_Q   (200000)              /* Same on quick run. */
+#define KEY_MAX     (72)
+
+
+typedef enum {
+	KEYLEN_SHORT = 0,                     /* 8 bytes. (inline) */
+	KEYLEN_MEDIUM,                        /* 24 bytes. (key arena) */
+	KEYLEN_LONG,                          /* 64 bytes. */
+	KEYLEN_MIXED,                         /* 8 to 64 bytes. */
+	KEYLEN_NUM
+} EKeyLen;
+
+static const char *keylen_name[] = {"short", "medium", "long", "mixed"};
+static const char *engine_name[] = {"linear", "swiss", "robinhood"};
+static const char *op_name[] = {"insert", "get_hit", "get_miss", "erase", "iterate", "mixed"};
+static int min_ops = MIN_OPS;
+
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+
+static int hash_fnv(char *key, int tblsz)
+{
+	uint32_t h = 2166136261u;
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return (int)(h % (uint32_t)tblsz);
+}
+
+
+/* Key i of distribution. miss selects a disjoint key set. */
+static void make_key(char *buf, EKeyLen dist, int i, int miss)
+{
+	static const int mixed_len[4] = {8, 16, 24, 64};
+	uint64_t x = mix64(((uint64_t)i << 1) | (uint64_t)miss);
+	int len = (KEYLEN_SHORT == dist) ? 8 : (KEYLEN_MEDIUM == dist) ? 24 : (KEYLEN_LONG == dist) ? 64 : mixed_len[x & 3];
+	int n;
+
+	n = sprintf(buf, "%c%07x", miss ? 'm' : 'k', i & 0xFFFFFFF);
+	while (n < len) {
+		n += sprintf(buf + n, "%016llx", (unsigned long long)x);
+		x = mix64(x);
+	}
+	buf[len] = '\0';
+}
+
+
+typedef struct {
+	int engine;
+	bool hook;
+	EKeyLen dist;
+	int keys;
+	float load;
+	char *hit;                            /* keys * KEY_MAX */
+	char *miss;
+	int *order;                           /* Random permutation of keys. */
+} BenchCase;
+
+
+static HashMapHandle bench_make(const BenchCase *c)
+{
+	HashMapOption option = {(EHashMapEngine)c->engine, NULL};
+	int tblsz = (int)(c->keys / c->load) + 1;
+	return HashMap_makeEx(sizeof(int), tblsz, c->hook ? hash_fnv : NULL, &option);
+}
+
+
+static void bench_fill(HashMapHandle map, const BenchCase *c)
+{
+	int i;
+	for (i=0; i<c->keys; i++) { HashMap_tryInsert(map, &c->hit[(size_t)i * KEY_MAX], &i); }
+}
+
+
+static bool bench_visit(const char *key, size_t len, void *data, void *arg)
+{
+	(void)key;
+	*(long *)arg += (long)len + *(int *)data;
+	return true;
+}
+
+
+/* Returns seconds per operation. */
+static double bench_op(const BenchCase *c, int op, double *real_load)
+{
+	HashMapHandle map = bench_make(c);
+	HashMapStats stats;
+	int reps = (min_ops + c->keys - 1) / c->keys;
+	double t, total = 0;
+	long sum = 0;
+	int r, i;
+
+	bench_fill(map, c);
+	HashMap_stats(map, &stats);
+	*real_load = stats.load;
+
+	for (r=0; r<reps; r++) {
+		switch (op) {
+		case 0:	/* insert */
+			HashMap_clear(map);
+			t = now_sec();
+			for (i=0; i<c->keys; i++) { HashMap_tryInsert(map, &c->hit[(size_t)c->order[i] * KEY_MAX], &i); }
+			total += now_sec() - t;
+			break;
+		case 1:	/* get_hit */
+			t = now_sec();
+			for (i=0; i<c->keys; i++) {
+				void *p;
+				if (HASHMAP_OK == HashMap_tryGet(map, &c->hit[(size_t)c->order[i] * KEY_MAX], &p)) { sum += *(int *)p; }
+			}
+			total += now_sec() - t;
+			break;
+		case 2:	/* get_miss */
+			t = now_sec();
+			for (i=0; i<c->keys; i++) {
+				if (HASHMAP_OK == HashMap_tryGet(map, &c->miss[(size_t)c->order[i] * KEY_MAX], NULL)) { sum++; }
+			}
+			total += now_sec() - t;
+			break;
+		case 3:	/* erase */
+			if (0 < r) { bench_fill(map, c); }
+			t = now_sec();
+			for (i=0; i<c->keys; i++) { HashMap_tryErase(map, &c->hit[(size_t)c->order[i] * KEY_MAX]); }
+			total += now_sec() - t;
+			break;
+		case 4:	/* iterate */
+			t = now_sec();
+			HashMap_foreach(map, bench_visit, &sum);
+			total += now_sec() - t;
+			break;
+		default:	/* mixed: 80% get, 10% insert, 10% erase on a live set of keys */
+			t = now_sec();
+			for (i=0; i<c->keys; i++) {
+				int k = c->order[i];
+				char *key = (k & 1) ? &c->miss[(size_t)k * KEY_MAX] : &c->hit[(size_t)k * KEY_MAX];
+				int sel = (int)(mix64((uint64_t)i + r) % 10);
+				if (sel < 8) {
+					if (HASHMAP_OK == HashMap_tryGet(map, key, NULL)) { sum++; }
+				} else if (8 == sel) {
+					HashMap_tryInsert(map, key, &i);
+				} else {
+					HashMap_tryErase(map, key);
+				}
+			}
+			total += now_sec() - t;
+			break;
+		}
+	}
+	HashMap_free(map);
+	if (1 == sum) { fprintf(stderr, " "); }	/* keep sum alive */
+	return total / ((double)reps * c->keys);
+}
+
+
+static int parse_list(const char *s, double *out)
+{
+	int n = 0;
+	while ((NULL != s) && (n < MAX_AXIS)) {
+		out[n++] = atof(s);
+		s = strchr(s, ',');
+		if (NULL != s) { s++; }
+	}
+	return n;
+}
+
+
+int main(int argc, char **argv)
+{
+	double keys_axis[MAX_AXIS] = {1000, 100000, 1000000};
+	double load_axis[MAX_AXIS] = {0.5, 0.75, 0.9};
+	int nkeys = 3, nloads = 3;
+	int i, e, h, d, k, l, op, max_keys = 0;
+	bool first = true;
+	char *hit, *miss;
+	int *order;
+
+	for (i=1; i<argc; i++) {
+		if (0 == strcmp(argv[i], "-q")) {
+			keys_axis[0] = 1000;
+			keys_axis[1] = 50000;
+			nkeys = 2;
+			load_axis[0] = 0.75;
+			nloads = 1;
+			min_ops = MIN_OPS_Q;
+		} else if ((0 == strcmp(argv[i], "-k")) && (i + 1 < argc)) {
+			nkeys = parse_list(argv[++i], keys_axis);
+		} else if ((0 == strcmp(argv[i], "-l")) && (i + 1 < argc)) {
+			nloads = parse_list(argv[++i], load_axis);
+		} else {
+			fprintf(stderr, "usage: %s [-q] [-k keys,...] [-l load,...] \n", argv[0]);
+			return 1;
+		}
+	}
+	for (k=0; k<nkeys; k++) {
+		if (max_keys < (int)keys_axis[k]) { max_keys = (int)keys_axis[k]; }
+	}
+
+	hit = malloc((size_t)max_keys * KEY_MAX);
+	miss = malloc((size_t)max_keys * KEY_MAX);
+	order = malloc(sizeof(int) * max_keys);
+	if ((NULL == hit) || (NULL == miss) || (NULL == order)) {
+		fprintf(stderr, "out of memory \n");
+		return 1;
+	}
+
+	printf("{\n  \"suite\": \"hashmap\",\n  \"timestamp\": %lld,\n  \"results\": [", (long long)time(NULL));
+	for (d=0; d<KEYLEN_NUM; d++) {
+		for (i=0; i<max_keys; i++) {
+			make_key(&hit[(size_t)i * KEY_MAX], (EKeyLen)d, i, 0);
+			make_key(&miss[(size_t)i * KEY_MAX], (EKeyLen)d, i, 1);
+		}
+		for (k=0; k<nkeys; k++) {
+			int n = (int)keys_axis[k];
+			for (i=0; i<n; i++) { order[i] = i; }
+			for (i=n-1; 0<i; i--) {
+				int j = (int)(mix64((uint64_t)i) % (uint64_t)(i + 1));
+				int tmp = order[i];
+				order[i] = order[j];
+				order[j] = tmp;
+			}
+			for (l=0; l<nloads; l++) {
+				for (e=0; e<3; e++) {
+					for (h=0; h<2; h++) {
+						BenchCase c = {e, (1 == h), (EKeyLen)d, n, (float)load_axis[l], hit, miss, order};
+						fprintf(stderr, "%s %s %s keys=%d load=%.2f \n", engine_name[e], h ? "hook" : "default",
+						        keylen_name[d], n, load_axis[l]);
+						for (op=0; op<6; op++) {
+							double real_load;
+							double sec = bench_op(&c, op, &real_load);
+							printf("%s\n    {\"engine\": \"%s\", \"hash\": \"%s\", \"keylen\": \"%s\", \"keys\": %d, "
+							       "\"load\": %.2f, \"real_load\": %.3f, \"op\": \"%s\", \"ns_per_op\": %.2f, \"mops\": %.3f}",
+							       first ? "" : ",", engine_name[e], h ? "hook" : "default", keylen_name[d], n,
+							       load_axis[l], real_load, op_name[op], sec * 1e9, 1e-6 / sec);
+							first = false;
+						}
+					}
+				}
+			}
+		}
+	}
+	printf("\n  ]\n}\n");
+
+	free(hit);
+	free(miss);
+	free(order);
+	return 0;
+}
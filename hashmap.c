@@ -2,6 +2,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#define HASHMAP_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if !defined(HASHMAP_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define HASHMAP_HAVE_THREADS
+#include <pthread.h>
+#endif
 #include "hashmap.h"
 
 
@@ -12,20 +29,91 @@
 #define LOG(...)
 #endif
 
+/*! Build with -DHASHMAP_NO_DIAG to drop every error message (no stdio on any path). */
+#ifdef HASHMAP_NO_DIAG
+#define DIAG(...)
+#else
+#define DIAG(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+/*! Build with -DHASHMAP_NO_HANDLE_CHECK to skip handle validation. (NULL or freed handle crashes) */
+#ifdef HASHMAP_NO_HANDLE_CHECK
+#define MAP_IS_INIT(handle) (true)
+#else
+#define MAP_IS_INIT(handle) map_is_init(handle)
+#endif
+
+/*! Build with -DHASHMAP_USDT to place USDT probes of provider "hashmap" (needs <sys/sdt.h>). (see HashMap_setTrace) */
+#ifdef HASHMAP_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(hashmap, name, a, b, c, d)
+#else
+#define TRACE_PROBE4(name, a, b, c, d) do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
 
-#define KEY_MAX_LEN     (32)
+#define KEY_INLINE_LEN  (16)                /*! Keys shorter than this are stored in HashData. */
+#define KEY_ARENA_MIN   (256)               /*! Initial key arena size. */
+#define KEY_HOOK_BUF    (64)                /*! Stack buffer to terminate binary key for fooked hash. */
 #define INIT_KEY        ("")
 #define CRASH_ADDRESS   (0xFFFFFF00000000)  /*! Inhibit Access Area.(System Dependent) */
 #define HANDLE_START_ID (55)                /*! Value has no meaning. */
 #define INVALID_CORD    (-1)
+#define DEFAULT_MAX_LOAD (0.75f)            /*! Load factor threshold of auto resize mode. */
+#define DEFAULT_GROWTH   (2.0f)             /*! Table growth factor of auto resize mode. */
+#define CTRL_EMPTY      (0x00)              /*! Never used. Probe sequence stops here. */
+#define CTRL_DELETED    (0x01)              /*! Tombstone. Probe sequence goes through. */
+#define CTRL_FULL       (0x80)              /*! Occupied. Lower 7 bits are hash fragment. (see map_h2) */
+#define CTRL_GROUP      (16)                /*! Slots tested at once by swiss engine. */
+#define BATCH_WINDOW    (16)                /*! Keys hashed and prefetched ahead in batch API. */
+#define WORKER_MAX      (64)                /*! Threads used by parallel API at most. */
+#define SNAP_MAGIC      ("HMAPSNAP")        /*! Snapshot file signature. (8 bytes) */
+#define SNAP_VERSION    (1)                 /*! Snapshot layout version. */
+#define SNAP_ORDER      (0x01020304u)       /*! Written as is to detect byte order. */
+#define SNAP_ALIGN      (64)                /*! Section alignment on snapshot file. */
+#define MPHF_LAMBDA     (4)                 /*! Average keys per bucket of frozen map. */
+#define MPHF_MAX_PILOT  (0x1000000u)        /*! Give up the seed if a bucket needs more pilots. */
+#define MPHF_RETRY      (16)                /*! Seeds tried to build frozen map. */
+#define SHARD_MAX       (1024)              /*! Inner maps of sharded handle at most. */
+#define SHARD_SEED      (0x9e3779b97f4a7c15ull) /*! Seed of route hash. Independent of inner map seed. */
+#define CACHE_LINE      (64)                /*! Shards are aligned to avoid false sharing of locks. */
+
+#if defined(__GNUC__)
+#define PREFETCH(p)     __builtin_prefetch(p)
+#define CACHE_ALIGNED   __attribute__((aligned(CACHE_LINE)))
+#else
+#define PREFETCH(p)
+#define CACHE_ALIGNED
+#endif
+
+/*! Handle ID counter is shared by all threads. */
+#if defined(__GNUC__)
+#define ATOMIC_FETCH_INC(p)  __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p)       __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define ATOMIC_FETCH_INC(p)  ((*(p))++)
+#define ATOMIC_LOAD(p)       (*(p))
+#define ATOMIC_STORE(p, v)   (*(p) = (v))
+#endif
 
 
+/*! Check Writable and Exit */
+#define PRE_WRITE_CHECK(handle, ret, ercd, label)                                     \
+do {                                                                                  \
+	if (handle->readonly) {                                                           \
+		ret = ercd;                                                                   \
+		DIAG("error ! HashMapHandle is read only ! @%s() \n", __func__);              \
+		goto label;                                                                   \
+	}                                                                                 \
+} while (0)
+
 /*! Check Initialized and Exit */
 #define PRE_SAFE_CHECK(handle, ret, ercd, label)                                      \
 do {                                                                                  \
-	if (false == map_is_init(handle)) {                                               \
+	if (false == MAP_IS_INIT(handle)) {                                               \
 		ret = ercd;                                                                   \
-		fprintf(stderr, "error ! HashMapHandle is not initialized ! @%s() \n", __func__); \
+		DIAG("error ! HashMapHandle is not initialized ! @%s() \n", __func__);       \
 		goto label;                                                                   \
 	}                                                                                 \
 } while (0)
@@ -34,7 +122,33 @@ do {
 do {                                                                                  \
 	if (0 == strcmp(key, INIT_KEY)) {                                                 \
 		ret = ercd;                                                                   \
-		fprintf(stderr, "error ! invalid key ! @%s() \n", __func__);                  \
+		DIAG("error ! invalid key ! @%s() \n", __func__);                  \
+		goto label;                                                                   \
+	}                                                                                 \
+} while (0)
+
+/*! Call Same API on Shard of Key and Exit (sharded handle) */
+#define PRE_SHARD_ROUTE(handle, key, len, ret, label, func, ...)                      \
+do {                                                                                  \
+	if (0 < handle->shards) {                                                         \
+		MapShard *shard_ = map_shard_lock(handle, map_shard_of(handle, key, len));   \
+		ret = func(shard_->map, __VA_ARGS__);                                         \
+		map_shard_unlock(shard_);                                                     \
+		goto label;                                                                   \
+	}                                                                                 \
+} while (0)
+
+/*! Call Same API on All Shards and Exit (sharded handle). ret is NG if a shard fails. */
+#define PRE_SHARD_EACH(handle, ret, label, func, ...)                                 \
+do {                                                                                  \
+	if (0 < handle->shards) {                                                         \
+		int shard_i_;                                                                 \
+		ret = OK;                                                                     \
+		for (shard_i_=0; shard_i_<handle->shards; shard_i_++) {                       \
+			MapShard *shard_ = map_shard_lock(handle, shard_i_);                      \
+			if (OK != func(shard_->map, __VA_ARGS__)) { ret = NG; }                   \
+			map_shard_unlock(shard_);                                                 \
+		}                                                                             \
 		goto label;                                                                   \
 	}                                                                                 \
 } while (0)
@@ -42,19 +156,129 @@ do {
 
 /*! Hash Table Data Structure */
 typedef struct tag_map_data {
-	char key[KEY_MAX_LEN];                /* Hash key. */
-	void *container;                      /* Data stored hash table. */
+	union {
+		char buf[KEY_INLINE_LEN];         /* Short key. (keylen < KEY_INLINE_LEN) */
+		size_t offset;                    /* Long key. Offset on key arena. */
+	} key;                                /* Hash key. Always terminated by '\0'. (see map_key) */
+	unsigned int hash;                    /* Cached hash value of key. (see map_hash) */
+	int keylen;                           /* Key length. */
 } HashData;
 
 
+/*! Hash Table Body */
+typedef struct tag_map_table {
+	int tblsz;                            /* Hash table size. */
+	unsigned char *ctrl;                  /* Control bytes. (CTRL_EMPTY/CTRL_DELETED/CTRL_FULL|fragment) */
+	HashData *slots;                      /* Key slots. */
+	char *values;                         /* Data stored hash table. (tblsz * cellsz, parallel to slots) */
+	unsigned char *refs;                  /* CLOCK reference bits. (1 byte per slot) NULL unless cache mode. */
+	uint64_t *expires;                    /* Expiry time of each slot. 0 never expires. NULL unless expiry mode. */
+} HashTable;
+
+
+/*! Snapshot File Header (see HashMap_save) */
+typedef struct tag_map_snap_header {
+	char magic[8];                        /* SNAP_MAGIC */
+	uint32_t version;                     /* SNAP_VERSION */
+	uint32_t order;                       /* SNAP_ORDER */
+	uint32_t slot_size;                   /* sizeof(HashData) */
+	uint32_t engine;                      /* EHashMapEngine */
+	uint32_t hash_kind;                   /* 0: wyhash, 1: crc32c, 2: fooked */
+	uint32_t probe_peak;                  /* Statistics. (see map_stats_probe) */
+	uint64_t seed;                        /* Seed of built-in hash. */
+	uint64_t cellsz;                      /* Container data size. */
+	int64_t tblsz;                        /* Hash table size. */
+	int64_t count;                        /* Number of registered keys. */
+	int64_t deleted;                      /* Number of tombstones. */
+	int64_t probe_sum;                    /* Statistics. */
+	uint64_t arena_used;                  /* Size of key arena section. */
+	uint64_t arena_dead;                  /* Size of erased keys on key arena. */
+	uint64_t ctrl_off;                    /* Offset of control bytes section. */
+	uint64_t slots_off;                   /* Offset of key slots section. */
+	uint64_t values_off;                  /* Offset of data section. */
+	uint64_t arena_off;                   /* Offset of key arena section. */
+	uint64_t file_size;                   /* Total size. */
+	int32_t probe_hist[HASHMAP_PROBE_HIST]; /* Statistics. */
+} MapSnapHeader;
+
+
+/*! Inner Map of Sharded Handle (see map_shard_make) */
+typedef struct tag_map_shard {
+	HashMapHandle map;                    /* Inner map. Plain handle. */
+	bool locked;                          /* lock is initialized. (HashMapOption.locked) */
+#ifdef HASHMAP_HAVE_THREADS
+	pthread_mutex_t lock;                 /* Taken while map is operated through the sharded handle. */
+#endif
+} CACHE_ALIGNED MapShard;
+
+
+/*! Tracing State of Handle (see HashMap_setTrace) */
+typedef struct tag_map_trace_state {
+	HashMapTrace data;                    /* Pulled by HashMap_trace. sample is a ring. */
+	int head;                             /* Next entry of sample ring. */
+	uint64_t slow_cycles;                 /* Lookups taking this or more cycles are slow. */
+	int sample_rate;                      /* One in sample_rate slow lookups is sampled. 0 means none. */
+	int countdown;                        /* Slow lookups until next sample. */
+} MapTrace;
+
+
 /*! Map Handle Information */
 struct tag_map_handle {
 	int hdl_id;                           /* Handle id. Use initialize check. */
 	int (* hash)(char *key, int tblsz);   /* Hash func pointer. HashMap_make can fook hash. */
-	size_t cellsz;                        /* Container data size @HashData. */
-	int tblsz;                            /* Hash table size. */
+	unsigned int (* hash_full)(const char *key, int len, uint64_t seed); /* Built-in hash. NULL if hash is fooked. */
+	uint64_t seed;                        /* Seed of built-in hash. */
+	size_t cellsz;                        /* Container data size @HashTable. */
+	EHashMapEngine engine;                /* Probing engine of hash table. */
+	HashMapAllocator allocator;           /* Memory allocator of handle, tables and keys. */
 	int iterator_pos;                     /* Iterator position. */
-	HashData *hash_table;                 /* Hash table data pointer. */
+	int iterators;                        /* External iterators pinning incremental rehash. (see HashMap_iterInit) */
+	unsigned int generation;              /* Changed when slots are moved to another table. Invalidates iterators. */
+	HashTable table;                      /* Hash table. */
+	int count;                            /* Number of registered keys. (HashMap_size) */
+	int deleted;                          /* Number of tombstones. */
+	bool resizable;                       /* Auto resize mode. */
+	float max_load;                       /* Load factor threshold to grow. */
+	float growth;                         /* Table growth factor. */
+	HashTable old;                        /* Table under incremental rehash. slots is NULL if not migrating. */
+	int rehash_pos;                       /* Next slot to migrate on old table. */
+	int rehash_step;                      /* Slots migrated per operation. 0 means one-shot rehash. */
+	char *key_arena;                      /* Long keys storage. */
+	size_t arena_size;                    /* Allocated size of key arena. */
+	size_t arena_used;                    /* Used size of key arena. */
+	size_t arena_dead;                    /* Size of erased keys on key arena. */
+	int probe_hist[HASHMAP_PROBE_HIST];   /* Keys by probe length. Last one counts longer keys too. (see map_stats_probe) */
+	long long probe_sum;                  /* Total probe length of keys. */
+	int probe_peak;                       /* Longest probe length since last rebuild. */
+	unsigned long resizes;                /* Number of table size changes. */
+	unsigned long hits;                   /* Lookups found. */
+	unsigned long misses;                 /* Lookups not found. */
+	char *map_base;                       /* Mapped snapshot file. NULL if not loaded. (see HashMap_load) */
+	size_t map_size;                      /* Size of mapped snapshot file. */
+	bool readonly;                        /* Loaded by HASHMAP_LOAD_READONLY, or frozen. */
+	bool frozen;                          /* Made by HashMap_freeze. Table is placed by perfect hash. */
+	uint32_t *pilots;                     /* Pilot of each bucket. (see map_mphf_slot) */
+	int buckets;                          /* Number of pilots. */
+	uint64_t mphf_seed;                   /* Seed of perfect hash. */
+	bool cache;                           /* Cache mode. Evicts keys instead of failing. (see HashMap_setCache) */
+	int cache_max;                        /* Keys kept at most. 0 means no limit. */
+	size_t cache_max_bytes;               /* Bytes (keylen + cellsz per key) kept at most. 0 means no limit. */
+	size_t cache_bytes;                   /* Bytes of registered keys. Counted on cache mode only. */
+	int clock_hand;                       /* Next slot examined by CLOCK eviction. */
+	void (* evict)(const char *key, size_t len, void *data, void *arg); /* Called before eviction. NULL allowed. */
+	void *evict_arg;                      /* Passed to evict as is. */
+	unsigned long evictions;              /* Keys evicted. */
+	bool expiry;                          /* Expiry mode. Keys may have TTL. (see HashMap_setExpiry) */
+	int sweep_step;                       /* Slots examined by sweeper per insert. 0 means no auto sweep. */
+	int sweep_pos;                        /* Next slot examined by sweeper. */
+	uint64_t (* clock)(void *arg);        /* Time source of TTL. NULL means monotonic milliseconds. */
+	void *clock_arg;                      /* Passed to clock as is. */
+	unsigned long expirations;            /* Expired keys reclaimed. */
+	int shards;                           /* Number of inner maps. 0 unless sharded handle. (see HashMap_makeEx) */
+	int shard_shift;                      /* Shard of key is the top bits of route hash. (see map_shard_of) */
+	MapShard *shard;                      /* Inner maps. Table of sharded handle itself is empty. */
+	void *shard_mem;                      /* Allocated block of shard. shard is aligned up to CACHE_LINE in it. */
+	MapTrace *trace;                      /* Tracing state. NULL unless tracing. (see HashMap_setTrace) */
 }; /* HashMapHandle define */
 
 
@@ -66,27 +290,384 @@ typedef enum {
 } ECleanUpLevel;
 
 
-static int hash_func_default(char *key, int tblsz);
+/*! Work of One Thread on HashMap_bulkLoad (see map_bulk_hash, map_bulk_insert) */
+typedef struct tag_map_bulk_work {
+	struct tag_map_handle local;          /* Copy of handle. Shares tables, counts by itself. */
+	char **keys;                          /* Keys of HashMap_bulkLoad. */
+	void **data;                          /* Data of HashMap_bulkLoad. */
+	int *len;                             /* Key length. 0 means invalid key. */
+	unsigned int *hash;                   /* map_hash() of key. */
+	const int *order;                     /* Keys sorted by owner. */
+	int first;                            /* Keys of this work. (order[first] .. order[last - 1]) */
+	int last;
+	int lo;                               /* Slots owned by this work. [lo, hi) */
+	int hi;
+	unsigned char *defer;                 /* Set to 1 if the key is left to serial insert. */
+	int inserted;                         /* Registered keys. */
+} MapBulkWork;
+
+
+/*! Work of One Thread on HashMap_parallelForeach (see map_scan_worker) */
+typedef struct tag_map_scan_work {
+	HashMapHandle handle;                 /* Scanned handle. */
+	bool (* func)(const char *key, size_t len, void *data, void *arg);
+	void *arg;                            /* Passed to func as is. */
+	int lo;                               /* Iterator positions of this work. [lo, hi) */
+	int hi;
+	int *stop;                            /* Set to 1 if func returns false. Shared by works. */
+} MapScanWork;
+
+
+/*! Work of One Thread on Sharded Handle (see map_shard_route, map_shard_insert, map_shard_scan) */
+typedef struct tag_map_shard_work {
+	HashMapHandle handle;                 /* Sharded handle. */
+	char **keys;                          /* Keys. Sorted by shard on map_shard_insert. */
+	void **data;                          /* Data of keys. */
+	int *route;                           /* Shard of each key. */
+	const int *start;                     /* Keys of shard s are keys[start[s]] .. keys[start[s+1] - 1]. */
+	int lo;                               /* Keys [lo, hi) on map_shard_route, shards [lo, hi) on others. */
+	int hi;
+	bool (* func)(const char *key, size_t len, void *data, void *arg);
+	void *arg;                            /* Passed to func as is. */
+	int *stop;                            /* Set to 1 if func returns false. Shared by works. */
+	int inserted;                         /* Registered keys. */
+} MapShardWork;
+
+
+static uint64_t hash_wyhash64(const char *key, int len, uint64_t seed);
+static unsigned int hash_full_wyhash(const char *key, int len, uint64_t seed);
+static unsigned int hash_full_crc32c(const char *key, int len, uint64_t seed);
 static int *map_get_handle_id_base(void);
 static int map_get_handle_id(void);
+#ifndef HASHMAP_NO_HANDLE_CHECK
 static bool map_is_init(HashMapHandle handle);
+#endif
 static void map_cleanup(HashMapHandle handle, ECleanUpLevel level);
-static int map_find(HashMapHandle handle, char *key, int index, int *misshit);
+static void *map_std_alloc(void *ctx, size_t size);
+static void *map_std_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void map_std_free(void *ctx, void *ptr, size_t size);
+static void *map_alloc(HashMapHandle handle, size_t size);
+static void *map_realloc(HashMapHandle handle, void *ptr, size_t old_size, size_t new_size);
+static void map_free(HashMapHandle handle, void *ptr, size_t size);
+static bool map_is_mapped(HashMapHandle handle, const void *ptr);
+static void map_unmap(HashMapHandle handle);
+static int map_table_size(HashMapHandle handle, int tblsz);
+static int map_table_alloc(HashMapHandle handle, HashTable *t, int tblsz);
+static void map_table_free(HashMapHandle handle, HashTable *t);
+static void *map_value(HashMapHandle handle, const HashTable *t, int index);
+static const char *map_key(HashMapHandle handle, const HashData *p);
+static bool map_key_equal(HashMapHandle handle, const HashData *p, const char *key, int len);
+static int map_store_key(HashMapHandle handle, HashData *p, const char *key, int len);
+static void map_release_key(HashMapHandle handle, HashData *p);
+static int map_arena_compact(HashMapHandle handle);
+static unsigned int map_hash(HashMapHandle handle, const char *key, int len, int tblsz);
+static int map_home(HashMapHandle handle, unsigned int hash, int tblsz);
+static unsigned char map_h2(HashMapHandle handle, unsigned int hash);
+static unsigned int map_group_match(const unsigned char *ctrl, unsigned char c);
+static unsigned int map_group_full(const unsigned char *ctrl);
+static int map_ctz(unsigned int bits);
+static int map_find_linear(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank);
+static int map_find_swiss(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank);
+static int map_robin_dist(HashMapHandle handle, const HashTable *t, int index);
+static int map_find_robin(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank);
+static int map_find(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank);
+static int map_find_blank(HashMapHandle handle, const HashTable *t, unsigned int hash);
+static void map_move_slot(HashMapHandle handle, HashTable *t, int dst, int src);
+static int map_make_room(HashMapHandle handle, HashTable *t, int index);
+static int map_mphf_bucket(uint64_t h, int buckets);
+static int map_mphf_slot(uint64_t h, uint32_t pilot, int tblsz);
+static int map_find_frozen(HashMapHandle handle, const char *key, int len);
+static int map_lookup(HashMapHandle handle, const char *key, int len, unsigned int hash, HashTable **found);
+static void map_occupy(HashMapHandle handle, HashTable *t, int index, unsigned int hash);
+static int map_probe_len(HashMapHandle handle, const HashTable *t, int index);
+static void map_stats_probe(HashMapHandle handle, const HashTable *t, int index, int delta);
+static void map_stats_rebuild(HashMapHandle handle);
+static void map_remove_at(HashMapHandle handle, HashTable *t, int index);
+static void map_touch(const HashTable *t, int index);
+static int map_clock_victim(HashMapHandle handle);
+static bool map_cache_over(HashMapHandle handle, int num, size_t add);
+static int map_cache_evict(HashMapHandle handle, int num, size_t add);
+static uint64_t map_now(HashMapHandle handle);
+static bool map_expired(HashMapHandle handle, const HashTable *t, int index);
+static bool map_reclaim(HashMapHandle handle, HashTable *t, int index);
+static int map_sweep(HashMapHandle handle, int step);
+static void map_set_ttl(HashMapHandle handle, void *value, uint64_t ttl);
+static int map_rehash(HashMapHandle handle, int tblsz);
+static int map_rehash_start(HashMapHandle handle, int tblsz);
+static void map_rehash_step(HashMapHandle handle, int step);
+static int map_reserve(HashMapHandle handle);
+static bool map_is_iterating(HashMapHandle handle);
+static HashData *map_iter_slot(HashMapHandle handle, int pos);
+static void *map_iter_value(HashMapHandle handle, int pos);
+static int map_ctrl_scan(const unsigned char *ctrl, int from, int end);
+static int map_iter_seek(HashMapHandle handle, int pos, int end);
+static void map_iter_release(HashMapIter *iter);
+static void map_prefetch(HashMapHandle handle, const HashTable *t, unsigned int hash);
+static EHashMapStatus map_emplace(HashMapHandle handle, const char *key, int len, unsigned int hash, void **value);
+static EHashMapStatus map_insert(HashMapHandle handle, const char *key, int len, unsigned int hash, void *data);
+static void map_run_workers(void *(* func)(void *work), void *works, size_t worksz, int num);
+static void *map_bulk_hash(void *work);
+static bool map_bulk_local(HashMapHandle handle, unsigned int hash, int hi);
+static void *map_bulk_insert(void *work);
+static void *map_scan_worker(void *work);
+static int map_shard_make(HashMapHandle handle, int tblsz, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option);
+static void map_shard_free(HashMapHandle handle);
+static int map_shard_of(HashMapHandle handle, const void *key, size_t len);
+static MapShard *map_shard_lock(HashMapHandle handle, int index);
+static void map_shard_unlock(MapShard *s);
+static bool map_shard_iter_next(HashMapIter *iter);
+static void *map_shard_route(void *work);
+static void *map_shard_insert(void *work);
+static int map_shard_load(HashMapHandle handle, char **keys, void **data, int num, int nthreads);
+static int map_shard_get_batch(HashMapHandle handle, char **keys, int num, void **results);
+static void *map_shard_scan(void *work);
+static HashMapHandle map_shard_freeze(HashMapHandle handle);
+static uint64_t map_cycles(void);
+static uint64_t map_trace_op(HashMapHandle handle, EHashMapOp op, uint64_t start);
+static void map_trace_lookup(HashMapHandle handle, const char *key, int len, bool hit, uint64_t cycles);
+static EHashMapStatus map_get(HashMapHandle handle, const char *key, int len, void **data);
+static EHashMapStatus map_erase(HashMapHandle handle, const char *key, int len);
+static int map_status_report(EHashMapStatus status, const char *key, int len, const char *func);
+static int map_bytes_check(HashMapHandle handle, const void *key, size_t len, char *buf, char **cstr);
+static uint64_t map_snap_align(uint64_t off);
+static uint32_t map_snap_hash_kind(int (* hash_fook)(char *key, int tblsz));
+static int map_snap_write(FILE *fp, uint64_t *pos, uint64_t off, const void *data, size_t size);
+static int map_snap_check(const MapSnapHeader *hdr, uint64_t file_size);
+static int map_snap_check_slots(const MapSnapHeader *hdr, const char *base);
+static int map_mphf_build(HashMapHandle handle, const uint64_t *h, int n, int *slot);
 
 
 
 /*=========================================================================================
- * @name:	static int hash_func_default(char *key, int tblsz)
- * @brief:	Default Hash Function
- * @note:	HashMap_make()時にhash関数が指定されなかった場合、このhash関数が使用される
+ * @name:	static uint64_t hash_wy_mum(uint64_t a, uint64_t b)
+ * @brief:	64x64->128bit Multiply and Fold
+ * @note:	wyhashの混合関数。128bit整数が使えない環境では32bit乗算で代用する。
  * @attention:
  =========================================================================================*/
-static int hash_func_default(char *key, int tblsz)
+static uint64_t hash_wy_mum(uint64_t a, uint64_t b)
 {
-	int len = strlen(key);
-	int ret = (len + (4 * (key[0] + (4 * key[len/2])))) % tblsz;
-	//fprintf(stderr, "%s: len=%d, key[0]=%d, key[len/2]=%d, ret=%d \n", key, len, key[len], key[len/2], ret);
-	return ret;
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), lo, hi;
+	uint64_t c = t < rl;
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	return lo ^ hi;
+#endif
+}
+static uint64_t hash_rd8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static uint64_t hash_rd4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+
+/*=========================================================================================
+ * @name:	static uint64_t hash_wyhash64(const char *key, int len, uint64_t seed)
+ * @brief:	wyhash (64bit)
+ * @note:	デフォルトのhash関数。キー全体を8byte単位で読み、乗算で混ぜる。
+ *       	先頭が共通するキー("user:000123"等)でも偏らない。
+ *       	完全ハッシュ(HashMap_freeze)はこの64bit値をそのまま使う。
+ * @attention:	リトルエンディアン以外では値が変わる(同一プロセス内では一貫している)。
+ =========================================================================================*/
+static uint64_t hash_wyhash64(const char *key, int len, uint64_t seed)
+{
+	static const uint64_t wyp[4] = {
+		0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+	};
+	const uint8_t *p = (const uint8_t *)key;
+	uint64_t a, b, h;
+	int i = len;
+
+	seed ^= hash_wy_mum(seed ^ wyp[0], wyp[1]);
+	if (len <= 16) {
+		if (4 <= len) {
+			a = (hash_rd4(p) << 32) | hash_rd4(p + ((len >> 3) << 2));
+			b = (hash_rd4(p + len - 4) << 32) | hash_rd4(p + len - 4 - ((len >> 3) << 2));
+		} else if (0 < len) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (48 < i) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = hash_wy_mum(hash_rd8(p) ^ wyp[1], hash_rd8(p + 8) ^ seed);
+				see1 = hash_wy_mum(hash_rd8(p + 16) ^ wyp[2], hash_rd8(p + 24) ^ see1);
+				see2 = hash_wy_mum(hash_rd8(p + 32) ^ wyp[3], hash_rd8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (48 < i);
+			seed ^= see1 ^ see2;
+		}
+		while (16 < i) {
+			seed = hash_wy_mum(hash_rd8(p) ^ wyp[1], hash_rd8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hash_rd8(p + i - 16);
+		b = hash_rd8(p + i - 8);
+	}
+	h = hash_wy_mum(hash_wy_mum(a ^ wyp[1], b ^ seed) ^ wyp[0] ^ (uint64_t)len, wyp[1]);
+
+	return h;
+}
+
+
+/*=========================================================================================
+ * @name:	static unsigned int hash_full_wyhash(const char *key, int len, uint64_t seed)
+ * @brief:	wyhash (Table Size Independent)
+ * @note:	hash_wyhash64()を32bitに畳んだもの。
+ *       	テーブルサイズで剰余を取る前の値を返すので、HashDataにキャッシュしてリハッシュ時に再利用する。
+ * @attention:
+ =========================================================================================*/
+static unsigned int hash_full_wyhash(const char *key, int len, uint64_t seed)
+{
+	uint64_t h = hash_wyhash64(key, len, seed);
+	return (unsigned int)(h ^ (h >> 32));
+}
+
+
+/*! CRC32C (Castagnoli, reflected 0x82F63B78) byte table for hash_crc32c_sw */
+static const uint32_t crc32c_table[256] = {
+	0x00000000u, 0xF26B8303u, 0xE13B70F7u, 0x1350F3F4u, 0xC79A971Fu, 0x35F1141Cu, 0x26A1E7E8u, 0xD4CA64EBu,
+	0x8AD958CFu, 0x78B2DBCCu, 0x6BE22838u, 0x9989AB3Bu, 0x4D43CFD0u, 0xBF284CD3u, 0xAC78BF27u, 0x5E133C24u,
+	0x105EC76Fu, 0xE235446Cu, 0xF165B798u, 0x030E349Bu, 0xD7C45070u, 0x25AFD373u, 0x36FF2087u, 0xC494A384u,
+	0x9A879FA0u, 0x68EC1CA3u, 0x7BBCEF57u, 0x89D76C54u, 0x5D1D08BFu, 0xAF768BBCu, 0xBC267848u, 0x4E4DFB4Bu,
+	0x20BD8EDEu, 0xD2D60DDDu, 0xC186FE29u, 0x33ED7D2Au, 0xE72719C1u, 0x154C9AC2u, 0x061C6936u, 0xF477EA35u,
+	0xAA64D611u, 0x580F5512u, 0x4B5FA6E6u, 0xB93425E5u, 0x6DFE410Eu, 0x9F95C20Du, 0x8CC531F9u, 0x7EAEB2FAu,
+	0x30E349B1u, 0xC288CAB2u, 0xD1D83946u, 0x23B3BA45u, 0xF779DEAEu, 0x05125DADu, 0x1642AE59u, 0xE4292D5Au,
+	0xBA3A117Eu, 0x4851927Du, 0x5B016189u, 0xA96AE28Au, 0x7DA08661u, 0x8FCB0562u, 0x9C9BF696u, 0x6EF07595u,
+	0x417B1DBCu, 0xB3109EBFu, 0xA0406D4Bu, 0x522BEE48u, 0x86E18AA3u, 0x748A09A0u, 0x67DAFA54u, 0x95B17957u,
+	0xCBA24573u, 0x39C9C670u, 0x2A993584u, 0xD8F2B687u, 0x0C38D26Cu, 0xFE53516Fu, 0xED03A29Bu, 0x1F682198u,
+	0x5125DAD3u, 0xA34E59D0u, 0xB01EAA24u, 0x42752927u, 0x96BF4DCCu, 0x64D4CECFu, 0x77843D3Bu, 0x85EFBE38u,
+	0xDBFC821Cu, 0x2997011Fu, 0x3AC7F2EBu, 0xC8AC71E8u, 0x1C661503u, 0xEE0D9600u, 0xFD5D65F4u, 0x0F36E6F7u,
+	0x61C69362u, 0x93AD1061u, 0x80FDE395u, 0x72966096u, 0xA65C047Du, 0x5437877Eu, 0x4767748Au, 0xB50CF789u,
+	0xEB1FCBADu, 0x197448AEu, 0x0A24BB5Au, 0xF84F3859u, 0x2C855CB2u, 0xDEEEDFB1u, 0xCDBE2C45u, 0x3FD5AF46u,
+	0x7198540Du, 0x83F3D70Eu, 0x90A324FAu, 0x62C8A7F9u, 0xB602C312u, 0x44694011u, 0x5739B3E5u, 0xA55230E6u,
+	0xFB410CC2u, 0x092A8FC1u, 0x1A7A7C35u, 0xE811FF36u, 0x3CDB9BDDu, 0xCEB018DEu, 0xDDE0EB2Au, 0x2F8B6829u,
+	0x82F63B78u, 0x709DB87Bu, 0x63CD4B8Fu, 0x91A6C88Cu, 0x456CAC67u, 0xB7072F64u, 0xA457DC90u, 0x563C5F93u,
+	0x082F63B7u, 0xFA44E0B4u, 0xE9141340u, 0x1B7F9043u, 0xCFB5F4A8u, 0x3DDE77ABu, 0x2E8E845Fu, 0xDCE5075Cu,
+	0x92A8FC17u, 0x60C37F14u, 0x73938CE0u, 0x81F80FE3u, 0x55326B08u, 0xA759E80Bu, 0xB4091BFFu, 0x466298FCu,
+	0x1871A4D8u, 0xEA1A27DBu, 0xF94AD42Fu, 0x0B21572Cu, 0xDFEB33C7u, 0x2D80B0C4u, 0x3ED04330u, 0xCCBBC033u,
+	0xA24BB5A6u, 0x502036A5u, 0x4370C551u, 0xB11B4652u, 0x65D122B9u, 0x97BAA1BAu, 0x84EA524Eu, 0x7681D14Du,
+	0x2892ED69u, 0xDAF96E6Au, 0xC9A99D9Eu, 0x3BC21E9Du, 0xEF087A76u, 0x1D63F975u, 0x0E330A81u, 0xFC588982u,
+	0xB21572C9u, 0x407EF1CAu, 0x532E023Eu, 0xA145813Du, 0x758FE5D6u, 0x87E466D5u, 0x94B49521u, 0x66DF1622u,
+	0x38CC2A06u, 0xCAA7A905u, 0xD9F75AF1u, 0x2B9CD9F2u, 0xFF56BD19u, 0x0D3D3E1Au, 0x1E6DCDEEu, 0xEC064EEDu,
+	0xC38D26C4u, 0x31E6A5C7u, 0x22B65633u, 0xD0DDD530u, 0x0417B1DBu, 0xF67C32D8u, 0xE52CC12Cu, 0x1747422Fu,
+	0x49547E0Bu, 0xBB3FFD08u, 0xA86F0EFCu, 0x5A048DFFu, 0x8ECEE914u, 0x7CA56A17u, 0x6FF599E3u, 0x9D9E1AE0u,
+	0xD3D3E1ABu, 0x21B862A8u, 0x32E8915Cu, 0xC083125Fu, 0x144976B4u, 0xE622F5B7u, 0xF5720643u, 0x07198540u,
+	0x590AB964u, 0xAB613A67u, 0xB831C993u, 0x4A5A4A90u, 0x9E902E7Bu, 0x6CFBAD78u, 0x7FAB5E8Cu, 0x8DC0DD8Fu,
+	0xE330A81Au, 0x115B2B19u, 0x020BD8EDu, 0xF0605BEEu, 0x24AA3F05u, 0xD6C1BC06u, 0xC5914FF2u, 0x37FACCF1u,
+	0x69E9F0D5u, 0x9B8273D6u, 0x88D28022u, 0x7AB90321u, 0xAE7367CAu, 0x5C18E4C9u, 0x4F48173Du, 0xBD23943Eu,
+	0xF36E6F75u, 0x0105EC76u, 0x12551F82u, 0xE03E9C81u, 0x34F4F86Au, 0xC69F7B69u, 0xD5CF889Du, 0x27A40B9Eu,
+	0x79B737BAu, 0x8BDCB4B9u, 0x988C474Du, 0x6AE7C44Eu, 0xBE2DA0A5u, 0x4C4623A6u, 0x5F16D052u, 0xAD7D5351u
+};
+
+
+/*=========================================================================================
+ * @name:	static uint32_t hash_crc32c_sw(uint32_t crc, const uint8_t *p, int len)
+ * @brief:	CRC32C (Castagnoli) Software Implementation
+ * @note:	SSE4.2が使えない環境向け。テーブルは定数なので、複数のスレッドから同時に呼んでよい。
+ * @attention:
+ =========================================================================================*/
+static uint32_t hash_crc32c_sw(uint32_t crc, const uint8_t *p, int len)
+{
+	int i;
+
+	for (i=0; i<len; i++) {
+		crc = crc32c_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define HASH_CRC32C_HW
+/*=========================================================================================
+ * @name:	static uint32_t hash_crc32c_hw(uint32_t crc, const uint8_t *p, int len)
+ * @brief:	CRC32C by SSE4.2 crc32 Instruction
+ * @note:	8byte単位で処理する。呼び出し前に__builtin_cpu_supports("sse4.2")で確認すること。
+ * @attention:
+ =========================================================================================*/
+__attribute__((target("sse4.2")))
+static uint32_t hash_crc32c_hw(uint32_t crc, const uint8_t *p, int len)
+{
+#ifdef __x86_64__
+	uint64_t c = crc;
+	for (; 8 <= len; p += 8, len -= 8) { c = _mm_crc32_u64(c, hash_rd8(p)); }
+	crc = (uint32_t)c;
+#endif
+	for (; 4 <= len; p += 4, len -= 4) { crc = _mm_crc32_u32(crc, (uint32_t)hash_rd4(p)); }
+	for (; 0 < len; p++, len--) { crc = _mm_crc32_u8(crc, *p); }
+	return crc;
+}
+#endif
+
+
+/*=========================================================================================
+ * @name:	static unsigned int hash_full_crc32c(const char *key, int len, uint64_t seed)
+ * @brief:	CRC32C Hash (Table Size Independent)
+ * @note:	x86でSSE4.2が使える場合はcrc32命令を使用する。CRCは線形なので最後に混合して
+ *       	下位ビットの偏りを抑える。
+ * @attention:
+ =========================================================================================*/
+static unsigned int hash_full_crc32c(const char *key, int len, uint64_t seed)
+{
+	uint32_t h = (uint32_t)(seed ^ (seed >> 32)) ^ 0xFFFFFFFFu;
+#ifdef HASH_CRC32C_HW
+	static int hw = -1;	/* atomic: hashed by several threads (same value is stored by all) */
+	int use = ATOMIC_LOAD(&hw);
+	if (use < 0) {
+		use = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+		ATOMIC_STORE(&hw, use);
+	}
+	if (use) {
+		h = hash_crc32c_hw(h, (const uint8_t *)key, len);
+	} else
+#endif
+	{
+		h = hash_crc32c_sw(h, (const uint8_t *)key, len);
+	}
+	/* fmix32 */
+	h ^= (uint32_t)len;
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_hashWyhash(char *key, int tblsz)
+ * @brief:	Built-in Hash Function (wyhash)
+ * @note:	HashMap_make()のhash関数に指定すると、テーブルサイズに依存しない値をキャッシュする
+ *       	組み込みモードで動作し、HashMap_setSeed()のseedが使われる。
+ *       	hash関数を指定しなかった場合もこの関数が使用される。
+ * @attention:	直接呼び出した場合はseed=0で計算する。
+ =========================================================================================*/
+int HashMap_hashWyhash(char *key, int tblsz)
+{
+	return (int)(hash_full_wyhash(key, strlen(key), 0) % (unsigned int)tblsz);
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_hashCrc32c(char *key, int tblsz)
+ * @brief:	Built-in Hash Function (CRC32C)
+ * @note:	HashMap_make()のhash関数に指定すると組み込みモードで動作する。(HashMap_hashWyhash参照)
+ * @attention:	直接呼び出した場合はseed=0で計算する。
+ =========================================================================================*/
+int HashMap_hashCrc32c(char *key, int tblsz)
+{
+	return (int)(hash_full_crc32c(key, strlen(key), 0) % (unsigned int)tblsz);
 }
 
 
@@ -104,17 +685,19 @@ static int *map_get_handle_id_base(void)
 /*=========================================================================================
  * @name:	static int map_get_handle_id(void)
  * @brief:	Manage Handle ID
- * @note:	呼び出される毎にインクリメントする。
+ * @note:	呼び出される毎にインクリメントする。複数スレッドから同時にHashMap_make()しても
+ *       	IDが重複しないように、アトミックに加算する。
  * @attention:
  =========================================================================================*/
 static int map_get_handle_id(void)
 {
 	int *handle_num = map_get_handle_id_base();
-	LOG("get handle_id = %d \n", (*handle_num));
-	return (*handle_num)++;
+	LOG("get handle_id = %d \n", ATOMIC_LOAD(handle_num));
+	return ATOMIC_FETCH_INC(handle_num);
 }
 
 
+#ifndef HASHMAP_NO_HANDLE_CHECK
 /*=========================================================================================
  * @name:	static bool map_is_init(HashMapHandle handle)
  * @brief:	Check Initialize HashMapHandle
@@ -130,11 +713,12 @@ static bool map_is_init(HashMapHandle handle)
 	if      (NULL == handle)                   { is_init = false; }
 	else if (CRASH_ADDRESS <= (unsigned long)handle)  { is_init = false; }	/* このままメンバにアクセスすると吹っ飛ぶ */
 	else if (HANDLE_START_ID > handle->hdl_id) { is_init = false; }
-	else if (*handle_id_max <= handle->hdl_id) { is_init = false; }
+	else if (ATOMIC_LOAD(handle_id_max) <= handle->hdl_id) { is_init = false; }
 	else                                       { is_init = true;  }
 
 	return is_init;
 }
+#endif
 
 
 /*=========================================================================================
@@ -145,252 +729,4296 @@ static bool map_is_init(HashMapHandle handle)
  =========================================================================================*/
 static void map_cleanup(HashMapHandle handle, ECleanUpLevel level)
 {
+	HashMapAllocator allocator = handle->allocator;
+
 	switch (level) {
 		case FULL_CLEANUP:
-		{
-			int i;
-			for (i=0; i<handle->tblsz; i++) {
-				strcpy(handle->hash_table[i].key, INIT_KEY);
-				free(handle->hash_table[i].container);
-			}
-		}
+			map_table_free(handle, &(handle->old));
 		case MIDDLE_CLEANUP:
-			free(handle->hash_table);
+			map_free(handle, handle->key_arena, handle->arena_size);
+			map_table_free(handle, &(handle->table));
+			map_free(handle, handle->pilots, sizeof(uint32_t) * handle->buckets);
+			map_unmap(handle);
+			map_shard_free(handle);
+			map_free(handle, handle->trace, sizeof(MapTrace));
 			handle->hdl_id = INVALID_CORD;
 		case LITTLE_CLEANUP:
-			free(handle);
+			allocator.free(allocator.ctx, handle, sizeof(struct tag_map_handle));
 			break;
 		default:
-			fprintf(stderr, "error ! invalid cleanup level ! @map_cleanup() \n");
+			DIAG("error ! invalid cleanup level ! @map_cleanup() \n");
 			break;
 	}
 }
 
 
 /*=========================================================================================
- * @name:	static int map_find(HashMapHandle handle, char *key, EFindOption option)
- * @brief:	Find Key on Hash Table
- * @note:	
+ * @name:	static void *map_std_alloc(void *ctx, size_t size)
+ * @brief:	Default Allocator (malloc)
+ * @note:	アロケータを指定しなかった場合に使う。ctxは使わない。
  * @attention:	
  =========================================================================================*/
-static int map_find(HashMapHandle handle, char *key, int index, int *misshit)
+static void *map_std_alloc(void *ctx, size_t size)
 {
-	int i, end;
-	int ret = INVALID_CORD;
-	int dummy = 0;
-	LOG("key=%s, hash=%d \n", key, index);
-
-	/* Invalid misshit */
-	if (NULL == misshit) { misshit = &dummy; }
+	(void)ctx;
+	return malloc(size);
+}
 
-	end = (0==index) ? (handle->tblsz - 1) : (index - 1);
-	for (i=index; ; i=(i+1)%(handle->tblsz)) {
-		//LOG("- [%2d] key=%s \n", i, handle->hash_table[i].key);
-		if (0 == strcmp(handle->hash_table[i].key, key)) {
-			ret = i;		/* hit */
-			break;
-		} else {
-			(*misshit)++;
-		}
-		if (end == i) {
-			ret = INVALID_CORD;
-			break;
-		}
-	}
 
-	return ret;
+/*=========================================================================================
+ * @name:	static void *map_std_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+ * @brief:	Default Allocator (realloc)
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+static void *map_std_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	(void)ctx;
+	(void)old_size;
+	return realloc(ptr, new_size);
 }
 
 
-/*==
- * =======================================================================================
- * @name:	HashMapHandle HashMap_make(const size_t cellsz, const int tblsz, int (* hash_fook)(char *key, int tblsz))
- * @brief:	Make Hash Table
- * @note:	Hashテーブルサイズ、格納データ、Hash関数を引数で指定する
- *       	hash関数指定がNULLのときはdefaultの関数を利用する
- * @attention:
+/*=========================================================================================
+ * @name:	static void map_std_free(void *ctx, void *ptr, size_t size)
+ * @brief:	Default Allocator (free)
+ * @note:	
+ * @attention:	
  =========================================================================================*/
-HashMapHandle HashMap_make(const size_t cellsz, const int tblsz, int (* hash_fook)(char *key, int tblsz))
+static void map_std_free(void *ctx, void *ptr, size_t size)
 {
-	HashMapHandle handle;
-	int i;
-	LOG("Enter %s -> \n", __func__);
-	LOG("cellsz = %zd \n", cellsz);
-	LOG("tblsz  = %d \n", tblsz);
-	LOG("hash fook? -> %s \n", (NULL == hash_fook) ? ("no") : ("yes"));
-
-	if (cellsz <= 0) {
-		fprintf(stderr, "error ! cell size must be more than 0 ! \n");
-		handle = NULL;
-		goto catch_exit;
-	}
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
 
-	if (tblsz <= 0) {
-		fprintf(stderr, "error ! table size must be more than 0 ! \n");
-		handle = NULL;
-		goto catch_exit;
-	}
 
-	/*! make handle */
-	handle = (HashMapHandle)malloc(sizeof(struct tag_map_handle));
-	if (NULL == handle) {
-		fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(HashMapHandle));
-		goto catch_exit;
-	}
+/*=========================================================================================
+ * @name:	static void *map_alloc(HashMapHandle handle, size_t size)
+ * @brief:	Allocate Memory with Handle Allocator
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+static void *map_alloc(HashMapHandle handle, size_t size)
+{
+	return handle->allocator.alloc(handle->allocator.ctx, size);
+}
 
-	/*! configure handle */
-	handle->hdl_id = map_get_handle_id();
-	/*! fook hash? */
-	if (NULL == hash_fook) {
-		handle->hash = hash_func_default;
-	} else {
-		/*! fook! */
-		handle->hash = hash_fook;
-	}
 
-	/*! make hash table */
-	handle->cellsz = cellsz;
-	handle->tblsz = tblsz;
-	handle->iterator_pos = 0;
-	handle->hash_table = (HashData *)malloc(sizeof(HashData) * handle->tblsz);
-	if (NULL == handle->hash_table) {
-		fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(HashData) * handle->tblsz);
-		map_cleanup(handle, LITTLE_CLEANUP);
-		handle = NULL;
-		goto catch_exit;
+/*=========================================================================================
+ * @name:	static void *map_realloc(HashMapHandle handle, void *ptr, size_t old_size, size_t new_size)
+ * @brief:	Reallocate Memory with Handle Allocator
+ * @note:	ptrがNULLの場合はmap_alloc()と同じ。
+ * @attention:	失敗時はNULLを返し、ptrはそのまま残る。
+ =========================================================================================*/
+static void *map_realloc(HashMapHandle handle, void *ptr, size_t old_size, size_t new_size)
+{
+	if (NULL == ptr) {
+		return map_alloc(handle, new_size);
 	}
-	for (i=0; i<handle->tblsz; i++) {
-		handle->hash_table[i].container = (void *)malloc(handle->cellsz);
-		if (NULL == handle->hash_table[i].container) {
-			fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(handle->cellsz));
-			map_cleanup(handle, MIDDLE_CLEANUP);
-			handle = NULL;
-			goto catch_exit;
-		}
-		strcpy(handle->hash_table[i].key, INIT_KEY);
+	if (map_is_mapped(handle, ptr)) {
+		void *p = map_alloc(handle, new_size);
+		if (NULL != p) { memcpy(p, ptr, (old_size < new_size) ? (old_size) : (new_size)); }
+		return p;
 	}
+	return handle->allocator.realloc(handle->allocator.ctx, ptr, old_size, new_size);
+}
 
-catch_exit:
-	LOG("Leave %s <- \n", __func__);
-	return handle;
+
+/*=========================================================================================
+ * @name:	static void map_free(HashMapHandle handle, void *ptr, size_t size)
+ * @brief:	Free Memory with Handle Allocator
+ * @note:	sizeは確保した時のサイズ。ptrがNULLの場合は何もしない。
+ * @attention:	
+ =========================================================================================*/
+static void map_free(HashMapHandle handle, void *ptr, size_t size)
+{
+	if ((NULL == ptr) || map_is_mapped(handle, ptr)) { return; }
+	handle->allocator.free(handle->allocator.ctx, ptr, size);
 }
 
 
 /*=========================================================================================
- * @name:	int HashMap_free(HashMapHandle handle)
- * @brief:	Free Map Memory
- * @note:
+ * @name:	static bool map_is_mapped(HashMapHandle handle, const void *ptr)
+ * @brief:	Check Pointer is on Mapped Snapshot
+ * @note:	HashMap_load()したテーブルとキーアリーナはファイルのマッピング上にあるため、
+ *       	map_free()では解放せず、map_realloc()ではコピーして移す。
  * @attention:
  =========================================================================================*/
-int HashMap_free(HashMapHandle handle)
+static bool map_is_mapped(HashMapHandle handle, const void *ptr)
 {
-	int ret = OK;
-	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	return (NULL != handle->map_base) && (handle->map_base <= (const char *)ptr) && ((const char *)ptr < handle->map_base + handle->map_size);
+}
 
-	map_cleanup(handle, FULL_CLEANUP);
 
-catch_exit:
-	LOG("Leave %s <- \n", __func__);
-	return ret;
+/*=========================================================================================
+ * @name:	static void map_unmap(HashMapHandle handle)
+ * @brief:	Unmap Snapshot File
+ * @note:	
+ * @attention:	テーブルとキーアリーナを解放した後に呼ぶこと。
+ =========================================================================================*/
+static void map_unmap(HashMapHandle handle)
+{
+#ifdef HASHMAP_HAVE_MMAP
+	if (NULL != handle->map_base) { munmap(handle->map_base, handle->map_size); }
+#endif
+	handle->map_base = NULL;
+	handle->map_size = 0;
 }
 
 
 /*=========================================================================================
- * @name:	int HashMap_insert(HashMapHandle handle, char *key, void *data)
- * @brief:	Register Data on Hash Table
- * @note:
- * @attention:
+ * @name:	static int map_table_size(HashMapHandle handle, int tblsz)
+ * @brief:	Adjust Table Size for Engine
+ * @note:	swissエンジンはグループ単位(CTRL_GROUP)で探索し、グループ番号をマスクで求めるため、
+ *       	CTRL_GROUP以上の2のべき乗に切り上げる。linearエンジンは指定サイズのまま。
+ * @attention:	切り上げでintを超える場合はINVALID_CORDを返す。
  =========================================================================================*/
-int HashMap_insert(HashMapHandle handle, char *key, void *data)
+static int map_table_size(HashMapHandle handle, int tblsz)
 {
-	int ret, hash_value, index;
-	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
-	PRE_KEY_CHECK(key, ret, NG, catch_exit);
+	int size = CTRL_GROUP;
+
+	if (HASHMAP_ENGINE_SWISS != handle->engine) { return tblsz; }
+
+	while (size < tblsz) {
+		if ((INT_MAX / 2) < size) { return INVALID_CORD; }
+		size *= 2;
+	}
+	return size;
+}
 
-	LOG("handle_id=%d key=\"%s\" @%s \n", handle->hdl_id, key, __func__);
 
-	/*! search to check key is already registerd */
-	hash_value = handle->hash(key, handle->tblsz);
-	if (INVALID_CORD < map_find(handle, key, hash_value, NULL)) {
+/*=========================================================================================
+ * @name:	static int map_table_alloc(HashMapHandle handle, HashTable *t, int tblsz)
+ * @brief:	Allocate Hash Table Body
+ * @note:	制御バイト配列、キーのスロット配列、データを格納する連続領域(tblsz * cellsz)を
+ *       	1回ずつ確保する。制御バイトはすべてCTRL_EMPTYで初期化する。
+ *       	キャッシュモードでは参照ビットの配列(tblsz byte)も確保する。
+ *       	期限モードでは期限の配列(tblsz * 8 byte)も確保する。
+ *       	テーブルサイズはエンジンに合わせて切り上げる。(map_table_size参照)
+ * @attention:	失敗時は何も確保しない。
+ =========================================================================================*/
+static int map_table_alloc(HashMapHandle handle, HashTable *t, int tblsz)
+{
+	int ret = OK;
+	size_t cellsz = handle->cellsz;
+
+	tblsz = map_table_size(handle, tblsz);
+	if ((INVALID_CORD == tblsz) || (((size_t)-1 / cellsz) < (size_t)tblsz)) {
+		DIAG("error ! table size overflow ! [%d * %zd byte] \n", tblsz, cellsz);
 		ret = NG;
-		fprintf(stderr, "error ! \"%s\" is already registerd ! @HashMap_insert() \n", key);
 		goto catch_exit;
 	}
 
-	/*! search blank table */
-	index = map_find(handle, INIT_KEY, hash_value, NULL);
-	if (index == INVALID_CORD) {
-		fprintf(stderr, "error ! \"%s\" failed to register hash table ! @HashMap_insert() \n", key);
+	t->ctrl = (unsigned char *)map_alloc(handle, tblsz);
+	t->slots = (HashData *)map_alloc(handle, sizeof(HashData) * tblsz);
+	t->values = (char *)map_alloc(handle, cellsz * tblsz);
+	t->refs = (handle->cache) ? ((unsigned char *)map_alloc(handle, tblsz)) : (NULL);
+	t->expires = (handle->expiry) ? ((uint64_t *)map_alloc(handle, sizeof(uint64_t) * tblsz)) : (NULL);
+	t->tblsz = tblsz;
+	if ((NULL == t->ctrl) || (NULL == t->slots) || (NULL == t->values) ||
+	    (handle->cache && (NULL == t->refs)) || (handle->expiry && (NULL == t->expires))) {
+		DIAG("error ! memory alocate failed ! [%zd byte] \n", (sizeof(HashData) + cellsz + 2 + sizeof(uint64_t)) * tblsz);
+		map_table_free(handle, t);
 		ret = NG;
-	} else {
-		strcpy(handle->hash_table[index].key, key);
-		memcpy(handle->hash_table[index].container, data, handle->cellsz);
-		LOG("addr:%08lX -> %08lX (%zd B) \n", (unsigned long)data, (unsigned long)(handle->hash_table[index].container), handle->cellsz);
-		ret = OK;
+		goto catch_exit;
 	}
+	memset(t->ctrl, CTRL_EMPTY, tblsz);
+	if (NULL != t->refs) { memset(t->refs, 0, tblsz); }
+	if (NULL != t->expires) { memset(t->expires, 0, sizeof(uint64_t) * tblsz); }
 
 catch_exit:
-	LOG("Leave %s <- \n", __func__);
 	return ret;
 }
 
 
 /*=========================================================================================
- * @name:	void* HashMap_get(HashMapHandle handle, char *key)
- * @brief:	Get Hash Table Element Pointer
- * @note:	返却値はvoidポインタのため、コール側でキャストすること
+ * @name:	static void map_table_free(HashMapHandle handle, HashTable *t)
+ * @brief:	Free Hash Table Body
+ * @note:	確保に失敗した途中のテーブルも解放できる。
  * @attention:	
  =========================================================================================*/
-void* HashMap_get(HashMapHandle handle, char *key)
+static void map_table_free(HashMapHandle handle, HashTable *t)
+{
+	map_free(handle, t->values, handle->cellsz * t->tblsz);
+	map_free(handle, t->slots, sizeof(HashData) * t->tblsz);
+	map_free(handle, t->ctrl, t->tblsz);
+	map_free(handle, t->refs, t->tblsz);
+	map_free(handle, t->expires, sizeof(uint64_t) * t->tblsz);
+	t->ctrl = NULL;
+	t->slots = NULL;
+	t->values = NULL;
+	t->refs = NULL;
+	t->expires = NULL;
+	t->tblsz = 0;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_value(HashMapHandle handle, const HashTable *t, int index)
+ * @brief:	Get Data Pointer of Slot
+ * @note:	データはスロットと同じ並びで連続領域に格納している。
+ * @attention:	
+ =========================================================================================*/
+static void *map_value(HashMapHandle handle, const HashTable *t, int index)
+{
+	return t->values + ((size_t)index * handle->cellsz);
+}
+
+
+/*=========================================================================================
+ * @name:	static const char *map_key(HashMapHandle handle, const HashData *p)
+ * @brief:	Get Key Pointer of Slot
+ * @note:	短いキーはHashData内に、長いキーはキーアリーナに格納している。
+ * @attention:	キーアリーナは拡張時に移動するため、返却値を保持しないこと。
+ =========================================================================================*/
+static const char *map_key(HashMapHandle handle, const HashData *p)
+{
+	if (p->keylen < KEY_INLINE_LEN) {
+		return p->key.buf;
+	}
+	return handle->key_arena + p->key.offset;
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_key_equal(HashMapHandle handle, const HashData *p, const char *key, int len)
+ * @brief:	Compare Key of Slot
+ * @note:	キーアリーナ上のキーは、オフセットが使用範囲内であることを確かめてから比較する。
+ *       	HashMap_peek()は書き込み中のスロットを読むことがあるため、壊れたオフセットで
+ *       	アリーナの外を読まないようにする。
+ * @attention:	
+ =========================================================================================*/
+static bool map_key_equal(HashMapHandle handle, const HashData *p, const char *key, int len)
+{
+	if (len != p->keylen) { return false; }
+	if (len < KEY_INLINE_LEN) {
+		return (0 == memcmp(p->key.buf, key, len));
+	}
+	if ((handle->arena_used < p->key.offset) || ((handle->arena_used - p->key.offset) < (size_t)len)) { return false; }
+	return (0 == memcmp(handle->key_arena + p->key.offset, key, len));
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_store_key(HashMapHandle handle, HashData *p, const char *key, int len)
+ * @brief:	Store Key on Slot
+ * @note:	KEY_INLINE_LEN未満のキーはスロット内に、それ以外はキーアリーナの末尾に追記する。
+ *       	どちらも'\0'で終端する(fookされたhash関数にそのまま渡せるようにするため)。
+ *       	キーアリーナは位置ではなくオフセットで参照するので、reallocで移動しても問題ない。
+ * @attention:	
+ =========================================================================================*/
+static int map_store_key(HashMapHandle handle, HashData *p, const char *key, int len)
+{
+	int ret = OK;
+
+	if (len < KEY_INLINE_LEN) {
+		memcpy(p->key.buf, key, len);
+		p->key.buf[len] = '\0';
+		p->keylen = len;
+		goto catch_exit;
+	}
+
+	if ((handle->arena_size - handle->arena_used) < ((size_t)len + 1)) {
+		size_t size = (0 == handle->arena_size) ? (KEY_ARENA_MIN) : (handle->arena_size * 2);
+		char *arena;
+		while (size < (handle->arena_used + len + 1)) { size *= 2; }
+		arena = (char *)map_realloc(handle, handle->key_arena, handle->arena_size, size);
+		if (NULL == arena) {
+			DIAG("error ! memory alocate failed ! [%zd byte] \n", size);
+			ret = NG;
+			goto catch_exit;
+		}
+		handle->key_arena = arena;
+		handle->arena_size = size;
+	}
+	memcpy(handle->key_arena + handle->arena_used, key, len);
+	handle->key_arena[handle->arena_used + len] = '\0';
+	p->key.offset = handle->arena_used;
+	p->keylen = len;
+	handle->arena_used += (size_t)len + 1;
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_release_key(HashMapHandle handle, HashData *p)
+ * @brief:	Release Key of Slot
+ * @note:	キーアリーナ上のキーは解放せず、未使用量として数える。(map_arena_compact参照)
+ * @attention:	
+ =========================================================================================*/
+static void map_release_key(HashMapHandle handle, HashData *p)
+{
+	if (KEY_INLINE_LEN <= p->keylen) {
+		handle->arena_dead += (size_t)p->keylen + 1;
+	}
+	p->keylen = 0;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_arena_compact(HashMapHandle handle)
+ * @brief:	Compact Key Arena
+ * @note:	削除されたキーがキーアリーナの半分を超えた場合に、登録中の長いキーだけを
+ *       	新しいアリーナに詰め直す。
+ * @attention:	失敗した場合は何もしない(次の機会に再度試みる)。
+ =========================================================================================*/
+static int map_arena_compact(HashMapHandle handle)
+{
+	int i, end, ret = OK;
+	size_t size = KEY_ARENA_MIN;
+	size_t used = 0;
+	char *arena;
+
+	if ((handle->arena_dead < KEY_ARENA_MIN) || ((handle->arena_dead * 2) <= handle->arena_used)) { goto catch_exit; }
+
+	while (size < (handle->arena_used - handle->arena_dead)) { size *= 2; }
+	arena = (char *)map_alloc(handle, size);
+	if (NULL == arena) {
+		DIAG("error ! memory alocate failed ! [%zd byte] \n", size);
+		ret = NG;
+		goto catch_exit;
+	}
+	end = handle->old.tblsz + handle->table.tblsz;
+	for (i=map_iter_seek(handle, 0, end); i<end; i=map_iter_seek(handle, i + 1, end)) {
+		HashData *p = map_iter_slot(handle, i);
+		if (p->keylen < KEY_INLINE_LEN) { continue; }
+		memcpy(arena + used, handle->key_arena + p->key.offset, (size_t)p->keylen + 1);
+		p->key.offset = used;
+		used += (size_t)p->keylen + 1;
+	}
+	map_free(handle, handle->key_arena, handle->arena_size);
+	handle->key_arena = arena;
+	handle->arena_size = size;
+	handle->arena_used = used;
+	handle->arena_dead = 0;
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static unsigned int map_hash(HashMapHandle handle, const char *key, int len, int tblsz)
+ * @brief:	Calculate Hash Value to Cache
+ * @note:	組み込みのhash関数はテーブルサイズに依存しない値を返す。
+ *       	fookされたhash関数はテーブルサイズ毎の値(=ホーム位置)しか得られないため、
+ *       	そのままキャッシュし、リハッシュ時のみ再計算する。
+ *       	凍結したテーブルはmap_find_frozen()が自分でハッシュするので計算しない。
+ * @attention:	fookされたhash関数を使う場合、keyは'\0'で終端していること。
+ =========================================================================================*/
+static unsigned int map_hash(HashMapHandle handle, const char *key, int len, int tblsz)
+{
+	if (handle->frozen) {
+		return 0;	/* not used. (see map_find_frozen) */
+	}
+	if (NULL != handle->hash_full) {
+		return handle->hash_full(key, len, handle->seed);
+	}
+	return (unsigned int)handle->hash((char *)key, tblsz);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_home(HashMapHandle handle, unsigned int hash, int tblsz)
+ * @brief:	Get Home Slot from Hash Value
+ * @note:	テーブルサイズが2のべき乗の場合は剰余の代わりにマスクを使う。
+ * @attention:	
+ =========================================================================================*/
+static int map_home(HashMapHandle handle, unsigned int hash, int tblsz)
+{
+	if (NULL != handle->hash_full) {
+		if (0 == (tblsz & (tblsz - 1))) {
+			return (int)(hash & (unsigned int)(tblsz - 1));
+		}
+		return (int)(hash % (unsigned int)tblsz);
+	}
+	return (int)hash;
+}
+
+
+/*=========================================================================================
+ * @name:	static unsigned char map_h2(HashMapHandle handle, unsigned int hash)
+ * @brief:	Make Control Byte from Hash Value
+ * @note:	ハッシュ値の断片(7bit)にCTRL_FULLを立てた値。ホーム位置は下位ビットから求めるので、
+ *       	組み込みのhash関数では上位7bitを使う。fookされたhash関数はホーム位置しか得られない
+ *       	ため、下位7bitを使う。
+ * @attention:	
+ =========================================================================================*/
+static unsigned char map_h2(HashMapHandle handle, unsigned int hash)
+{
+	if (NULL != handle->hash_full) {
+		return (unsigned char)(CTRL_FULL | (hash >> 25));
+	}
+	return (unsigned char)(CTRL_FULL | (hash & 0x7F));
+}
+
+
+#if defined(__SSE2__)
+/*=========================================================================================
+ * @name:	static unsigned int map_group_match(const unsigned char *ctrl, unsigned char c)
+ * @brief:	Match Control Bytes of Group (SSE2)
+ * @note:	ctrlからCTRL_GROUP個の制御バイトをcと比較し、一致した位置のビットを立てて返す。
+ * @attention:	ctrlはCTRL_GROUP個読める位置であること。
+ =========================================================================================*/
+static unsigned int map_group_match(const unsigned char *ctrl, unsigned char c)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+}
+
+
+/*=========================================================================================
+ * @name:	static unsigned int map_group_full(const unsigned char *ctrl)
+ * @brief:	Match Occupied Slots of Group (SSE2)
+ * @note:	使用中の制御バイトは最上位ビット(CTRL_FULL)が立っているので、movemaskだけで求まる。
+ * @attention:	ctrlはCTRL_GROUP個読める位置であること。
+ =========================================================================================*/
+static unsigned int map_group_full(const unsigned char *ctrl)
+{
+	return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+/*=========================================================================================
+ * @name:	static unsigned int map_group_match(const unsigned char *ctrl, unsigned char c)
+ * @brief:	Match Control Bytes of Group (Scalar)
+ * @note:	SSE2が使えない環境向け。8byteずつまとめて比較する(SWAR)。
+ * @attention:	ctrlはCTRL_GROUP個読める位置であること。
+ =========================================================================================*/
+static unsigned int map_group_match(const unsigned char *ctrl, unsigned char c)
+{
+	unsigned int bits = 0;
+	int i, j;
+
+	for (i=0; i<CTRL_GROUP; i+=8) {
+		uint64_t word;
+		memcpy(&word, ctrl + i, sizeof(word));
+		word ^= UINT64_C(0x0101010101010101) * c;
+		/* 一致したbyteだけ最上位ビットが立つ */
+		word = ~(((word & UINT64_C(0x7F7F7F7F7F7F7F7F)) + UINT64_C(0x7F7F7F7F7F7F7F7F)) | word | UINT64_C(0x7F7F7F7F7F7F7F7F));
+		for (j=0; j<8; j++) {
+			if (word & (UINT64_C(0x80) << (j * 8))) { bits |= 1u << (i + j); }
+		}
+	}
+	return bits;
+}
+
+
+/*=========================================================================================
+ * @name:	static unsigned int map_group_full(const unsigned char *ctrl)
+ * @brief:	Match Occupied Slots of Group (Scalar)
+ * @note:	SSE2が使えない環境向け。
+ * @attention:	ctrlはCTRL_GROUP個読める位置であること。
+ =========================================================================================*/
+static unsigned int map_group_full(const unsigned char *ctrl)
+{
+	unsigned int bits = 0;
+	int i;
+
+	for (i=0; i<CTRL_GROUP; i++) {
+		if (CTRL_FULL & ctrl[i]) { bits |= 1u << i; }
+	}
+	return bits;
+}
+#endif
+
+
+/*=========================================================================================
+ * @name:	static int map_ctz(unsigned int bits)
+ * @brief:	Count Trailing Zero Bits
+ * @note:	グループの一致ビットから最初のスロット位置を求める。
+ * @attention:	bitsは0以外であること。
+ =========================================================================================*/
+static int map_ctz(unsigned int bits)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(bits);
+#else
+	int n = 0;
+	while (0 == (bits & 1u)) { bits >>= 1; n++; }
+	return n;
+#endif
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_find_linear(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+ * @brief:	Find Key on Hash Table (Linear Probing)
+ * @note:	未使用(CTRL_EMPTY)のスロットに到達した時点で探索を打ち切る。
+ *       	削除済み(CTRL_DELETED)のスロットは読み飛ばして探索を続ける。
+ *       	制御バイトのハッシュ断片が一致した場合のみスロットを読み、
+ *       	キャッシュしたハッシュ値とキー長が一致した場合のみキーを比較する。
+ *       	blankがNULLでなければ、見つからなかった時に探索中に通過した最初の空き
+ *       	(削除済みか未使用)スロットを返す。探索を一度で済ませるため。(map_emplace参照)
+ * @attention:	hashはtに対するmap_hash()の値。blankは呼び出し側でINVALID_CORDに初期化すること。
+ =========================================================================================*/
+static int map_find_linear(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+{
+	int i, end, index;
+	int ret = INVALID_CORD;
+	unsigned char h2 = map_h2(handle, hash);
+
+	index = map_home(handle, hash, t->tblsz);
+	LOG("key=%.*s, hash=%d \n", len, key, index);
+
+	end = (0==index) ? (t->tblsz - 1) : (index - 1);
+	for (i=index; ; i=(i+1 == t->tblsz) ? (0) : (i+1)) {
+		//LOG("- [%2d] key=%s \n", i, map_key(handle, &t->slots[i]));
+		if (CTRL_EMPTY == t->ctrl[i]) {
+			if ((NULL != blank) && (INVALID_CORD == *blank)) { *blank = i; }
+			ret = INVALID_CORD;	/* miss */
+			break;
+		}
+		if ((h2 == t->ctrl[i]) && (hash == t->slots[i].hash) && map_key_equal(handle, &t->slots[i], key, len)) {
+			ret = i;		/* hit */
+			break;
+		} else {
+			(*misshit)++;
+			if ((NULL != blank) && (INVALID_CORD == *blank) && (CTRL_DELETED == t->ctrl[i])) { *blank = i; }
+		}
+		if (end == i) {
+			ret = INVALID_CORD;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_find_swiss(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+ * @brief:	Find Key on Hash Table (Swiss Group Probing)
+ * @note:	テーブルをCTRL_GROUP個ずつのグループに分け、ホーム位置のグループから三角数列
+ *       	(+1, +2, +3, ...)でグループを辿る。グループ内はmap_group_match()で16スロットを
+ *       	一度に調べ、ハッシュ断片が一致したスロットだけキーを比較する。
+ *       	未使用スロットを含むグループで見つからなければ、その先には無い。
+ *       	blankはmap_find_linear()と同じ。(最初に空きを持つグループの先頭の空きスロット)
+ * @attention:	テーブルサイズはCTRL_GROUP以上の2のべき乗であること。(map_table_size参照)
+ *           	misshitは断片の偽一致と、追加で辿ったグループの数を数える。
+ =========================================================================================*/
+static int map_find_swiss(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+{
+	int n, i;
+	int groups = t->tblsz / CTRL_GROUP;
+	int g = map_home(handle, hash, t->tblsz) / CTRL_GROUP;
+	unsigned char h2 = map_h2(handle, hash);
+	LOG("key=%.*s, group=%d \n", len, key, g);
+
+	for (n=1; n<=groups; n++) {
+		const unsigned char *ctrl = &(t->ctrl[g * CTRL_GROUP]);
+		unsigned int bits = map_group_match(ctrl, h2);
+		while (0 != bits) {
+			i = g * CTRL_GROUP + map_ctz(bits);
+			if ((hash == t->slots[i].hash) && map_key_equal(handle, &t->slots[i], key, len)) {
+				return i;	/* hit */
+			}
+			(*misshit)++;
+			bits &= bits - 1;
+		}
+		if ((NULL != blank) && (INVALID_CORD == *blank)) {
+			bits = ~map_group_full(ctrl) & ((1u << CTRL_GROUP) - 1);
+			if (0 != bits) { *blank = g * CTRL_GROUP + map_ctz(bits); }
+		}
+		if (0 != map_group_match(ctrl, CTRL_EMPTY)) { break; }	/* miss */
+		(*misshit)++;
+		g = (g + n) & (groups - 1);
+	}
+
+	return INVALID_CORD;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_robin_dist(HashMapHandle handle, const HashTable *t, int index)
+ * @brief:	Probe Distance of Slot
+ * @note:	スロットの位置とホーム位置の距離を返す。(robin hood)
+ * @attention:	indexは使用中のスロットであること。
+ =========================================================================================*/
+static int map_robin_dist(HashMapHandle handle, const HashTable *t, int index)
+{
+	int home = map_home(handle, t->slots[index].hash, t->tblsz);
+	return (home <= index) ? (index - home) : (index + t->tblsz - home);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_find_robin(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+ * @brief:	Find Key on Hash Table (Robin Hood)
+ * @note:	探索順はlinearと同じ。登録時にホーム位置から遠いキーを優先して置くため、
+ *       	各クラスタ内でキーはホーム位置順に並ぶ。よって探索距離よりも距離の短いキーに
+ *       	出会った時点で、その先には無いと判断して打ち切る。
+ *       	blankには打ち切った位置(登録すべき位置)を返す。(map_make_room参照)
+ * @attention:	現在のテーブルには墓標は無い。移行中の旧テーブルには移行済みの墓標があるが、
+ *           	残ったキーは動かないので打ち切りの判断は変わらない。
+ =========================================================================================*/
+static int map_find_robin(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+{
+	int i, d;
+	unsigned char h2 = map_h2(handle, hash);
+
+	i = map_home(handle, hash, t->tblsz);
+	LOG("key=%.*s, hash=%d \n", len, key, i);
+
+	for (d=0; d<t->tblsz; d++, i=(i+1 == t->tblsz) ? (0) : (i+1)) {
+		if (CTRL_EMPTY == t->ctrl[i]) { break; }	/* miss */
+		if (CTRL_DELETED == t->ctrl[i]) {
+			(*misshit)++;
+			continue;
+		}
+		if ((h2 == t->ctrl[i]) && (hash == t->slots[i].hash) && map_key_equal(handle, &t->slots[i], key, len)) {
+			return i;	/* hit */
+		}
+		if (map_robin_dist(handle, t, i) < d) { break; }	/* miss (richer slot) */
+		(*misshit)++;
+	}
+
+	if ((NULL != blank) && (d < t->tblsz)) { *blank = i; }
+	return INVALID_CORD;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_find(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+ * @brief:	Find Key on Hash Table
+ * @note:	エンジンに応じた探索を行う。
+ * @attention:	hashはtに対するmap_hash()の値。misshit、blankはNULL可。
+ =========================================================================================*/
+static int map_find(HashMapHandle handle, const HashTable *t, const char *key, int len, unsigned int hash, int *misshit, int *blank)
+{
+	int dummy = 0;
+
+	/* Invalid misshit */
+	if (NULL == misshit) { misshit = &dummy; }
+
+	if (HASHMAP_ENGINE_SWISS == handle->engine) {
+		return map_find_swiss(handle, t, key, len, hash, misshit, blank);
+	}
+	if (HASHMAP_ENGINE_ROBINHOOD == handle->engine) {
+		return map_find_robin(handle, t, key, len, hash, misshit, blank);
+	}
+	return map_find_linear(handle, t, key, len, hash, misshit, blank);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_find_blank(HashMapHandle handle, const HashTable *t, unsigned int hash)
+ * @brief:	Find Blank Slot on Hash Table
+ * @note:	未使用または削除済みのスロットを返す。削除済みスロットは再利用する。
+ *       	探索順はmap_find()と同じ。
+ *       	robin hood: 登録すべき位置を返す。使用中の場合があるため、map_make_room()で空けること。
+ * @attention:	キーが未登録であることを確認した後に呼び出すこと。
+ =========================================================================================*/
+static int map_find_blank(HashMapHandle handle, const HashTable *t, unsigned int hash)
+{
+	int i, n, end, index;
+	int ret = INVALID_CORD;
+
+	index = map_home(handle, hash, t->tblsz);
+
+	if (HASHMAP_ENGINE_SWISS == handle->engine) {
+		int groups = t->tblsz / CTRL_GROUP;
+		int g = index / CTRL_GROUP;
+		for (n=1; n<=groups; n++) {
+			unsigned int bits = ~map_group_full(&(t->ctrl[g * CTRL_GROUP])) & ((1u << CTRL_GROUP) - 1);
+			if (0 != bits) {
+				ret = g * CTRL_GROUP + map_ctz(bits);
+				break;
+			}
+			g = (g + n) & (groups - 1);
+		}
+		goto catch_exit;
+	}
+
+	if (HASHMAP_ENGINE_ROBINHOOD == handle->engine) {
+		for (n=0, i=index; n<t->tblsz; n++, i=(i+1 == t->tblsz) ? (0) : (i+1)) {
+			if ((0 == (CTRL_FULL & t->ctrl[i])) || (map_robin_dist(handle, t, i) < n)) {
+				ret = i;
+				break;
+			}
+		}
+		goto catch_exit;
+	}
+
+	end = (0==index) ? (t->tblsz - 1) : (index - 1);
+	for (i=index; ; i=(i+1 == t->tblsz) ? (0) : (i+1)) {
+		if (0 == (CTRL_FULL & t->ctrl[i])) {
+			ret = i;
+			break;
+		}
+		if (end == i) {
+			ret = INVALID_CORD;
+			break;
+		}
+	}
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_move_slot(HashMapHandle handle, HashTable *t, int dst, int src)
+ * @brief:	Move Slot
+ * @note:	スロット、制御バイト、データ、参照ビット、期限を移す。srcはそのまま残る。
+ * @attention:
+ =========================================================================================*/
+static void map_move_slot(HashMapHandle handle, HashTable *t, int dst, int src)
+{
+	map_stats_probe(handle, t, src, -1);
+	t->slots[dst] = t->slots[src];
+	t->ctrl[dst] = t->ctrl[src];
+	memcpy(map_value(handle, t, dst), map_value(handle, t, src), handle->cellsz);
+	if (NULL != t->refs) { t->refs[dst] = t->refs[src]; }
+	if (NULL != t->expires) { t->expires[dst] = t->expires[src]; }
+	map_stats_probe(handle, t, dst, 1);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_make_room(HashMapHandle handle, HashTable *t, int index)
+ * @brief:	Make Slot Blank for Registration
+ * @note:	robin hood: indexから次の空きスロットまでを一つずつ後ろへずらし、indexを空ける。
+ *       	ずらしたキーはホーム位置から一つ遠くなるだけで、並び順は変わらない。
+ *       	(距離の短いキーと入れ替えながら進むrobin hoodの登録と同じ結果になる)
+ *       	他のエンジンではmap_find_blank()の返すスロットは空いているので何もしない。
+ * @attention:	空きスロットが無ければNGを返す。
+ =========================================================================================*/
+static int map_make_room(HashMapHandle handle, HashTable *t, int index)
+{
+	int i, n;
+
+	if ((HASHMAP_ENGINE_ROBINHOOD != handle->engine) || (0 == (CTRL_FULL & t->ctrl[index]))) {
+		return OK;
+	}
+
+	for (n=0, i=index; n<t->tblsz; n++, i=(i+1 == t->tblsz) ? (0) : (i+1)) {
+		if (0 == (CTRL_FULL & t->ctrl[i])) { break; }
+	}
+	if (n == t->tblsz) {
+		return NG;
+	}
+
+	while (i != index) {
+		int prev = (0==i) ? (t->tblsz - 1) : (i - 1);
+		map_move_slot(handle, t, i, prev);
+		i = prev;
+	}
+	t->ctrl[index] = CTRL_EMPTY;
+	return OK;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_mphf_bucket(uint64_t h, int buckets)
+ * @brief:	Bucket of Perfect Hash
+ * @note:	上位32bitを[0, buckets)に写す。(剰余の代わりに乗算)
+ * @attention:
+ =========================================================================================*/
+static int map_mphf_bucket(uint64_t h, int buckets)
+{
+	return (int)(((h >> 32) * (uint64_t)buckets) >> 32);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_mphf_slot(uint64_t h, uint32_t pilot, int tblsz)
+ * @brief:	Slot of Perfect Hash
+ * @note:	キーのハッシュ値とバケットのパイロットを混ぜて[0, tblsz)に写す。
+ *       	バケット毎に、属するキーが全て空きスロットに入るパイロットを選んである。
+ * @attention:
+ =========================================================================================*/
+static int map_mphf_slot(uint64_t h, uint32_t pilot, int tblsz)
+{
+	uint64_t x = h ^ ((uint64_t)pilot * 0x9e3779b97f4a7c15ull);
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	return (int)(((x >> 32) * (uint64_t)tblsz) >> 32);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_find_frozen(HashMapHandle handle, const char *key, int len)
+ * @brief:	Find Key on Frozen Hash Table
+ * @note:	ハッシュ1回、スロット1つ、キー比較1回。探索はしない。
+ * @attention:	未登録のキーも何れかのスロットに写るため、必ずキーを比較する。
+ =========================================================================================*/
+static int map_find_frozen(HashMapHandle handle, const char *key, int len)
+{
+	uint64_t h;
+	int index;
+	const HashData *p;
+
+	if (0 == handle->table.tblsz) { return INVALID_CORD; }
+
+	h = hash_wyhash64(key, len, handle->mphf_seed);
+	index = map_mphf_slot(h, handle->pilots[map_mphf_bucket(h, handle->buckets)], handle->table.tblsz);
+	p = &(handle->table.slots[index]);
+	if (((unsigned int)h == p->hash) && map_key_equal(handle, p, key, len)) {
+		return index;
+	}
+	return INVALID_CORD;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_lookup(HashMapHandle handle, const char *key, int len, unsigned int hash, HashTable **found)
+ * @brief:	Find Key on Current and Migrating Hash Table
+ * @note:	hashは現在のテーブルに対するmap_hash()の値。
+ *       	インクリメンタルリハッシュ中は新旧両方のテーブルを探索する。
+ *       	凍結したテーブルはhashを使わない。
+ *       	foundには見つかったテーブルを返す(NULL可)。
+ * @attention:	
+ =========================================================================================*/
+static int map_lookup(HashMapHandle handle, const char *key, int len, unsigned int hash, HashTable **found)
+{
+	int index;
+	HashTable *dummy;
+
+	if (NULL == found) { found = &dummy; }
+
+	*found = &(handle->table);
+	if (handle->frozen) { return map_find_frozen(handle, key, len); }
+	index = map_find(handle, &(handle->table), key, len, hash, NULL, NULL);
+	if ((INVALID_CORD == index) && (NULL != handle->old.slots)) {
+		if (NULL == handle->hash_full) { hash = map_hash(handle, key, len, handle->old.tblsz); }
+		*found = &(handle->old);
+		index = map_find(handle, &(handle->old), key, len, hash, NULL, NULL);
+	}
+	return index;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_occupy(HashMapHandle handle, HashTable *t, int index, unsigned int hash)
+ * @brief:	Mark Slot as Occupied
+ * @note:	制御バイトにハッシュ断片を書き込む。墓標を再利用した場合は墓標数を減らす。
+ *       	参照ビットは落とす。(一度も参照されないキーから追い出す) 期限は無しにする。
+ * @attention:	キーとデータは呼び出し側で格納すること。
+ =========================================================================================*/
+static void map_occupy(HashMapHandle handle, HashTable *t, int index, unsigned int hash)
+{
+	if ((CTRL_DELETED == t->ctrl[index]) && (t == &(handle->table))) { handle->deleted--; }
+	t->ctrl[index] = map_h2(handle, hash);
+	t->slots[index].hash = hash;
+	if (NULL != t->refs) { t->refs[index] = 0; }
+	if (NULL != t->expires) { t->expires[index] = 0; }
+	map_stats_probe(handle, t, index, 1);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_probe_len(HashMapHandle handle, const HashTable *t, int index)
+ * @brief:	Probe Length of Slot
+ * @note:	キーを見つけるまでに余分に調べる長さを返す。
+ *       	linear/robin hood: ホーム位置からのスロット数。swiss: 追加で辿るグループ数。
+ * @attention:	indexは使用中のスロットであること。
+ =========================================================================================*/
+static int map_probe_len(HashMapHandle handle, const HashTable *t, int index)
+{
+	int n, g, groups;
+
+	if (HASHMAP_ENGINE_SWISS != handle->engine) {
+		return map_robin_dist(handle, t, index);
+	}
+
+	groups = t->tblsz / CTRL_GROUP;
+	g = map_home(handle, t->slots[index].hash, t->tblsz) / CTRL_GROUP;
+	for (n=0; (n < groups) && (g != index / CTRL_GROUP); n++) {
+		g = (g + n + 1) & (groups - 1);
+	}
+	return n;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_stats_probe(HashMapHandle handle, const HashTable *t, int index, int delta)
+ * @brief:	Count Probe Length of Slot
+ * @note:	キーを置いた時にdelta=1、取り除く時にdelta=-1で呼び、探索長のヒストグラムと
+ *       	合計を更新する。HashMap_stats()を全キーの探索無しで返すため。
+ * @attention:	handleのテーブル以外(作成中のテーブル)は数えない。(map_stats_rebuild参照)
+ =========================================================================================*/
+static void map_stats_probe(HashMapHandle handle, const HashTable *t, int index, int delta)
+{
+	int len;
+
+	if ((t != &(handle->table)) && (t != &(handle->old))) { return; }
+
+	len = map_probe_len(handle, t, index);
+	handle->probe_hist[(len < HASHMAP_PROBE_HIST) ? (len) : (HASHMAP_PROBE_HIST - 1)] += delta;
+	handle->probe_sum += (long long)delta * len;
+	if (handle->probe_peak < len) { handle->probe_peak = len; }
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_stats_rebuild(HashMapHandle handle)
+ * @brief:	Recount Probe Length of All Keys
+ * @note:	テーブルを作り直した時に呼ぶ。
+ * @attention:
+ =========================================================================================*/
+static void map_stats_rebuild(HashMapHandle handle)
+{
+	int i;
+
+	memset(handle->probe_hist, 0, sizeof(handle->probe_hist));
+	handle->probe_sum = 0;
+	handle->probe_peak = 0;
+	for (i=0; i<handle->old.tblsz; i++) {
+		if (CTRL_FULL & handle->old.ctrl[i]) { map_stats_probe(handle, &(handle->old), i, 1); }
+	}
+	for (i=0; i<handle->table.tblsz; i++) {
+		if (CTRL_FULL & handle->table.ctrl[i]) { map_stats_probe(handle, &(handle->table), i, 1); }
+	}
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_remove_at(HashMapHandle handle, HashTable *t, int index)
+ * @brief:	Remove Slot and Cleanup Tombstones
+ * @note:	linear: スロットを削除済みにする。次のスロットが未使用であれば、そこで終わる探索列は
+ *       	存在しないため、直前に連続する削除済みスロットごと未使用に戻す。
+ *       	swiss: 同じグループに未使用スロットがあれば、そのグループを通り過ぎた探索列は
+ *       	存在しないため、墓標を残さず未使用に戻す。
+ *       	robin hood: 後続のキーをホーム位置に着くか空きに当たるまで一つずつ前へ詰める
+ *       	(backward shift)。墓標は残さない。ただし移行中の旧テーブルは墓標にする。
+ * @attention:	旧テーブル(移行中)の墓標は移行完了時にまとめて捨てるので数えない。
+ *           	robin hoodではイテレーション中に登録/削除すると、要素を飛ばしたり
+ *           	二度返したりすることがある。
+ =========================================================================================*/
+static void map_remove_at(HashMapHandle handle, HashTable *t, int index)
+{
+	bool counted = (t == &(handle->table));
+	int i = index;
+	int next = (index + 1 == t->tblsz) ? (0) : (index + 1);
+
+	map_stats_probe(handle, t, index, -1);
+	if (handle->cache) { handle->cache_bytes -= (size_t)t->slots[index].keylen + handle->cellsz; }
+	map_release_key(handle, &(t->slots[index]));
+	handle->count--;
+
+	if (HASHMAP_ENGINE_SWISS == handle->engine) {
+		if (0 != map_group_match(&(t->ctrl[index & ~(CTRL_GROUP - 1)]), CTRL_EMPTY)) {
+			t->ctrl[index] = CTRL_EMPTY;
+		} else {
+			t->ctrl[index] = CTRL_DELETED;
+			if (counted) { handle->deleted++; }
+		}
+		return;
+	}
+
+	if ((HASHMAP_ENGINE_ROBINHOOD == handle->engine) && counted) {
+		for (;;) {
+			if ((0 == (CTRL_FULL & t->ctrl[next])) || (0 == map_robin_dist(handle, t, next))) { break; }
+			map_move_slot(handle, t, i, next);
+			i = next;
+			next = (next + 1 == t->tblsz) ? (0) : (next + 1);
+		}
+		t->ctrl[i] = CTRL_EMPTY;
+		return;
+	}
+
+	t->ctrl[index] = CTRL_DELETED;
+	if (counted) { handle->deleted++; }
+
+	if (CTRL_EMPTY != t->ctrl[next]) { return; }
+
+	while (CTRL_DELETED == t->ctrl[i]) {
+		t->ctrl[i] = CTRL_EMPTY;
+		if (counted) { handle->deleted--; }
+		i = (0==i) ? (t->tblsz - 1) : (i - 1);
+	}
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_touch(const HashTable *t, int index)
+ * @brief:	Set Reference Bit of Slot
+ * @note:	キャッシュモードで参照されたキーに印を付ける。CLOCKの針が通るまで追い出されない。
+ *       	既に立っていれば書き込まない。(キャッシュラインを汚さない)
+ * @attention:	キャッシュモードでなければ(refsがNULL)何もしない。
+ =========================================================================================*/
+static void map_touch(const HashTable *t, int index)
+{
+	if ((NULL != t->refs) && (0 == t->refs[index])) { t->refs[index] = 1; }
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_clock_victim(HashMapHandle handle)
+ * @brief:	Select Eviction Victim by CLOCK
+ * @note:	針の位置から使用中のスロットを巡り、参照ビットが立っていれば落として進み、
+ *       	落ちているスロットを返す。空きと墓標はmap_ctrl_scan()で読み飛ばす。
+ *       	全キーの参照ビットが立っていても、2周目で必ず見つかる。
+ * @attention:	登録数が1以上であること。インクリメンタルリハッシュ中でないこと。
+ =========================================================================================*/
+static int map_clock_victim(HashMapHandle handle)
+{
+	HashTable *t = &(handle->table);
+	int i = handle->clock_hand;
+
+	for (;;) {
+		i = map_ctrl_scan(t->ctrl, (i < t->tblsz) ? (i) : (0), t->tblsz);
+		if (t->tblsz == i) {
+			i = 0;
+			continue;
+		}
+		if (0 == t->refs[i]) { break; }
+		t->refs[i] = 0;
+		i++;
+	}
+	return i;
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_cache_over(HashMapHandle handle, int num, size_t add)
+ * @brief:	Check Cache Budget
+ * @note:	num件(合計addバイト)のキーを追加すると、件数、バイト数、テーブルの空きの
+ *       	いずれかが足りなくなる場合にtrueを返す。
+ * @attention:	
+ =========================================================================================*/
+static bool map_cache_over(HashMapHandle handle, int num, size_t add)
+{
+	if ((0 < handle->cache_max) && (handle->cache_max < handle->count + num)) { return true; }
+	if ((0 < handle->cache_max_bytes) && (handle->cache_max_bytes < handle->cache_bytes + add)) { return true; }
+	return (false == handle->resizable) && (handle->table.tblsz < handle->count + num);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_cache_evict(HashMapHandle handle, int num, size_t add)
+ * @brief:	Evict Keys for Registration (Cache Mode)
+ * @note:	num件(合計addバイト、1件はkeylen + cellsz)のキーを追加できるまで、
+ *       	CLOCKで選んだキーを追い出す。
+ *       	追い出す前にevictコールバックを呼ぶ。
+ *       	削除で後続のキーが詰められた場合(robin hood)も読み飛ばさないように、
+ *       	削除した位置がまだ使用中なら針をそこに残す。
+ *       	戻り値は追い出した件数。
+ * @attention:	addが上限バイト数を超える場合は何もしない。(呼び出し側で登録を断ること)
+ =========================================================================================*/
+static int map_cache_evict(HashMapHandle handle, int num, size_t add)
+{
+	HashTable *t = &(handle->table);
+	int i, n = 0;
+
+	if ((0 < handle->cache_max_bytes) && (handle->cache_max_bytes < add)) { return 0; }
+
+	map_rehash_step(handle, INT_MAX);
+	while ((0 < handle->count) && map_cache_over(handle, num, add)) {
+		i = map_clock_victim(handle);
+		if (NULL != handle->evict) {
+			HashData *p = &(t->slots[i]);
+			handle->evict(map_key(handle, p), (size_t)p->keylen, map_value(handle, t, i), handle->evict_arg);
+		}
+		map_remove_at(handle, t, i);
+		handle->clock_hand = (CTRL_FULL & t->ctrl[i]) ? (i) : (i + 1);
+		handle->evictions++;
+		n++;
+	}
+	if (0 < n) { map_arena_compact(handle); }
+	return n;
+}
+
+
+/*=========================================================================================
+ * @name:	static uint64_t map_now(HashMapHandle handle)
+ * @brief:	Current Time of TTL
+ * @note:	HashMap_setExpiry()で時刻関数を指定していればその値を、無ければ単調増加する
+ *       	ミリ秒を返す。
+ * @attention:	
+ =========================================================================================*/
+static uint64_t map_now(HashMapHandle handle)
+{
+	if (NULL != handle->clock) { return handle->clock(handle->clock_arg); }
+#if defined(CLOCK_MONOTONIC)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+	}
+#else
+	return (uint64_t)time(NULL) * 1000;
+#endif
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_expired(HashMapHandle handle, const HashTable *t, int index)
+ * @brief:	Check Slot is Expired
+ * @note:	期限の無いキー(0)は時刻を読まずにfalseを返す。
+ * @attention:	indexは使用中のスロットであること。
+ =========================================================================================*/
+static bool map_expired(HashMapHandle handle, const HashTable *t, int index)
+{
+	if ((NULL == t->expires) || (0 == t->expires[index])) { return false; }
+	return (t->expires[index] <= map_now(handle));
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_reclaim(HashMapHandle handle, HashTable *t, int index)
+ * @brief:	Reclaim Expired Slot on Access (Lazy Expiry)
+ * @note:	期限切れのキーであればtrueを返す。(呼び出し側は未登録として扱う)
+ *       	走査中でなければ、その場で削除する。
+ * @attention:	削除するとrobin hoodでは後続のキーが詰められ、データのアドレスが変わる。
+ =========================================================================================*/
+static bool map_reclaim(HashMapHandle handle, HashTable *t, int index)
+{
+	if (false == map_expired(handle, t, index)) { return false; }
+	if (false == map_is_iterating(handle)) {
+		map_remove_at(handle, t, index);
+		map_arena_compact(handle);
+		handle->expirations++;
+	}
+	return true;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_sweep(HashMapHandle handle, int step)
+ * @brief:	Reclaim Expired Slots Incrementally
+ * @note:	前回の続きからstep個のスロットを調べ、期限切れのキーを削除する。
+ *       	1回の処理量はstepで抑えられ、テーブル全体を一度に走査することはない。
+ *       	(Redisの期限切れキーの回収と同様に、少しずつ巡回する)
+ *       	削除で後続のキーが詰められた場合(robin hood)は、同じ位置をもう一度調べる。
+ *       	戻り値は削除した件数。
+ * @attention:	走査中は何もしない。移行中の旧テーブルは調べない。(移行後に回収する)
+ =========================================================================================*/
+static int map_sweep(HashMapHandle handle, int step)
+{
+	HashTable *t = &(handle->table);
+	uint64_t now;
+	int i, n = 0;
+
+	if ((NULL == t->expires) || (0 == handle->count) || map_is_iterating(handle)) { return 0; }
+
+	now = map_now(handle);
+	i = (handle->sweep_pos < t->tblsz) ? (handle->sweep_pos) : (0);
+	while (0 < step--) {
+		if ((CTRL_FULL & t->ctrl[i]) && (0 != t->expires[i]) && (t->expires[i] <= now)) {
+			map_remove_at(handle, t, i);
+			handle->expirations++;
+			n++;
+			if (CTRL_FULL & t->ctrl[i]) { continue; }
+		}
+		i = (i + 1 == t->tblsz) ? (0) : (i + 1);
+	}
+	handle->sweep_pos = i;
+	if (0 < n) { map_arena_compact(handle); }
+	return n;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_set_ttl(HashMapHandle handle, void *value, uint64_t ttl)
+ * @brief:	Set Expiry Time of Slot by Data Pointer
+ * @note:	map_emplace()が返したデータのポインタからスロットを求め、現在時刻 + ttlを期限にする。
+ *       	ttlが0の場合は期限を無しにする。
+ * @attention:	期限モードであること。
+ =========================================================================================*/
+static void map_set_ttl(HashMapHandle handle, void *value, uint64_t ttl)
+{
+	HashTable *t = &(handle->table);
+	char *p = (char *)value;
+
+	if ((NULL != handle->old.values) && (handle->old.values <= p) && (p < handle->old.values + handle->cellsz * handle->old.tblsz)) {
+		t = &(handle->old);
+	}
+	t->expires[(size_t)(p - t->values) / handle->cellsz] = (0 == ttl) ? (0) : (map_now(handle) + ttl);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_rehash(HashMapHandle handle, int tblsz)
+ * @brief:	Rebuild Hash Table with New Size
+ * @note:	登録済みのキーをhandle->hashで新しいテーブルに再配置し、データをコピーする。
+ *       	墓標はすべて取り除かれる。
+ * @attention:	失敗時はテーブルを変更せずにNGを返す。イテレータ位置は無効になる。
+ *           	インクリメンタルリハッシュ中の場合は、先に移行を完了させる。
+ =========================================================================================*/
+static int map_rehash(HashMapHandle handle, int tblsz)
+{
+	int ret = OK;
+	int i, old_tblsz = handle->table.tblsz;
+	HashTable new_table;
+	uint64_t start = (NULL != handle->trace) ? map_cycles() : 0;
+	LOG("rehash %d -> %d (count=%d deleted=%d) \n", handle->table.tblsz, tblsz, handle->count, handle->deleted);
+
+	map_rehash_step(handle, INT_MAX);
+
+	if (tblsz < handle->count) {
+		DIAG("error ! table size %d is smaller than data num %d ! @%s() \n", tblsz, handle->count, __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	ret = map_table_alloc(handle, &new_table, tblsz);
+	if (NG == ret) { goto catch_exit; }
+
+	/*! move registered data */
+	for (i=0; i<handle->table.tblsz; i++) {
+		HashData *src = &(handle->table.slots[i]);
+		int index;
+		if (0 == (CTRL_FULL & handle->table.ctrl[i])) { continue; }
+		if (NULL == handle->hash_full) { src->hash = map_hash(handle, map_key(handle, src), src->keylen, new_table.tblsz); }
+		index = map_find_blank(handle, &new_table, src->hash);
+		map_make_room(handle, &new_table, index);
+		new_table.slots[index] = *src;
+		new_table.ctrl[index] = map_h2(handle, src->hash);
+		memcpy(map_value(handle, &new_table, index), map_value(handle, &(handle->table), i), handle->cellsz);
+		if ((NULL != new_table.refs) && (NULL != handle->table.refs)) { new_table.refs[index] = handle->table.refs[i]; }
+		if ((NULL != new_table.expires) && (NULL != handle->table.expires)) { new_table.expires[index] = handle->table.expires[i]; }
+	}
+
+	if (tblsz != handle->table.tblsz) { handle->resizes++; }
+	map_table_free(handle, &(handle->table));
+	handle->table = new_table;
+	handle->deleted = 0;
+	handle->iterator_pos = 0;
+	handle->generation++;
+	map_stats_rebuild(handle);
+	if (NULL != handle->trace) {
+		uint64_t cycles = map_trace_op(handle, HASHMAP_OP_RESIZE, start);
+		TRACE_PROBE4(resize, handle, old_tblsz, tblsz, cycles);
+	}
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_rehash_start(HashMapHandle handle, int tblsz)
+ * @brief:	Start Incremental Rehash
+ * @note:	新しいテーブルを確保し、現在のテーブルを旧テーブルとして残す。
+ *       	データの移行はmap_rehash_step()で操作毎に少しずつ行う(Redis方式)。
+ * @attention:	移行中の場合は、先に移行を完了させる。
+ =========================================================================================*/
+static int map_rehash_start(HashMapHandle handle, int tblsz)
+{
+	int ret = OK;
+	int old_tblsz = handle->table.tblsz;
+	HashTable new_table;
+	uint64_t start = (NULL != handle->trace) ? map_cycles() : 0;
+	LOG("rehash start %d -> %d (count=%d deleted=%d) \n", handle->table.tblsz, tblsz, handle->count, handle->deleted);
+
+	map_rehash_step(handle, INT_MAX);
+
+	if (tblsz < handle->count) {
+		DIAG("error ! table size %d is smaller than data num %d ! @%s() \n", tblsz, handle->count, __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	ret = map_table_alloc(handle, &new_table, tblsz);
+	if (NG == ret) { goto catch_exit; }
+
+	if (tblsz != handle->table.tblsz) { handle->resizes++; }
+	handle->old = handle->table;
+	handle->rehash_pos = 0;
+	handle->table = new_table;
+	handle->deleted = 0;
+	handle->iterator_pos = 0;
+	handle->generation++;
+	if (NULL != handle->trace) {
+		uint64_t cycles = map_trace_op(handle, HASHMAP_OP_RESIZE, start);
+		TRACE_PROBE4(resize, handle, old_tblsz, tblsz, cycles);
+	}
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_rehash_step(HashMapHandle handle, int step)
+ * @brief:	Migrate Slots from Old Table
+ * @note:	旧テーブルのスロットをstep個だけ新テーブルへ移す。移したスロットは墓標にするので、
+ *       	旧テーブルに残るキーの探索列は途切れない。全スロットを移したら旧テーブルを解放する。
+ * @attention:	移したデータのアドレスは変わる。
+ =========================================================================================*/
+static void map_rehash_step(HashMapHandle handle, int step)
+{
+	while ((NULL != handle->old.slots) && (0 < step--)) {
+		HashData *src = &(handle->old.slots[handle->rehash_pos]);
+		if (CTRL_FULL & handle->old.ctrl[handle->rehash_pos]) {
+			int index;
+			map_stats_probe(handle, &(handle->old), handle->rehash_pos, -1);
+			if (NULL == handle->hash_full) { src->hash = map_hash(handle, map_key(handle, src), src->keylen, handle->table.tblsz); }
+			index = map_find_blank(handle, &(handle->table), src->hash);
+			map_make_room(handle, &(handle->table), index);
+			handle->table.slots[index] = *src;
+			map_occupy(handle, &(handle->table), index, src->hash);
+			memcpy(map_value(handle, &(handle->table), index), map_value(handle, &(handle->old), handle->rehash_pos), handle->cellsz);
+			if ((NULL != handle->table.refs) && (NULL != handle->old.refs)) { handle->table.refs[index] = handle->old.refs[handle->rehash_pos]; }
+			if ((NULL != handle->table.expires) && (NULL != handle->old.expires)) { handle->table.expires[index] = handle->old.expires[handle->rehash_pos]; }
+			handle->old.ctrl[handle->rehash_pos] = CTRL_DELETED;
+		}
+
+		if (handle->old.tblsz <= ++(handle->rehash_pos)) {
+			LOG("rehash done -> %d \n", handle->table.tblsz);
+			map_table_free(handle, &(handle->old));
+			handle->rehash_pos = 0;
+			handle->generation++;
+		}
+	}
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_reserve(HashMapHandle handle)
+ * @brief:	Grow Hash Table before Insert
+ * @note:	自動リサイズモードの時、1件追加すると負荷率がmax_loadを超える場合にテーブルを
+ *       	growth倍に拡張する。墓標だけで閾値を超える場合は同じサイズで再構築する。
+ * @attention:	キャッシュモードでは常に一括でリハッシュする。(CLOCKは一つのテーブルだけを巡回する)
+ =========================================================================================*/
+static int map_reserve(HashMapHandle handle)
+{
+	int ret = OK;
+	double tblsz = handle->table.tblsz;
+
+	if (false == handle->resizable) { goto catch_exit; }
+	if ((handle->count + handle->deleted + 1) <= (handle->max_load * tblsz)) { goto catch_exit; }
+
+	while ((handle->count + 1) > (handle->max_load * tblsz)) {
+		tblsz = (tblsz * handle->growth < tblsz + 1) ? (tblsz + 1) : (tblsz * handle->growth);
+	}
+	if (INT_MAX < tblsz) {
+		DIAG("error ! table size overflow ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if ((0 < handle->rehash_step) && (false == handle->cache)) {
+		ret = map_rehash_start(handle, (int)tblsz);
+	} else {
+		ret = map_rehash(handle, (int)tblsz);
+	}
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_is_iterating(HashMapHandle handle)
+ * @brief:	Check Iteration is in Progress
+ * @note:	走査中にスロットを移すと、同じ要素を二度返したり読み飛ばしたりするため、
+ *       	走査中はインクリメンタルリハッシュを止める。
+ *       	HashMap_next()の走査と、HashMap_iterInit()した外部イテレータの両方を見る。
+ * @attention:	
+ =========================================================================================*/
+static bool map_is_iterating(HashMapHandle handle)
+{
+	if (0 < handle->iterators) { return true; }
+	return (0 < handle->iterator_pos) && (handle->iterator_pos < (handle->old.tblsz + handle->table.tblsz));
+}
+
+
+/*=========================================================================================
+ * @name:	static HashData *map_iter_slot(HashMapHandle handle, int pos)
+ * @brief:	Get Slot by Iterator Position
+ * @note:	イテレータ位置は旧テーブル、新テーブルの順に通し番号で数える。
+ * @attention:	
+ =========================================================================================*/
+static HashData *map_iter_slot(HashMapHandle handle, int pos)
+{
+	if (pos < handle->old.tblsz) {
+		return &(handle->old.slots[pos]);
+	}
+	return &(handle->table.slots[pos - handle->old.tblsz]);
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_iter_value(HashMapHandle handle, int pos)
+ * @brief:	Get Data Pointer by Iterator Position
+ * @note:	map_iter_slot()と同じ位置のデータを返す。
+ * @attention:	
+ =========================================================================================*/
+static void *map_iter_value(HashMapHandle handle, int pos)
+{
+	if (pos < handle->old.tblsz) {
+		return map_value(handle, &(handle->old), pos);
+	}
+	return map_value(handle, &(handle->table), pos - handle->old.tblsz);
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_ctrl_scan(const unsigned char *ctrl, int from, int end)
+ * @brief:	Scan Control Bytes for Occupied Slot
+ * @note:	[from, end)で最初の使用中スロットの位置を返す。無ければendを返す。
+ *       	CTRL_GROUP個ずつmap_group_full()で調べ、空きと墓標のグループは読み飛ばす。
+ *       	スロット本体は読まない。
+ * @attention:	
+ =========================================================================================*/
+static int map_ctrl_scan(const unsigned char *ctrl, int from, int end)
+{
+	int i = from;
+
+	for (; (i + CTRL_GROUP) <= end; i+=CTRL_GROUP) {
+		unsigned int bits = map_group_full(ctrl + i);
+		if (0 != bits) { return i + map_ctz(bits); }
+	}
+	for (; i<end; i++) {
+		if (CTRL_FULL & ctrl[i]) { return i; }
+	}
+	return end;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_iter_seek(HashMapHandle handle, int pos, int end)
+ * @brief:	Seek Occupied Slot by Iterator Position
+ * @note:	[pos, end)で最初の使用中スロットのイテレータ位置を返す。無ければendを返す。
+ *       	endは末尾(旧テーブルと新テーブルのサイズの和)以下であること。
+ * @attention:	
+ =========================================================================================*/
+static int map_iter_seek(HashMapHandle handle, int pos, int end)
+{
+	int old = handle->old.tblsz;
+
+	if (pos < old) {
+		int stop = (end < old) ? (end) : (old);
+		pos = map_ctrl_scan(handle->old.ctrl, pos, stop);
+		if ((pos < stop) || (stop == end)) { return pos; }
+	}
+	if (end <= pos) { return end; }
+	return old + map_ctrl_scan(handle->table.ctrl, pos - old, end - old);
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_iter_release(HashMapIter *iter)
+ * @brief:	Release External Iterator
+ * @note:	止めていたインクリメンタルリハッシュを再開できるようにする。二度呼んでもよい。
+ *       	シャード付きハンドルでは、走査中のシャードのものを再開する。
+ * @attention:	
+ =========================================================================================*/
+static void map_iter_release(HashMapIter *iter)
+{
+	if (iter->pinned) {
+		HashMapHandle handle = iter->handle;
+		if (0 < handle->shards) { handle = handle->shard[iter->shard].map; }
+		handle->iterators--;
+		iter->pinned = false;
+	}
+	iter->key = NULL;
+	iter->keylen = 0;
+	iter->data = NULL;
+}
+
+
+/*==
+ * =======================================================================================
+ * @name:	HashMapHandle HashMap_make(const size_t cellsz, const int tblsz, int (* hash_fook)(char *key, int tblsz))
+ * @brief:	Make Hash Table
+ * @note:	Hashテーブルサイズ、格納データ、Hash関数を引数で指定する
+ *       	hash関数指定がNULLのときはdefaultの関数(HashMap_hashWyhash)を利用する
+ *       	組み込みのhash関数(HashMap_hashWyhash/HashMap_hashCrc32c)を指定した場合は、
+ *       	テーブルサイズに依存しないハッシュ値をキャッシュし、seedを使用する
+ * @attention:
+ =========================================================================================*/
+HashMapHandle HashMap_make(const size_t cellsz, const int tblsz, int (* hash_fook)(char *key, int tblsz))
+{
+	return HashMap_makeEx(cellsz, tblsz, hash_fook, NULL);
+}
+
+
+/*=========================================================================================
+ * @name:	HashMapHandle HashMap_makeEx(const size_t cellsz, const int tblsz, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option)
+ * @brief:	Make Hash Table with Options
+ * @note:	HashMap_make()にオプションを追加したもの。optionがNULLの場合はHashMap_make()と同じ。
+ *       	option->engineで探索方式を選ぶ。
+ *       	HASHMAP_ENGINE_LINEAR: 線形探索。(default)
+ *       	HASHMAP_ENGINE_SWISS : 制御バイトを16個ずつSIMDで比較する。参照の多い用途向け。
+ *       	                       テーブルサイズは16以上の2のべき乗に切り上げる。
+ *       	HASHMAP_ENGINE_ROBINHOOD: 線形探索の並びをホーム位置順に保つ。削除は後続を詰める。
+ *       	                       探索長のばらつきが小さく、高負荷率(85-90%)向け。
+ *       	option->allocatorを指定すると、ハンドル、テーブル、キーをすべてそのアロケータで
+ *       	確保する(NULLの場合はmalloc)。アロケータの内容はハンドルにコピーする。
+ *       	option->shards>1の場合は、キーをshards個の独立したマップ(シャード)に振り分ける
+ *       	シャード付きハンドルを作る。(map_shard_make参照) 各シャードはtblsz/shardsのテーブルを持ち、
+ *       	拡張、リハッシュ、キャッシュの追い出し等をシャード毎に行う。HashMap_*はそのまま使える。
+ *       	option->lockedの場合はシャード毎にmutexを持ち、キー単位の操作は複数スレッドから呼んでよい。
+ *       	option->shard_allocatorsを指定すると、シャードiのテーブルとキーをshard_allocators[i]で
+ *       	確保する。(NUMAノード毎のアロケータ等)
+ * @attention:	アロケータ(ctxの指す先)はHashMap_free()するまで解放しないこと。
+
+ =========================================================================================*/
+HashMapHandle HashMap_makeEx(const size_t cellsz, const int tblsz, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option)
+{
+	HashMapHandle handle;
+	EHashMapEngine engine = (NULL == option) ? (HASHMAP_ENGINE_LINEAR) : (option->engine);
+	HashMapAllocator allocator = {map_std_alloc, map_std_realloc, map_std_free, NULL};
+	LOG("Enter %s -> \n", __func__);
+	LOG("cellsz = %zd \n", cellsz);
+	LOG("tblsz  = %d \n", tblsz);
+	LOG("hash fook? -> %s \n", (NULL == hash_fook) ? ("no") : ("yes"));
+	LOG("engine = %d \n", engine);
+
+	if (cellsz <= 0) {
+		DIAG("error ! cell size must be more than 0 ! \n");
+		handle = NULL;
+		goto catch_exit;
+	}
+
+	if (tblsz <= 0) {
+		DIAG("error ! table size must be more than 0 ! \n");
+		handle = NULL;
+		goto catch_exit;
+	}
+
+	if ((HASHMAP_ENGINE_LINEAR != engine) && (HASHMAP_ENGINE_SWISS != engine) && (HASHMAP_ENGINE_ROBINHOOD != engine)) {
+		DIAG("error ! invalid engine ! \n");
+		handle = NULL;
+		goto catch_exit;
+	}
+
+	if ((NULL != option) && (NULL != option->allocator)) {
+		allocator = *(option->allocator);
+		if ((NULL == allocator.alloc) || (NULL == allocator.realloc) || (NULL == allocator.free)) {
+			DIAG("error ! allocator must have alloc, realloc and free ! \n");
+			handle = NULL;
+			goto catch_exit;
+		}
+	}
+
+	if ((NULL != option) && ((option->shards < 0) || (SHARD_MAX < option->shards) || (0 != (option->shards & (option->shards - 1))))) {
+		DIAG("error ! shards must be power of 2 and %d or less ! \n", SHARD_MAX);
+		handle = NULL;
+		goto catch_exit;
+	}
+#ifndef HASHMAP_HAVE_THREADS
+	if ((NULL != option) && (1 < option->shards) && option->locked) {
+		DIAG("error ! locked shards need thread support ! \n");
+		handle = NULL;
+		goto catch_exit;
+	}
+#endif
+
+	/*! make handle */
+	handle = (HashMapHandle)allocator.alloc(allocator.ctx, sizeof(struct tag_map_handle));
+	if (NULL == handle) {
+		DIAG("error ! memory alocate failed ! [%zd byte] \n", sizeof(HashMapHandle));
+		goto catch_exit;
+	}
+
+	/*! configure handle */
+	handle->hdl_id = map_get_handle_id();
+	handle->allocator = allocator;
+	/*! fook hash? */
+	if ((NULL == hash_fook) || (HashMap_hashWyhash == hash_fook)) {
+		handle->hash = HashMap_hashWyhash;
+		handle->hash_full = hash_full_wyhash;
+	} else if (HashMap_hashCrc32c == hash_fook) {
+		handle->hash = HashMap_hashCrc32c;
+		handle->hash_full = hash_full_crc32c;
+	} else {
+		/*! fook! */
+		handle->hash = hash_fook;
+		handle->hash_full = NULL;
+	}
+	handle->seed = 0;
+
+	/*! make hash table */
+	handle->cellsz = cellsz;
+	handle->engine = engine;
+	handle->iterator_pos = 0;
+	handle->iterators = 0;
+	handle->generation = 0;
+	handle->count = 0;
+	handle->deleted = 0;
+	handle->resizable = false;
+	handle->max_load = DEFAULT_MAX_LOAD;
+	handle->growth = DEFAULT_GROWTH;
+	handle->old.ctrl = NULL;
+	handle->old.slots = NULL;
+	handle->old.values = NULL;
+	handle->old.refs = NULL;
+	handle->old.expires = NULL;
+	handle->old.tblsz = 0;
+	handle->rehash_pos = 0;
+	handle->rehash_step = 0;
+	handle->key_arena = NULL;
+	handle->arena_size = 0;
+	handle->arena_used = 0;
+	handle->arena_dead = 0;
+	memset(handle->probe_hist, 0, sizeof(handle->probe_hist));
+	handle->probe_sum = 0;
+	handle->probe_peak = 0;
+	handle->resizes = 0;
+	handle->hits = 0;
+	handle->misses = 0;
+	handle->map_base = NULL;
+	handle->map_size = 0;
+	handle->readonly = false;
+	handle->frozen = false;
+	handle->pilots = NULL;
+	handle->buckets = 0;
+	handle->mphf_seed = 0;
+	handle->cache = false;
+	handle->cache_max = 0;
+	handle->cache_max_bytes = 0;
+	handle->cache_bytes = 0;
+	handle->clock_hand = 0;
+	handle->evict = NULL;
+	handle->evict_arg = NULL;
+	handle->evictions = 0;
+	handle->expiry = false;
+	handle->sweep_step = 0;
+	handle->sweep_pos = 0;
+	handle->clock = NULL;
+	handle->clock_arg = NULL;
+	handle->expirations = 0;
+	handle->shards = 0;
+	handle->shard_shift = 0;
+	handle->shard = NULL;
+	handle->shard_mem = NULL;
+	handle->trace = NULL;
+	handle->table.ctrl = NULL;
+	handle->table.slots = NULL;
+	handle->table.values = NULL;
+	handle->table.refs = NULL;
+	handle->table.expires = NULL;
+	handle->table.tblsz = 0;
+
+	/*! sharded handle has inner maps instead of table */
+	if ((NULL != option) && (1 < option->shards)) {
+		if (NG == map_shard_make(handle, tblsz, hash_fook, option)) {
+			map_cleanup(handle, MIDDLE_CLEANUP);
+			handle = NULL;
+		}
+		goto catch_exit;
+	}
+
+	if (NG == map_table_alloc(handle, &(handle->table), tblsz)) {
+		map_cleanup(handle, LITTLE_CLEANUP);
+		handle = NULL;
+		goto catch_exit;
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return handle;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_free(HashMapHandle handle)
+ * @brief:	Free Map Memory
+ * @note:
+ * @attention:
+ =========================================================================================*/
+int HashMap_free(HashMapHandle handle)
+{
+	int ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	map_cleanup(handle, FULL_CLEANUP);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_prefetch(HashMapHandle handle, const HashTable *t, unsigned int hash)
+ * @brief:	Prefetch Home Slot
+ * @note:	探索の最初に読む制御バイトとスロットをキャッシュに載せておく。
+ *       	swissエンジンはグループの先頭から読む。
+ *       	凍結したテーブルはハッシュ値を持たないので何もしない。
+ * @attention:	hashはtに対するmap_hash()の値。
+ =========================================================================================*/
+static void map_prefetch(HashMapHandle handle, const HashTable *t, unsigned int hash)
+{
+	int index;
+
+	if (handle->frozen) { return; }
+	index = map_home(handle, hash, t->tblsz);
+	if (HASHMAP_ENGINE_SWISS == handle->engine) { index &= ~(CTRL_GROUP - 1); }
+	PREFETCH(&(t->ctrl[index]));
+	PREFETCH(&(t->slots[index]));
+}
+
+
+/*=========================================================================================
+ * @name:	static EHashMapStatus map_emplace(HashMapHandle handle, const char *key, int len, unsigned int hash, void **value)
+ * @brief:	Find or Allocate Slot of Key (Worker)
+ * @note:	キーを探し、無ければ登録してHASHMAP_OKを、あればHASHMAP_EXISTSを返す。
+ *       	どちらの場合もvalueにデータ領域のポインタを返す。新規のデータ領域は0で埋める。
+ *       	探索中に見つけた最初の空きスロットを覚えておき、登録に使う(探索は一度だけ)。
+ *       	ただし、テーブルが拡張された場合は新しいテーブルで空きを探し直す。
+ *       	キャッシュモードでは上限を超える分のキーを先に追い出す。(map_cache_evict参照)
+ *       	期限モードでは先に期限切れのキーを少し回収する。(map_sweep参照)
+ *       	期限切れのキーが見つかった場合は、同じスロットに登録し直す。(期限は無しになる)
+ *       	hashは現在のテーブルに対するmap_hash()の値。
+ * @attention:	keyの妥当性は呼び出し側で確認すること。失敗時valueはNULL。
+ =========================================================================================*/
+static EHashMapStatus map_emplace(HashMapHandle handle, const char *key, int len, unsigned int hash, void **value)
+{
+	EHashMapStatus ret;
+	int index, blank = INVALID_CORD;
+	HashData *slots, *p;
+	HashTable *t;
+	uint64_t start = (NULL != handle->trace) ? map_cycles() : 0;
+
+	LOG("handle_id=%d key=\"%.*s\" @%s \n", handle->hdl_id, len, key, __func__);
+	*value = NULL;
+
+	if (false == map_is_iterating(handle)) { map_rehash_step(handle, handle->rehash_step); }
+	if (0 < handle->sweep_step) { map_sweep(handle, handle->sweep_step); }
+
+	/*! search key, and remember blank slot on the way */
+	t = &(handle->table);
+	index = map_find(handle, t, key, len, hash, NULL, &blank);
+	if ((INVALID_CORD == index) && (NULL != handle->old.slots)) {
+		unsigned int old_hash = (NULL == handle->hash_full) ? map_hash(handle, key, len, handle->old.tblsz) : hash;
+		t = &(handle->old);
+		index = map_find(handle, t, key, len, old_hash, NULL, NULL);
+	}
+	if (INVALID_CORD < index) {
+		*value = map_value(handle, t, index);
+		ret = HASHMAP_EXISTS;
+		if (map_expired(handle, t, index)) {
+			/* expired key: register again on the same slot */
+			t->expires[index] = 0;
+			handle->expirations++;
+			memset(*value, 0, handle->cellsz);
+			ret = HASHMAP_OK;
+		}
+		map_touch(t, index);
+		goto catch_exit;
+	}
+
+	/*! evict keys to make room (cache mode) */
+	if (handle->cache) {
+		if ((0 < handle->cache_max_bytes) && (handle->cache_max_bytes < (size_t)len + handle->cellsz)) {
+			ret = HASHMAP_FULL;
+			goto catch_exit;
+		}
+		if (0 < map_cache_evict(handle, 1, (size_t)len + handle->cellsz)) {
+			blank = map_find_blank(handle, &(handle->table), hash);
+		}
+	}
+
+	/*! grow table if needed (auto resize mode) */
+	slots = handle->table.slots;
+	if (NG == map_reserve(handle)) {
+		DIAG("warning ! failed to grow hash table ! @%s() \n", __func__);
+	}
+	if (slots != handle->table.slots) {
+		hash = map_hash(handle, key, len, handle->table.tblsz);
+		blank = map_find_blank(handle, &(handle->table), hash);
+	}
+	if ((blank == INVALID_CORD) || (NG == map_make_room(handle, &(handle->table), blank))) {
+		ret = HASHMAP_FULL;
+		goto catch_exit;
+	}
+	p = &(handle->table.slots[blank]);
+	if (NG == map_store_key(handle, p, key, len)) {
+		ret = HASHMAP_NO_MEMORY;
+		goto catch_exit;
+	}
+	map_occupy(handle, &(handle->table), blank, hash);
+	handle->count++;
+	if (handle->cache) { handle->cache_bytes += (size_t)len + handle->cellsz; }
+	*value = map_value(handle, &(handle->table), blank);
+	memset(*value, 0, handle->cellsz);
+	ret = HASHMAP_OK;
+
+catch_exit:
+	if (NULL != handle->trace) { map_trace_op(handle, HASHMAP_OP_INSERT, start); }
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static EHashMapStatus map_insert(HashMapHandle handle, const char *key, int len, unsigned int hash, void *data)
+ * @brief:	Register Data on Hash Table (Worker)
+ * @note:	HashMap_insert()/HashMap_insertBytes()/HashMap_insertBatch()/HashMap_tryInsert()の本体。
+ *       	hashは現在のテーブルに対するmap_hash()の値。
+ *       	登録済み(HASHMAP_EXISTS)、空き無し(HASHMAP_FULL)はログを出さずに返す。
+ * @attention:	keyの妥当性は呼び出し側で確認すること。
+ =========================================================================================*/
+static EHashMapStatus map_insert(HashMapHandle handle, const char *key, int len, unsigned int hash, void *data)
+{
+	EHashMapStatus ret;
+	void *value;
+
+	ret = map_emplace(handle, key, len, hash, &value);
+	if (HASHMAP_OK == ret) {
+		memcpy(value, data, handle->cellsz);
+		LOG("addr:%08lX -> %08lX (%zd B) \n", (unsigned long)data, (unsigned long)value, handle->cellsz);
+	}
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_run_workers(void *(* func)(void *work), void *works, size_t worksz, int num)
+ * @brief:	Run Works on Threads
+ * @note:	worksはworksz byteの要素num個の配列。要素毎にfuncを呼び、全て終わるまで待つ。
+ *       	先頭の要素は呼び出したスレッドで処理する。スレッドを作れなかった要素も同様。
+ * @attention:	スレッドが使えない環境では全て順に処理する。
+ =========================================================================================*/
+static void map_run_workers(void *(* func)(void *work), void *works, size_t worksz, int num)
+{
+	int i;
+#ifdef HASHMAP_HAVE_THREADS
+	pthread_t tid[WORKER_MAX];
+	bool started[WORKER_MAX];
+
+	for (i=1; i<num; i++) {
+		started[i] = (0 == pthread_create(&tid[i], NULL, func, (char *)works + worksz * i));
+	}
+	func(works);
+	for (i=1; i<num; i++) {
+		if (started[i]) {
+			pthread_join(tid[i], NULL);
+		} else {
+			func((char *)works + worksz * i);
+		}
+	}
+#else
+	for (i=0; i<num; i++) { func((char *)works + worksz * i); }
+#endif
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_bulk_hash(void *work)
+ * @brief:	Hash Keys of Bulk Load (Worker)
+ * @note:	MapBulkWorkのkeys[first] .. keys[last - 1]の長さとmap_hash()を求める。
+ * @attention:	fookされたhash関数は複数のスレッドから同時に呼ばれる。
+ =========================================================================================*/
+static void *map_bulk_hash(void *work)
+{
+	MapBulkWork *w = (MapBulkWork *)work;
+	HashMapHandle handle = &(w->local);
+	int i;
+
+	for (i=w->first; i<w->last; i++) {
+		char *key = w->keys[i];
+		if ((NULL == key) || ('\0' == key[0])) {
+			w->len[i] = 0;
+			continue;
+		}
+		w->len[i] = strlen(key);
+		w->hash[i] = map_hash(handle, key, w->len[i], handle->table.tblsz);
+	}
+	return NULL;
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_bulk_local(HashMapHandle handle, unsigned int hash, int hi)
+ * @brief:	Check Probe Stays in Own Slots
+ * @note:	ホーム位置からhiまでに未使用スロットがあれば、探索も登録(robin hoodのずらしを含む)も
+ *       	そこまでで終わるので、他のスレッドのスロットに触れない。
+ *       	swissは最初のグループに未使用スロットがあればよい。(担当範囲はグループ単位)
+ * @attention:	hashは現在のテーブルに対するmap_hash()の値。
+ =========================================================================================*/
+static bool map_bulk_local(HashMapHandle handle, unsigned int hash, int hi)
+{
+	const unsigned char *ctrl = handle->table.ctrl;
+	int i = map_home(handle, hash, handle->table.tblsz);
+
+	if (HASHMAP_ENGINE_SWISS == handle->engine) {
+		return (0 != map_group_match(&ctrl[i & ~(CTRL_GROUP - 1)], CTRL_EMPTY));
+	}
+	for (; i<hi; i++) {
+		if (CTRL_EMPTY == ctrl[i]) { return true; }
+	}
+	return false;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_bulk_insert(void *work)
+ * @brief:	Register Keys of Bulk Load (Worker)
+ * @note:	ホーム位置が[lo, hi)にあるキーを登録する。担当範囲の外に及ぶキーはdeferに印を付けて
+ *       	残す。(呼び出し側で順に登録する)
+ *       	localはハンドルの複製で、テーブルとキーアリーナを共有する。登録数や統計はlocalに
+ *       	数えるので、スレッド間で書き込みは重ならない。
+ * @attention:	localは拡張しない設定であること。長いキーの置き場所はキーアリーナ上に予約しておくこと。
+ =========================================================================================*/
+static void *map_bulk_insert(void *work)
+{
+	MapBulkWork *w = (MapBulkWork *)work;
+	HashMapHandle handle = &(w->local);
+	int k;
+
+	for (k=w->first; k<w->last; k++) {
+		int i = w->order[k];
+		if (false == map_bulk_local(handle, w->hash[i], w->hi)) {
+			w->defer[i] = 1;
+			continue;
+		}
+		if (HASHMAP_OK == map_insert(handle, w->keys[i], w->len[i], w->hash[i], w->data[i])) { w->inserted++; }
+	}
+	return NULL;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_scan_worker(void *work)
+ * @brief:	Scan Slots of Parallel Foreach (Worker)
+ * @note:	イテレータ位置[lo, hi)の使用中スロットについてfuncを呼ぶ。
+ *       	funcがfalseを返したら、全てのスレッドを止める。
+ * @attention:	
+ =========================================================================================*/
+static void *map_scan_worker(void *work)
+{
+	MapScanWork *w = (MapScanWork *)work;
+	HashMapHandle handle = w->handle;
+	int i;
+
+	for (i=map_iter_seek(handle, w->lo, w->hi); i<w->hi; i=map_iter_seek(handle, i + 1, w->hi)) {
+		HashData *p = map_iter_slot(handle, i);
+		if (ATOMIC_LOAD(w->stop)) { break; }
+		if (false == w->func(map_key(handle, p), (size_t)p->keylen, map_iter_value(handle, i), w->arg)) {
+			ATOMIC_STORE(w->stop, 1);
+			break;
+		}
+	}
+	return NULL;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_shard_make(HashMapHandle handle, int tblsz, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option)
+ * @brief:	Make Inner Maps of Sharded Handle
+ * @note:	option->shards個のマップを作り、handleから振り分ける。各シャードは通常のハンドルで、
+ *       	テーブルの拡張、リハッシュ、キーアリーナ等を他のシャードと独立に持つ。
+ *       	シャードのテーブルサイズはtblsz/shards(切り上げ)とする。
+ *       	キーは経路ハッシュ(シードの異なるwyhash)の上位ビットで振り分けるので、
+ *       	シャード内のハッシュ値(ホーム位置、制御バイト)とは相関しない。
+ * @attention:	handleのテーブルは空のまま。失敗時は作りかけのシャードを残す。(map_shard_freeで解放する)
+ =========================================================================================*/
+static int map_shard_make(HashMapHandle handle, int tblsz, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option)
+{
+	int i, ret = OK;
+	int n = option->shards;
+	HashMapOption inner = {option->engine, option->allocator, 0, false, NULL};
+
+	/* allocator may not align to cache line */
+	handle->shard_mem = map_alloc(handle, sizeof(MapShard) * n + CACHE_LINE);
+	if (NULL == handle->shard_mem) {
+		DIAG("error ! memory alocate failed ! [%zd byte] \n", sizeof(MapShard) * n + CACHE_LINE);
+		ret = NG;
+		goto catch_exit;
+	}
+	handle->shard = (MapShard *)(((uintptr_t)handle->shard_mem + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+	handle->shards = n;
+	for (handle->shard_shift=64; 1<n; n>>=1) { handle->shard_shift--; }
+
+	for (i=0; i<handle->shards; i++) {
+		handle->shard[i].map = NULL;
+		handle->shard[i].locked = false;
+	}
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s = &(handle->shard[i]);
+		if (NULL != option->shard_allocators) { inner.allocator = &(option->shard_allocators[i]); }
+		s->map = HashMap_makeEx(handle->cellsz, (tblsz + handle->shards - 1) / handle->shards, hash_fook, &inner);
+		if (NULL == s->map) {
+			ret = NG;
+			goto catch_exit;
+		}
+#ifdef HASHMAP_HAVE_THREADS
+		if (option->locked) { s->locked = (0 == pthread_mutex_init(&(s->lock), NULL)); }
+		if (option->locked && (false == s->locked)) {
+			DIAG("error ! failed to initialize shard lock ! @%s() \n", __func__);
+			ret = NG;
+			goto catch_exit;
+		}
+#endif
+	}
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_shard_free(HashMapHandle handle)
+ * @brief:	Free Inner Maps of Sharded Handle
+ * @note:	シャード付きハンドルでなければ何もしない。
+ * @attention:
+ =========================================================================================*/
+static void map_shard_free(HashMapHandle handle)
+{
+	int i;
+
+	if (NULL == handle->shard) { return; }
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s = &(handle->shard[i]);
+		if (NULL != s->map) { HashMap_free(s->map); }
+#ifdef HASHMAP_HAVE_THREADS
+		if (s->locked) { pthread_mutex_destroy(&(s->lock)); }
+#endif
+	}
+	map_free(handle, handle->shard_mem, sizeof(MapShard) * handle->shards + CACHE_LINE);
+	handle->shard = NULL;
+	handle->shard_mem = NULL;
+	handle->shards = 0;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_shard_of(HashMapHandle handle, const void *key, size_t len)
+ * @brief:	Route Key to Shard
+ * @note:	経路ハッシュの上位ビットをシャード番号にする。
+ *       	HashMap_insert("abc")とHashMap_insertBytes("abc", 3)は同じシャードに振り分ける。
+ *       	不正なキーは0番に振り分ける。(エラーはシャードの処理で報告する)
+ * @attention:
+ =========================================================================================*/
+static int map_shard_of(HashMapHandle handle, const void *key, size_t len)
+{
+	if ((NULL == key) || (0 == len) || ((size_t)INT_MAX <= len)) { return 0; }
+	return (int)(hash_wyhash64((const char *)key, (int)len, SHARD_SEED) >> handle->shard_shift);
+}
+
+
+/*=========================================================================================
+ * @name:	static MapShard *map_shard_lock(HashMapHandle handle, int index)
+ * @brief:	Lock Shard
+ * @note:	HashMapOption.lockedでなければロックは取らない。
+ * @attention:	map_shard_unlock()と対で使うこと。
+ =========================================================================================*/
+static MapShard *map_shard_lock(HashMapHandle handle, int index)
+{
+	MapShard *s = &(handle->shard[index]);
+#ifdef HASHMAP_HAVE_THREADS
+	if (s->locked) { pthread_mutex_lock(&(s->lock)); }
+#endif
+	return s;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_shard_unlock(MapShard *s)
+ * @brief:	Unlock Shard
+ * @note:	
+ * @attention:
+ =========================================================================================*/
+static void map_shard_unlock(MapShard *s)
+{
+#ifdef HASHMAP_HAVE_THREADS
+	if (s->locked) { pthread_mutex_unlock(&(s->lock)); }
+#else
+	(void)s;
+#endif
+}
+
+
+/*=========================================================================================
+ * @name:	static bool map_shard_iter_next(HashMapIter *iter)
+ * @brief:	Advance External Iterator of Sharded Handle
+ * @note:	iter->shardのシャードをHashMap_iterNext()で走査し、終われば次のシャードに進む。
+ *       	pos、generation、pinnedは走査中のシャードのもの。
+ *       	シャードの走査位置が無効になった場合はiter->shardをINVALID_CORDにしてfalseを返す。
+ * @attention:	ロックは取らない。
+ =========================================================================================*/
+static bool map_shard_iter_next(HashMapIter *iter)
+{
+	HashMapHandle handle = iter->handle;
+	HashMapIter in;
+	bool ret = false;
+
+	while ((false == ret) && (0 <= iter->shard) && (iter->shard < handle->shards)) {
+		in = *iter;
+		in.handle = handle->shard[iter->shard].map;
+		ret = HashMap_iterNext(&in);
+		if ((false == ret) && (in.generation != in.handle->generation)) {
+			in.shard = INVALID_CORD;
+		} else if ((false == ret) && (in.shard + 1 < handle->shards)) {
+			HashMap_iterInit(handle->shard[in.shard + 1].map, &in);
+			in.shard = iter->shard + 1;
+		} else if (false == ret) {
+			in.shard = handle->shards;
+		}
+		in.handle = handle;
+		*iter = in;
+	}
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_shard_route(void *work)
+ * @brief:	Route Keys of Bulk Load on Sharded Handle (Worker)
+ * @note:	MapShardWorkのkeys[lo] .. keys[hi - 1]のシャードをrouteに求める。
+ * @attention:
+ =========================================================================================*/
+static void *map_shard_route(void *work)
+{
+	MapShardWork *w = (MapShardWork *)work;
+	int i;
+
+	for (i=w->lo; i<w->hi; i++) {
+		char *key = w->keys[i];
+		w->route[i] = (NULL == key) ? (0) : (map_shard_of(w->handle, key, strlen(key)));
+	}
+	return NULL;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_shard_insert(void *work)
+ * @brief:	Register Keys of Bulk Load on Sharded Handle (Worker)
+ * @note:	シャード[lo, hi)に振り分けたキーを、シャード毎にHashMap_insertBatch()で登録する。
+ *       	シャードは独立しているので、担当の異なるスレッドとは何も共有しない。
+ * @attention:	keys、dataはシャード順に並べておくこと。
+ =========================================================================================*/
+static void *map_shard_insert(void *work)
+{
+	MapShardWork *w = (MapShardWork *)work;
+	int i;
+
+	for (i=w->lo; i<w->hi; i++) {
+		MapShard *s;
+		if (w->start[i] == w->start[i + 1]) { continue; }
+		s = map_shard_lock(w->handle, i);
+		w->inserted += HashMap_insertBatch(s->map, &(w->keys[w->start[i]]), &(w->data[w->start[i]]), w->start[i + 1] - w->start[i]);
+		map_shard_unlock(s);
+	}
+	return NULL;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_shard_load(HashMapHandle handle, char **keys, void **data, int num, int nthreads)
+ * @brief:	Register Data of Many Keys on Sharded Handle
+ * @note:	HashMap_insertBatch()/HashMap_bulkLoad()のシャード付きハンドル版。
+ *       	1. キーのシャードを並列に求める。
+ *       	2. キーをシャード順に並べる。(同じシャードの中では元の順番のまま)
+ *       	3. シャードをスレッド数に分け、並列にHashMap_insertBatch()する。
+ *       	同じキーが複数ある場合は先のdataを登録する。戻り値は登録できた件数。
+ * @attention:	引数の妥当性は呼び出し側で確認すること。
+ =========================================================================================*/
+static int map_shard_load(HashMapHandle handle, char **keys, void **data, int num, int nthreads)
+{
+	int i, p, parts, ret = 0;
+	int *route = NULL, *start = NULL;
+	char **skeys = NULL;
+	void **sdata = NULL;
+	MapShardWork works[WORKER_MAX];
+
+	if (0 == num) { goto catch_exit; }
+	if (nthreads < 1) { nthreads = 1; }
+	if (WORKER_MAX < nthreads) { nthreads = WORKER_MAX; }
+
+	route = (int *)map_alloc(handle, sizeof(int) * num);
+	start = (int *)map_alloc(handle, sizeof(int) * (handle->shards + 1));
+	skeys = (char **)map_alloc(handle, sizeof(char *) * num);
+	sdata = (void **)map_alloc(handle, sizeof(void *) * num);
+	if ((NULL == route) || (NULL == start) || (NULL == skeys) || (NULL == sdata)) {
+		DIAG("error ! memory alocate failed ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+
+	/*! 1. route keys */
+	parts = (num < nthreads) ? (num) : (nthreads);
+	for (p=0; p<parts; p++) {
+		memset(&works[p], 0, sizeof(MapShardWork));
+		works[p].handle = handle;
+		works[p].keys = keys;
+		works[p].route = route;
+		works[p].lo = (int)((long long)num * p / parts);
+		works[p].hi = (int)((long long)num * (p + 1) / parts);
+	}
+	map_run_workers(map_shard_route, works, sizeof(MapShardWork), parts);
+
+	/*! 2. sort keys by shard (counting sort) */
+	memset(start, 0, sizeof(int) * (handle->shards + 1));
+	for (i=0; i<num; i++) { start[route[i] + 1]++; }
+	for (i=0; i<handle->shards; i++) { start[i + 1] += start[i]; }
+	for (i=0; i<num; i++) {
+		int k = start[route[i]]++;
+		skeys[k] = keys[i];
+		sdata[k] = data[i];
+	}
+	for (i=handle->shards; 0<i; i--) { start[i] = start[i - 1]; }
+	start[0] = 0;
+
+	/*! 3. register by shard */
+	parts = (handle->shards < nthreads) ? (handle->shards) : (nthreads);
+	for (p=0; p<parts; p++) {
+		memset(&works[p], 0, sizeof(MapShardWork));
+		works[p].handle = handle;
+		works[p].keys = skeys;
+		works[p].data = sdata;
+		works[p].start = start;
+		works[p].lo = handle->shards * p / parts;
+		works[p].hi = handle->shards * (p + 1) / parts;
+	}
+	map_run_workers(map_shard_insert, works, sizeof(MapShardWork), parts);
+	for (p=0; p<parts; p++) { ret += works[p].inserted; }
+
+catch_exit:
+	map_free(handle, route, sizeof(int) * num);
+	map_free(handle, start, sizeof(int) * (handle->shards + 1));
+	map_free(handle, skeys, sizeof(char *) * num);
+	map_free(handle, sdata, sizeof(void *) * num);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_shard_get_batch(HashMapHandle handle, char **keys, int num, void **results)
+ * @brief:	Get Hash Table Element Pointers of Many Keys on Sharded Handle
+ * @note:	HashMap_getBatch()のシャード付きハンドル版。
+ *       	キーをシャード順に並べ(map_shard_load()と同じ数え上げソート)、シャード毎に
+ *       	一度だけロックしてHashMap_getBatch()する。結果は元の順番に戻す。
+ * @attention:	引数の妥当性は呼び出し側で確認すること。失敗時はNG。
+ =========================================================================================*/
+static int map_shard_get_batch(HashMapHandle handle, char **keys, int num, void **results)
+{
+	int i, ret = 0;
+	int *route = NULL, *start = NULL, *index = NULL;
+	char **skeys = NULL;
+	void **sres = NULL;
+
+	for (i=0; i<num; i++) { results[i] = NULL; }
+	if (0 == num) { goto catch_exit; }
+
+	route = (int *)map_alloc(handle, sizeof(int) * num);
+	start = (int *)map_alloc(handle, sizeof(int) * (handle->shards + 1));
+	index = (int *)map_alloc(handle, sizeof(int) * num);
+	skeys = (char **)map_alloc(handle, sizeof(char *) * num);
+	sres = (void **)map_alloc(handle, sizeof(void *) * num);
+	if ((NULL == route) || (NULL == start) || (NULL == index) || (NULL == skeys) || (NULL == sres)) {
+		DIAG("error ! memory alocate failed ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	/*! sort keys by shard (counting sort), invalid keys are left out */
+	memset(start, 0, sizeof(int) * (handle->shards + 1));
+	for (i=0; i<num; i++) {
+		char *key = keys[i];
+		route[i] = ((NULL == key) || ('\0' == key[0])) ? (INVALID_CORD) : (map_shard_of(handle, key, strlen(key)));
+		if (INVALID_CORD != route[i]) { start[route[i] + 1]++; }
+	}
+	for (i=0; i<handle->shards; i++) { start[i + 1] += start[i]; }
+	for (i=0; i<num; i++) {
+		int k;
+		if (INVALID_CORD == route[i]) { continue; }
+		k = start[route[i]]++;
+		skeys[k] = keys[i];
+		index[k] = i;
+	}
+	for (i=handle->shards; 0<i; i--) { start[i] = start[i - 1]; }
+	start[0] = 0;
+
+	/*! look up by shard */
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s;
+		if (start[i] == start[i + 1]) { continue; }
+		s = map_shard_lock(handle, i);
+		ret += HashMap_getBatch(s->map, &(skeys[start[i]]), start[i + 1] - start[i], &(sres[start[i]]));
+		map_shard_unlock(s);
+	}
+	for (i=0; i<start[handle->shards]; i++) { results[index[i]] = sres[i]; }
+
+catch_exit:
+	map_free(handle, route, sizeof(int) * num);
+	map_free(handle, start, sizeof(int) * (handle->shards + 1));
+	map_free(handle, index, sizeof(int) * num);
+	map_free(handle, skeys, sizeof(char *) * num);
+	map_free(handle, sres, sizeof(void *) * num);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *map_shard_scan(void *work)
+ * @brief:	Scan Shards (Worker)
+ * @note:	HashMap_parallelForeach()のシャード付きハンドル版。シャード[lo, hi)を順に走査する。
+ *       	走査中のシャードはロックし、インクリメンタルリハッシュを止める。
+ * @attention:
+ =========================================================================================*/
+static void *map_shard_scan(void *work)
+{
+	MapShardWork *w = (MapShardWork *)work;
+	int i;
+
+	for (i=w->lo; (i<w->hi) && (0 == ATOMIC_LOAD(w->stop)); i++) {
+		MapShard *s = map_shard_lock(w->handle, i);
+		MapScanWork scan = {s->map, w->func, w->arg, 0, s->map->old.tblsz + s->map->table.tblsz, w->stop};
+		s->map->iterators++;
+		map_scan_worker(&scan);
+		s->map->iterators--;
+		map_shard_unlock(s);
+	}
+	return NULL;
+}
+
+
+/*=========================================================================================
+ * @name:	static HashMapHandle map_shard_freeze(HashMapHandle handle)
+ * @brief:	Freeze Sharded Handle
+ * @note:	シャード毎にHashMap_freeze()した読み出し専用のシャード付きハンドルを返す。
+ *       	振り分けは元のハンドルと同じ。各シャードは元のシャードのアロケータを使う。
+ * @attention:	失敗時はNULL。
+ =========================================================================================*/
+static HashMapHandle map_shard_freeze(HashMapHandle handle)
+{
+	HashMapHandle frozen;
+	HashMapOption option = {handle->engine, &(handle->allocator), handle->shards, false, NULL};
+	int i;
+
+	frozen = HashMap_makeEx(handle->cellsz, handle->shards, handle->hash, &option);
+	if (NULL == frozen) { goto catch_exit; }
+	frozen->readonly = true;
+
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s = map_shard_lock(handle, i);
+		HashMap_free(frozen->shard[i].map);
+		frozen->shard[i].map = HashMap_freeze(s->map);
+		map_shard_unlock(s);
+		if (NULL == frozen->shard[i].map) {
+			map_cleanup(frozen, FULL_CLEANUP);
+			frozen = NULL;
+			goto catch_exit;
+		}
+	}
+
+catch_exit:
+	return frozen;
+}
+
+
+/*=========================================================================================
+ * @name:	static uint64_t map_cycles(void)
+ * @brief:	Read Cycle Counter
+ * @note:	x86: TSC、aarch64: 仮想カウンタ。それ以外は単調増加するナノ秒で代用する。
+ * @attention:	コア間やCPU周波数の違いは補正しない。(レイテンシの目安として使う)
+ =========================================================================================*/
+static uint64_t map_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	uint64_t v;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)clock();
+#endif
+}
+
+
+/*=========================================================================================
+ * @name:	static uint64_t map_trace_op(HashMapHandle handle, EHashMapOp op, uint64_t start)
+ * @brief:	Record Latency of Operation
+ * @note:	startからの経過サイクルをopのヒストグラムに数え、経過サイクルを返す。
+ * @attention:	handle->traceがNULLでないこと。
+ =========================================================================================*/
+static uint64_t map_trace_op(HashMapHandle handle, EHashMapOp op, uint64_t start)
+{
+	HashMapTrace *d = &(handle->trace->data);
+	uint64_t cycles = map_cycles() - start;
+	int b = 0;
+
+	while ((b < HASHMAP_TRACE_HIST - 1) && ((cycles >> (b + 1)) != 0)) { b++; }
+	d->ops[op]++;
+	d->cycles[op] += cycles;
+	if (d->max_cycles[op] < cycles) { d->max_cycles[op] = cycles; }
+	d->hist[op][b]++;
+	return cycles;
+}
+
+
+/*=========================================================================================
+ * @name:	static void map_trace_lookup(HashMapHandle handle, const char *key, int len, bool hit, uint64_t cycles)
+ * @brief:	Sample Slow Lookup
+ * @note:	slow_cycles以上かかった検索を遅い検索として数え、sample_rate回に1回記録する。
+ *       	記録する時だけ探索をやり直して探索長を求める。(速い検索には余分な処理をしない)
+ *       	USDTプローブ hashmap:slow_lookup(handle, hash, probe, cycles) もここで発火する。
+ * @attention:	handle->traceがNULLでないこと。
+ =========================================================================================*/
+static void map_trace_lookup(HashMapHandle handle, const char *key, int len, bool hit, uint64_t cycles)
+{
+	MapTrace *tr = handle->trace;
+	HashMapTraceSample *p;
+	unsigned int hash;
+	int misshit = 0;
+
+	if (cycles < tr->slow_cycles) { return; }
+	tr->data.slow++;
+	if ((0 == tr->sample_rate) || (0 < --tr->countdown)) { return; }
+	tr->countdown = tr->sample_rate;
+
+	hash = map_hash(handle, key, len, handle->table.tblsz);
+	if ((false == handle->frozen) && (INVALID_CORD == map_find(handle, &(handle->table), key, len, hash, &misshit, NULL)) && (NULL != handle->old.slots)) {
+		unsigned int old_hash = (NULL == handle->hash_full) ? map_hash(handle, key, len, handle->old.tblsz) : hash;
+		map_find(handle, &(handle->old), key, len, old_hash, &misshit, NULL);
+	}
+
+	p = &(tr->data.sample[tr->head]);
+	p->hash = hash;
+	p->probe = misshit;
+	p->hit = hit;
+	p->cycles = cycles;
+	tr->head = (tr->head + 1) % HASHMAP_TRACE_SAMPLES;
+	if (tr->data.samples < HASHMAP_TRACE_SAMPLES) { tr->data.samples++; }
+	tr->data.sampled++;
+	TRACE_PROBE4(slow_lookup, handle, hash, misshit, cycles);
+}
+
+
+/*=========================================================================================
+ * @name:	static EHashMapStatus map_get(HashMapHandle handle, const char *key, int len, void **data)
+ * @brief:	Get Hash Table Element Pointer (Worker)
+ * @note:	HashMap_get()/HashMap_getBytes()/HashMap_tryGet()の本体。
+ *       	見つかればdataにデータのポインタを返す。見つからなければNULLにする。
+ *       	期限切れのキーは見つからなかったものとし、その場で削除する。(map_reclaim参照)
+ * @attention:	keyの妥当性は呼び出し側で確認すること。
+ =========================================================================================*/
+static EHashMapStatus map_get(HashMapHandle handle, const char *key, int len, void **data)
+{
+	EHashMapStatus ret;
+	int index;
+	HashTable *t;
+	uint64_t start = (NULL != handle->trace) ? map_cycles() : 0;
+
+	if (false == map_is_iterating(handle)) { map_rehash_step(handle, handle->rehash_step); }
+
+	index = map_lookup(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), &t);
+	if ((INVALID_CORD != index) && map_reclaim(handle, t, index)) { index = INVALID_CORD; }
+	if (index == INVALID_CORD) {
+		*data = NULL;
+		handle->misses++;
+		ret = HASHMAP_NOT_FOUND;
+	} else {
+		map_touch(t, index);
+		*data = map_value(handle, t, index);
+		handle->hits++;
+		ret = HASHMAP_OK;
+	}
+	if (NULL != handle->trace) { map_trace_lookup(handle, key, len, (HASHMAP_OK == ret), map_trace_op(handle, HASHMAP_OP_GET, start)); }
+
+	LOG("index=%d addr=0x%08lX \n", index, (unsigned long)(*data));
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static EHashMapStatus map_erase(HashMapHandle handle, const char *key, int len)
+ * @brief:	Erase Hash Table Element (Worker)
+ * @note:	HashMap_erase()/HashMap_eraseBytes()/HashMap_tryErase()の本体。
+ *       	期限切れのキーは回収した上で、見つからなかったものとする。
+ * @attention:	keyの妥当性は呼び出し側で確認すること。
+ =========================================================================================*/
+static EHashMapStatus map_erase(HashMapHandle handle, const char *key, int len)
+{
+	EHashMapStatus ret;
+	int index;
+	HashTable *t;
+	uint64_t start = (NULL != handle->trace) ? map_cycles() : 0;
+
+	if (false == map_is_iterating(handle)) { map_rehash_step(handle, handle->rehash_step); }
+
+	index = map_lookup(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), &t);
+	if ((INVALID_CORD != index) && map_reclaim(handle, t, index)) { index = INVALID_CORD; }
+	if (index == INVALID_CORD) {
+		ret = HASHMAP_NOT_FOUND;
+	} else {
+		/* erase(leave tombstone) */
+		map_remove_at(handle, t, index);
+		map_arena_compact(handle);
+		ret = HASHMAP_OK;
+		LOG("erase key=\"%.*s\" index=%d \n", len, key, index);
+	}
+	if (NULL != handle->trace) { map_trace_op(handle, HASHMAP_OP_ERASE, start); }
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_status_report(EHashMapStatus status, const char *key, int len, const char *func)
+ * @brief:	Report Worker Status
+ * @note:	HashMap_insert()/HashMap_get()/HashMap_erase()等の従来のAPI用。
+ *       	ワーカーの結果をログに出し、OK/NGに変換する。
+ * @attention:	HashMap_try*()では使わない(ログを出さない)。
+ =========================================================================================*/
+static int map_status_report(EHashMapStatus status, const char *key, int len, const char *func)
+{
+	switch (status) {
+		case HASHMAP_OK:
+			return OK;
+		case HASHMAP_EXISTS:
+			DIAG("error ! \"%.*s\" is already registerd ! @%s() \n", len, key, func);
+			break;
+		case HASHMAP_FULL:
+			DIAG("error ! \"%.*s\" failed to register hash table ! @%s() \n", len, key, func);
+			break;
+		case HASHMAP_NOT_FOUND:
+			DIAG("error ! \"%.*s\" isn't registered on hash table ! @%s() \n", len, key, func);
+			break;
+		default:
+			break;
+	}
+	(void)key;
+	(void)len;
+	(void)func;
+	return NG;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_bytes_check(HashMapHandle handle, const void *key, size_t len, char *buf, char **cstr)
+ * @brief:	Check Binary Key and Make Terminated Copy
+ * @note:	fookされたhash関数は'\0'終端の文字列を受け取るため、終端したコピーを作る。
+ *       	KEY_HOOK_BUF未満はbuf(呼び出し側のスタック)に、それ以上はmap_alloc()でコピーする。
+ *       	組み込みのhash関数の場合はコピーせず、keyをそのまま返す。
+ * @attention:	*cstrがbufでもkeyでもない場合は、呼び出し側でmap_free()すること。
+ =========================================================================================*/
+static int map_bytes_check(HashMapHandle handle, const void *key, size_t len, char *buf, char **cstr)
+{
+	int ret = OK;
+
+	if ((NULL == key) || (0 == len) || ((size_t)INT_MAX <= len)) {
+		DIAG("error ! invalid key ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	*cstr = (char *)key;
+	if (NULL != handle->hash_full) { goto catch_exit; }
+
+	*cstr = (len < KEY_HOOK_BUF) ? (buf) : ((char *)map_alloc(handle, len + 1));
+	if (NULL == *cstr) {
+		DIAG("error ! memory alocate failed ! [%zd byte] \n", len + 1);
+		ret = NG;
+		goto catch_exit;
+	}
+	memcpy(*cstr, key, len);
+	(*cstr)[len] = '\0';
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_insert(HashMapHandle handle, char *key, void *data)
+ * @brief:	Register Data on Hash Table
+ * @note:
+ * @attention:
+ =========================================================================================*/
+int HashMap_insert(HashMapHandle handle, char *key, void *data)
+{
+	int ret, len;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+	PRE_KEY_CHECK(key, ret, NG, catch_exit);
+
+	len = strlen(key);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_insert, key, data);
+	ret = map_status_report(map_insert(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), data), key, len, __func__);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_insertBytes(HashMapHandle handle, const void *key, size_t len, void *data)
+ * @brief:	Register Data on Hash Table with Binary Key
+ * @note:	任意のバイト列(途中に'\0'を含んでもよい)をキーにできる。キー長に上限はない。
+ * @attention:	fookされたhash関数は'\0'までしか見ないため、'\0'を含むキーは偏る。
+ =========================================================================================*/
+int HashMap_insertBytes(HashMapHandle handle, const void *key, size_t len, void *data)
+{
+	int ret;
+	char buf[KEY_HOOK_BUF];
+	char *cstr = NULL;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_insertBytes, key, len, data);
+
+	ret = map_bytes_check(handle, key, len, buf, &cstr);
+	if (OK == ret) {
+		ret = map_status_report(map_insert(handle, cstr, (int)len, map_hash(handle, cstr, (int)len, handle->table.tblsz), data), cstr, (int)len, __func__);
+	}
+	if ((cstr != buf) && (cstr != key)) { map_free(handle, cstr, len + 1); }
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	void* HashMap_get(HashMapHandle handle, char *key)
+ * @brief:	Get Hash Table Element Pointer
+ * @note:	返却値はvoidポインタのため、コール側でキャストすること
+ * @attention:	返却値はテーブルの再構築(自動リサイズ、HashMap_shrink等)で無効になる。
+ *           	インクリメンタルリハッシュ中は、以降のどの操作でも移動しうる。
+ =========================================================================================*/
+void* HashMap_get(HashMapHandle handle, char *key)
 {
 	void* ret;
-	int hash_value, index;
+	int len;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
+	PRE_KEY_CHECK(key, ret, NULL, catch_exit);
+
+	len = strlen(key);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_get, key);
+	map_status_report(map_get(handle, key, len, &ret), key, len, __func__);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	void* HashMap_getBytes(HashMapHandle handle, const void *key, size_t len)
+ * @brief:	Get Hash Table Element Pointer with Binary Key
+ * @note:	返却値はvoidポインタのため、コール側でキャストすること
+ * @attention:	
+ =========================================================================================*/
+void* HashMap_getBytes(HashMapHandle handle, const void *key, size_t len)
+{
+	void* ret = NULL;
+	char buf[KEY_HOOK_BUF];
+	char *cstr = NULL;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_getBytes, key, len);
+
+	if (OK == map_bytes_check(handle, key, len, buf, &cstr)) {
+		map_status_report(map_get(handle, cstr, (int)len, &ret), cstr, (int)len, __func__);
+	}
+	if ((cstr != buf) && (cstr != key)) { map_free(handle, cstr, len + 1); }
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_peek(HashMapHandle handle, char *key, void *data, bool (* stale)(void *arg), void *arg)
+ * @brief:	Copy Hash Table Element without Side Effects
+ * @note:	keyのデータをdataにcellszバイトコピーする。見つからなければNGを返す(ログは出さない)。
+ *       	HashMap_get()と違い、インクリメンタルリハッシュの移行などハンドルへの書き込みを
+ *       	一切行わない。
+ *       	他スレッドの書き込みと並行して読む(seqlock等)ためにも使える。ハンドルの内容を
+ *       	手元に写した後でstale(arg)を呼び、trueが返れば(写した内容が書き込み途中だった)
+ *       	探索せずにNGを返す。結果の正しさは呼び出し側で再度確かめること。
+ *       	staleがNULLの場合は単独スレッドでの読み出しとして扱う。
+ *       	期限切れのキーは未登録として扱う。(削除はしない) キャッシュモードの参照ビットも立てない。
+ *       	シャード付きハンドルでは他のAPIと同じくシャードのロックを取って読む。
+ * @attention:	並行して読む場合、書き込み側のアロケータは読み出し中のメモリを解放しないこと。
+ =========================================================================================*/
+int HashMap_peek(HashMapHandle handle, char *key, void *data, bool (* stale)(void *arg), void *arg)
+{
+	int ret = NG;
+	int index, len;
+	struct tag_map_handle snap;
+	HashTable *t;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_KEY_CHECK(key, ret, NG, catch_exit);
+
+	len = strlen(key);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_peek, key, data, stale, arg);
+	snap = *handle;
+	if ((NULL != stale) && stale(arg)) { goto catch_exit; }
+
+	index = map_lookup(&snap, key, len, map_hash(&snap, key, len, snap.table.tblsz), &t);
+	if ((INVALID_CORD == index) || map_expired(&snap, t, index)) { goto catch_exit; }
+	memcpy(data, map_value(&snap, t, index), snap.cellsz);
+	ret = OK;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_erase(HashMapHandle handle, char *key)
+ * @brief:	Erase Hash Table Element
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+int HashMap_erase(HashMapHandle handle, char *key)
+{
+	int ret, len;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+	PRE_KEY_CHECK(key, ret, NG, catch_exit);
+
+	len = strlen(key);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_erase, key);
+	ret = map_status_report(map_erase(handle, key, len), key, len, __func__);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_eraseBytes(HashMapHandle handle, const void *key, size_t len)
+ * @brief:	Erase Hash Table Element with Binary Key
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+int HashMap_eraseBytes(HashMapHandle handle, const void *key, size_t len)
+{
+	int ret;
+	char buf[KEY_HOOK_BUF];
+	char *cstr = NULL;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_eraseBytes, key, len);
+
+	ret = map_bytes_check(handle, key, len, buf, &cstr);
+	if (OK == ret) {
+		ret = map_status_report(map_erase(handle, cstr, (int)len), cstr, (int)len, __func__);
+	}
+	if ((cstr != buf) && (cstr != key)) { map_free(handle, cstr, len + 1); }
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	EHashMapStatus HashMap_tryInsert(HashMapHandle handle, char *key, void *data)
+ * @brief:	Register Data on Hash Table (Quiet)
+ * @note:	HashMap_insert()と同じ処理を行い、結果をEHashMapStatusで返す。ログは出さない。
+ *       	登録済みならHASHMAP_EXISTS、空きが無ければHASHMAP_FULLを返す。
+ * @attention:	HASHMAP_NO_HANDLE_CHECK定義時はhandleを検査しない。
+ =========================================================================================*/
+EHashMapStatus HashMap_tryInsert(HashMapHandle handle, char *key, void *data)
+{
+	int len;
+
+	if ((false == MAP_IS_INIT(handle)) || (key == NULL) || ('\0' == key[0])) {
+		return HASHMAP_INVALID;
+	}
+	if (handle->readonly) {
+		return HASHMAP_READ_ONLY;
+	}
+	len = strlen(key);
+	if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, len));
+		EHashMapStatus ret = HashMap_tryInsert(s->map, key, data);
+		map_shard_unlock(s);
+		return ret;
+	}
+	return map_insert(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), data);
+}
+
+
+/*=========================================================================================
+ * @name:	EHashMapStatus HashMap_tryGet(HashMapHandle handle, char *key, void **data)
+ * @brief:	Get Hash Table Element Pointer (Quiet)
+ * @note:	見つかればHASHMAP_OKを返し、dataにデータのポインタを格納する。
+ *       	見つからなければHASHMAP_NOT_FOUNDを返す。ログは出さない。
+ *       	存在確認だけならdataはNULLでよい。
+ * @attention:	HASHMAP_NO_HANDLE_CHECK定義時はhandleを検査しない。
+ =========================================================================================*/
+EHashMapStatus HashMap_tryGet(HashMapHandle handle, char *key, void **data)
+{
+	EHashMapStatus ret;
+	void *p;
+
+	if ((false == MAP_IS_INIT(handle)) || (key == NULL) || ('\0' == key[0])) {
+		ret = HASHMAP_INVALID;
+		p = NULL;
+	} else if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, strlen(key)));
+		ret = HashMap_tryGet(s->map, key, &p);
+		map_shard_unlock(s);
+	} else {
+		ret = map_get(handle, key, strlen(key), &p);
+	}
+	if (data != NULL) { *data = p; }
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	EHashMapStatus HashMap_tryErase(HashMapHandle handle, char *key)
+ * @brief:	Erase Hash Table Element (Quiet)
+ * @note:	未登録ならHASHMAP_NOT_FOUNDを返す。ログは出さない。
+ * @attention:	HASHMAP_NO_HANDLE_CHECK定義時はhandleを検査しない。
+ =========================================================================================*/
+EHashMapStatus HashMap_tryErase(HashMapHandle handle, char *key)
+{
+	if ((false == MAP_IS_INIT(handle)) || (key == NULL) || ('\0' == key[0])) {
+		return HASHMAP_INVALID;
+	}
+	if (handle->readonly) {
+		return HASHMAP_READ_ONLY;
+	}
+	if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, strlen(key)));
+		EHashMapStatus ret = HashMap_tryErase(s->map, key);
+		map_shard_unlock(s);
+		return ret;
+	}
+	return map_erase(handle, key, strlen(key));
+}
+
+
+/*=========================================================================================
+ * @name:	EHashMapStatus HashMap_tryInsertBytes(HashMapHandle handle, const void *key, size_t len, void *data)
+ * @brief:	Register Data on Hash Table with Binary Key (Quiet)
+ * @note:	HashMap_insertBytes()と同じ処理を行い、結果をHashMap_tryInsert()と同じく返す。
+ *       	ログは出さない。
+ * @attention:	HASHMAP_NO_HANDLE_CHECK定義時はhandleを検査しない。
+ =========================================================================================*/
+EHashMapStatus HashMap_tryInsertBytes(HashMapHandle handle, const void *key, size_t len, void *data)
+{
+	EHashMapStatus ret;
+	char buf[KEY_HOOK_BUF];
+	char *cstr;
+
+	if ((false == MAP_IS_INIT(handle)) || (key == NULL) || (0 == len) || ((size_t)INT_MAX <= len)) {
+		return HASHMAP_INVALID;
+	}
+	if (handle->readonly) {
+		return HASHMAP_READ_ONLY;
+	}
+	if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, len));
+		ret = HashMap_tryInsertBytes(s->map, key, len, data);
+		map_shard_unlock(s);
+		return ret;
+	}
+	if (NG == map_bytes_check(handle, key, len, buf, &cstr)) {
+		return HASHMAP_NO_MEMORY;
+	}
+	ret = map_insert(handle, cstr, (int)len, map_hash(handle, cstr, (int)len, handle->table.tblsz), data);
+	if ((cstr != buf) && (cstr != key)) { map_free(handle, cstr, len + 1); }
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	EHashMapStatus HashMap_tryGetBytes(HashMapHandle handle, const void *key, size_t len, void **data)
+ * @brief:	Get Hash Table Element Pointer with Binary Key (Quiet)
+ * @note:	HashMap_tryGet()のバイナリキー版。存在確認だけならdataはNULLでよい。
+ * @attention:	HASHMAP_NO_HANDLE_CHECK定義時はhandleを検査しない。
+ =========================================================================================*/
+EHashMapStatus HashMap_tryGetBytes(HashMapHandle handle, const void *key, size_t len, void **data)
+{
+	EHashMapStatus ret;
+	char buf[KEY_HOOK_BUF];
+	char *cstr;
+	void *p = NULL;
+
+	if ((false == MAP_IS_INIT(handle)) || (key == NULL) || (0 == len) || ((size_t)INT_MAX <= len)) {
+		ret = HASHMAP_INVALID;
+	} else if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, len));
+		ret = HashMap_tryGetBytes(s->map, key, len, &p);
+		map_shard_unlock(s);
+	} else if (NG == map_bytes_check(handle, key, len, buf, &cstr)) {
+		ret = HASHMAP_NO_MEMORY;
+	} else {
+		ret = map_get(handle, cstr, (int)len, &p);
+		if ((cstr != buf) && (cstr != key)) { map_free(handle, cstr, len + 1); }
+	}
+	if (data != NULL) { *data = p; }
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	EHashMapStatus HashMap_tryEraseBytes(HashMapHandle handle, const void *key, size_t len)
+ * @brief:	Erase Hash Table Element with Binary Key (Quiet)
+ * @note:	HashMap_tryErase()のバイナリキー版。未登録ならHASHMAP_NOT_FOUNDを返す。ログは出さない。
+ * @attention:	HASHMAP_NO_HANDLE_CHECK定義時はhandleを検査しない。
+ =========================================================================================*/
+EHashMapStatus HashMap_tryEraseBytes(HashMapHandle handle, const void *key, size_t len)
+{
+	EHashMapStatus ret;
+	char buf[KEY_HOOK_BUF];
+	char *cstr;
+
+	if ((false == MAP_IS_INIT(handle)) || (key == NULL) || (0 == len) || ((size_t)INT_MAX <= len)) {
+		return HASHMAP_INVALID;
+	}
+	if (handle->readonly) {
+		return HASHMAP_READ_ONLY;
+	}
+	if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, len));
+		ret = HashMap_tryEraseBytes(s->map, key, len);
+		map_shard_unlock(s);
+		return ret;
+	}
+	if (NG == map_bytes_check(handle, key, len, buf, &cstr)) {
+		return HASHMAP_NO_MEMORY;
+	}
+	ret = map_erase(handle, cstr, (int)len);
+	if ((cstr != buf) && (cstr != key)) { map_free(handle, cstr, len + 1); }
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	void *HashMap_getOrInsert(HashMapHandle handle, char *key, bool *inserted)
+ * @brief:	Get Data Pointer, Register Key if Not Exist
+ * @note:	登録済みならそのデータのポインタを、未登録なら登録して0で埋めたデータ領域の
+ *       	ポインタを返す。呼び出し側はそこに直接データを構築してよい。
+ *       	insertedには新規登録したかどうかを返す(NULL可)。探索は一度だけ。
+ * @attention:	返したポインタは次の登録/削除/リサイズまで有効。失敗時はNULL。
+ =========================================================================================*/
+void *HashMap_getOrInsert(HashMapHandle handle, char *key, bool *inserted)
+{
+	void *ret = NULL;
+	int len;
+	EHashMapStatus st = HASHMAP_INVALID;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NULL, catch_exit);
+	PRE_KEY_CHECK(key, ret, NULL, catch_exit);
+
+	len = strlen(key);
+	if (0 < handle->shards) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, len));
+		bool in = false;
+		ret = HashMap_getOrInsert(s->map, key, &in);
+		map_shard_unlock(s);
+		st = in ? (HASHMAP_OK) : (HASHMAP_EXISTS);
+		goto catch_exit;
+	}
+	st = map_emplace(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), &ret);
+	if ((HASHMAP_OK != st) && (HASHMAP_EXISTS != st)) {
+		map_status_report(st, key, len, __func__);
+	}
+
+catch_exit:
+	if (NULL != inserted) { *inserted = (HASHMAP_OK == st); }
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_upsert(HashMapHandle handle, char *key, void (* update)(void *data, bool inserted, void *arg), void *arg)
+ * @brief:	Update Data in Place, Register Key if Not Exist
+ * @note:	HashMap_getOrInsert()で得たデータ領域に対してupdateを呼ぶ。
+ *       	未登録だった場合はinsertedがtrueで、データ領域は0で埋まっている。
+ *       	カウンタの加算などをget/insert/getの三回の探索ではなく一回で行う。
+ *       	ロック付きのシャード付きハンドルでは、updateはシャードのロックを取ったまま呼ぶ。
+ * @attention:	updateの中で同じhandleを操作しないこと。
+ =========================================================================================*/
+int HashMap_upsert(HashMapHandle handle, char *key, void (* update)(void *data, bool inserted, void *arg), void *arg)
+{
+	int ret = NG;
+	bool inserted;
+	void *value;
+	LOG("Enter %s -> \n", __func__);
+
+	if (NULL == update) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+	if (MAP_IS_INIT(handle) && (0 < handle->shards) && (NULL != key)) {
+		/* update under the lock of shard */
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, strlen(key)));
+		ret = HashMap_upsert(s->map, key, update, arg);
+		map_shard_unlock(s);
+		goto catch_exit;
+	}
+	value = HashMap_getOrInsert(handle, key, &inserted);
+	if (NULL != value) {
+		update(value, inserted, arg);
+		ret = OK;
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_insertOrAssign(HashMapHandle handle, char *key, void *data)
+ * @brief:	Register Data, Overwrite if Already Registered
+ * @note:	未登録なら登録し、登録済みならデータを上書きする。探索は一度だけ。
+ * @attention:
+ =========================================================================================*/
+int HashMap_insertOrAssign(HashMapHandle handle, char *key, void *data)
+{
+	int ret = NG;
+	void *value;
+	LOG("Enter %s -> \n", __func__);
+
+	if (MAP_IS_INIT(handle) && (0 < handle->shards) && (NULL != key)) {
+		MapShard *s = map_shard_lock(handle, map_shard_of(handle, key, strlen(key)));
+		ret = HashMap_insertOrAssign(s->map, key, data);
+		map_shard_unlock(s);
+	} else if (NULL != (value = HashMap_getOrInsert(handle, key, NULL))) {
+		memcpy(value, data, handle->cellsz);
+		ret = OK;
+	}
+
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_getBatch(HashMapHandle handle, char **keys, int num, void **results)
+ * @brief:	Get Hash Table Element Pointers of Many Keys
+ * @note:	keys[0..num-1]を引き、results[i]にデータのポインタ(未登録ならNULL)を返す。
+ *       	BATCH_WINDOW件ずつ、先に全キーのハッシュを計算してホーム位置をプリフェッチし、
+ *       	その後で探索する。キャッシュミスの待ち時間がキー同士で重なる。
+ *       	見つかったデータもプリフェッチしておく。未登録でもログは出さない。
+ *       	期限切れのキーは未登録として扱う。(他の結果のアドレスが変わらないように、削除はしない)
+ *       	シャード付きハンドルではキーをシャード毎にまとめて引く。(map_shard_get_batch参照)
+ *       	戻り値は見つかった件数。
+ * @attention:	返却値の有効期間はHashMap_get()と同じ。
+ =========================================================================================*/
+int HashMap_getBatch(HashMapHandle handle, char **keys, int num, void **results)
+{
+	int i, j, n, ret = 0;
+	int len[BATCH_WINDOW];
+	unsigned int hash[BATCH_WINDOW];
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	if ((NULL == keys) || (NULL == results) || (num < 0)) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	if (0 < handle->shards) {
+		ret = map_shard_get_batch(handle, keys, num, results);
+		goto catch_exit;
+	}
+
+	/* 1件毎に移行するのと同じ量をまとめて移行する */
+	if ((false == map_is_iterating(handle)) && (0 < handle->rehash_step)) {
+		map_rehash_step(handle, (num < (INT_MAX / handle->rehash_step)) ? (handle->rehash_step * num) : (INT_MAX));
+	}
+
+	for (i=0; i<num; i+=BATCH_WINDOW) {
+		n = ((num - i) < BATCH_WINDOW) ? (num - i) : (BATCH_WINDOW);
+
+		/*! hash all keys and prefetch home slots */
+		for (j=0; j<n; j++) {
+			char *key = keys[i + j];
+			if ((NULL == key) || ('\0' == key[0])) {
+				len[j] = 0;
+				continue;
+			}
+			len[j] = strlen(key);
+			hash[j] = map_hash(handle, key, len[j], handle->table.tblsz);
+			map_prefetch(handle, &(handle->table), hash[j]);
+		}
+
+		/*! resolve probes */
+		for (j=0; j<n; j++) {
+			HashTable *t;
+			int index;
+			results[i + j] = NULL;
+			if (0 == len[j]) { continue; }
+			index = map_lookup(handle, keys[i + j], len[j], hash[j], &t);
+			if ((INVALID_CORD == index) || map_expired(handle, t, index)) {
+				handle->misses++;
+				continue;
+			}
+			handle->hits++;
+			map_touch(t, index);
+			results[i + j] = map_value(handle, t, index);
+			PREFETCH(results[i + j]);
+			ret++;
+		}
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_insertBatch(HashMapHandle handle, char **keys, void **data, int num)
+ * @brief:	Register Data of Many Keys on Hash Table
+ * @note:	keys[i]にdata[i]を登録する。HashMap_getBatch()と同様に、先にハッシュ計算と
+ *       	プリフェッチをまとめて行う。登録済み等で失敗したキーは読み飛ばす。
+ *       	戻り値は登録できた件数。
+ * @attention:	途中でテーブルが拡張された場合、fookされたhash関数の値は計算し直す。
+ =========================================================================================*/
+int HashMap_insertBatch(HashMapHandle handle, char **keys, void **data, int num)
+{
+	int i, j, n, tblsz, ret = 0;
+	int len[BATCH_WINDOW];
+	unsigned int hash[BATCH_WINDOW];
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if ((NULL == keys) || (NULL == data) || (num < 0)) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	if (0 < handle->shards) {
+		ret = map_shard_load(handle, keys, data, num, 1);
+		goto catch_exit;
+	}
+
+	for (i=0; i<num; i+=BATCH_WINDOW) {
+		n = ((num - i) < BATCH_WINDOW) ? (num - i) : (BATCH_WINDOW);
+
+		/*! hash all keys and prefetch home slots */
+		tblsz = handle->table.tblsz;
+		for (j=0; j<n; j++) {
+			char *key = keys[i + j];
+			if ((NULL == key) || ('\0' == key[0])) {
+				len[j] = 0;
+				continue;
+			}
+			len[j] = strlen(key);
+			hash[j] = map_hash(handle, key, len[j], tblsz);
+			map_prefetch(handle, &(handle->table), hash[j]);
+		}
+
+		/*! register */
+		for (j=0; j<n; j++) {
+			if (0 == len[j]) {
+				DIAG("error ! invalid key ! @%s() \n", __func__);
+				continue;
+			}
+			if ((NULL == handle->hash_full) && (tblsz != handle->table.tblsz)) {
+				hash[j] = map_hash(handle, keys[i + j], len[j], handle->table.tblsz);
+			}
+			if (HASHMAP_OK == map_insert(handle, keys[i + j], len[j], hash[j], data[i + j])) { ret++; }
+		}
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_bulkLoad(HashMapHandle handle, char **keys, void **data, int num, int nthreads)
+ * @brief:	Register Data of Many Keys on Hash Table by Threads
+ * @note:	HashMap_insertBatch()と同じ結果になるように、keys[i]にdata[i]をnthreads個のスレッドで登録する。
+ *       	1. 自動リサイズモードでは、全件入るサイズまで先にテーブルを拡張する。(一括で再構築する)
+ *       	2. キーの長さとハッシュ値を並列に求める。
+ *       	3. テーブルをスレッド数に分け、ホーム位置で担当スレッドを決めて並列に登録する。
+ *       	   長いキーの置き場所は担当毎にキーアリーナ上に予約しておく。
+ *       	4. 担当範囲の外まで探索が及ぶキーだけ、最後に順に登録する。
+ *       	期限モードの巡回回収は、スレッドに分ける前にまとめて1スレッドで行う。
+ *       	登録済み等で失敗したキーは読み飛ばす。戻り値は登録できた件数。
+ *       	同じキーが複数ある場合は先のdataを登録する。
+ * @attention:	fookされたhash関数は複数のスレッドから同時に呼ばれる。
+ *           	重複したキーや登録済みのキーの分は、キーアリーナに削除済みとして残る。
+ *           	キャッシュモードではHashMap_insertBatch()と同じく1スレッドで登録する。
+ *           	シャード付きハンドルではシャードをスレッドに分けて登録する。(map_shard_load参照)
+ =========================================================================================*/
+int HashMap_bulkLoad(HashMapHandle handle, char **keys, void **data, int num, int nthreads)
+{
+	int i, p, parts, span, tblsz, deleted, ret = 0;
+	int *len = NULL, *order = NULL, start[WORKER_MAX + 1];
+	unsigned int *hash = NULL;
+	unsigned char *defer = NULL;
+	size_t reserve[WORKER_MAX], total = 0;
+	MapBulkWork *works = NULL;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if ((NULL == keys) || (NULL == data) || (num < 0)) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (0 == num) { goto catch_exit; }
+	if (nthreads < 1) { nthreads = 1; }
+	if (WORKER_MAX < nthreads) { nthreads = WORKER_MAX; }
+
+	/*! sharded handle: threads register to their own shards */
+	if (0 < handle->shards) {
+		ret = map_shard_load(handle, keys, data, num, nthreads);
+		goto catch_exit;
+	}
+
+	/*! cache mode: keys are evicted in order of registration */
+	if (handle->cache) {
+		ret = HashMap_insertBatch(handle, keys, data, num);
+		goto catch_exit;
+	}
+
+	/*! finish migration, and reclaim expired keys here (workers do not sweep) */
+	map_rehash_step(handle, INT_MAX);
+	if (0 < handle->sweep_step) {
+		long long step = (long long)handle->sweep_step * num;
+		map_sweep(handle, (step < handle->table.tblsz) ? (int)step : handle->table.tblsz);
+	}
+
+	/*! grow table for all keys (auto resize mode) */
+	if (handle->resizable) {
+		double size = handle->table.tblsz;
+		while (((double)handle->count + num) > (handle->max_load * size)) {
+			size = (size * handle->growth < size + 1) ? (size + 1) : (size * handle->growth);
+		}
+		if (INT_MAX < size) {
+			DIAG("warning ! failed to grow hash table ! @%s() \n", __func__);
+		} else if (((double)handle->count + handle->deleted + num) > (handle->max_load * handle->table.tblsz)) {
+			if (NG == map_rehash(handle, (int)size)) { DIAG("warning ! failed to grow hash table ! @%s() \n", __func__); }
+		}
+	}
+	tblsz = handle->table.tblsz;
+
+	/*! split table into parts (swiss: by group) */
+	span = (tblsz + nthreads - 1) / nthreads;
+	if (HASHMAP_ENGINE_SWISS == handle->engine) { span = (span + CTRL_GROUP - 1) & ~(CTRL_GROUP - 1); }
+	parts = (tblsz + span - 1) / span;
+
+	len = (int *)map_alloc(handle, sizeof(int) * num);
+	hash = (unsigned int *)map_alloc(handle, sizeof(unsigned int) * num);
+	order = (int *)map_alloc(handle, sizeof(int) * num);
+	defer = (unsigned char *)map_alloc(handle, (size_t)num);
+	works = (MapBulkWork *)map_alloc(handle, sizeof(MapBulkWork) * nthreads);
+	if ((NULL == len) || (NULL == hash) || (NULL == order) || (NULL == defer) || (NULL == works)) {
+		DIAG("error ! memory alocate failed ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	memset(defer, 0, (size_t)num);
+
+	/*! hash keys */
+	for (p=0; p<nthreads; p++) {
+		MapBulkWork *w = &works[p];
+		w->local = *handle;
+		w->keys = keys;
+		w->data = data;
+		w->len = len;
+		w->hash = hash;
+		w->first = (int)((long long)num * p / nthreads);
+		w->last = (int)((long long)num * (p + 1) / nthreads);
+	}
+	map_run_workers(map_bulk_hash, works, sizeof(MapBulkWork), nthreads);
+
+	/*! sort keys by part (counting sort), and reserve key arena for each part */
+	memset(start, 0, sizeof(start));
+	memset(reserve, 0, sizeof(reserve));
+	for (i=0; i<num; i++) {
+		if (0 == len[i]) { continue; }
+		p = map_home(handle, hash[i], tblsz) / span;
+		start[p + 1]++;
+		if (KEY_INLINE_LEN <= len[i]) { reserve[p] += (size_t)len[i] + 1; }
+	}
+	for (p=0; p<parts; p++) {
+		start[p + 1] += start[p];
+		total += reserve[p];
+	}
+	if ((handle->arena_size - handle->arena_used) < total) {
+		size_t size = (0 == handle->arena_size) ? (KEY_ARENA_MIN) : (handle->arena_size);
+		char *arena;
+		while (size < (handle->arena_used + total)) { size *= 2; }
+		arena = (char *)map_realloc(handle, handle->key_arena, handle->arena_size, size);
+		if (NULL == arena) {
+			DIAG("error ! memory alocate failed ! [%zd byte] \n", size);
+			ret = NG;
+			goto catch_exit;
+		}
+		handle->key_arena = arena;
+		handle->arena_size = size;
+	}
+	for (p=0; p<parts; p++) {
+		MapBulkWork *w = &works[p];
+		w->local = *handle;
+		w->local.trace = NULL;	/* not shared by threads */
+		w->local.resizable = false;
+		w->local.sweep_step = 0;	/* sweeper would touch whole table and arena */
+		w->local.arena_used = (0 == p) ? (handle->arena_used) : (works[p - 1].local.arena_size);
+		w->local.arena_size = w->local.arena_used + reserve[p];
+		w->order = order;
+		w->first = start[p];
+		w->last = start[p];
+		w->lo = p * span;
+		w->hi = (tblsz < (p + 1) * span) ? (tblsz) : ((p + 1) * span);
+		w->defer = defer;
+		w->inserted = 0;
+	}
+	for (i=0; i<num; i++) {
+		if (0 == len[i]) { continue; }
+		order[works[map_home(handle, hash[i], tblsz) / span].last++] = i;
+	}
+
+	/*! register keys on own part */
+	deleted = handle->deleted;
+	map_run_workers(map_bulk_insert, works, sizeof(MapBulkWork), parts);
+	for (p=0; p<parts; p++) {
+		MapBulkWork *w = &works[p];
+		ret += w->inserted;
+		handle->count += w->inserted;
+		handle->deleted -= deleted - w->local.deleted;	/* reused tombstones */
+		handle->arena_dead += w->local.arena_size - w->local.arena_used;
+	}
+	handle->arena_used += total;
+	map_stats_rebuild(handle);
+
+	/*! register the rest in order */
+	for (i=0; i<num; i++) {
+		if (0 == len[i]) {
+			DIAG("error ! invalid key ! @%s() \n", __func__);
+			continue;
+		}
+		if (0 == defer[i]) { continue; }
+		if ((NULL == handle->hash_full) && (tblsz != handle->table.tblsz)) {
+			hash[i] = map_hash(handle, keys[i], len[i], handle->table.tblsz);
+		}
+		if (HASHMAP_OK == map_insert(handle, keys[i], len[i], hash[i], data[i])) { ret++; }
+	}
+
+catch_exit:
+	map_free(handle, works, sizeof(MapBulkWork) * nthreads);
+	map_free(handle, defer, (size_t)num);
+	map_free(handle, order, sizeof(int) * num);
+	map_free(handle, hash, sizeof(unsigned int) * num);
+	map_free(handle, len, sizeof(int) * num);
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_clear(HashMapHandle handle)
+ * @brief:	All Clear Hash Table (not free)
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+int HashMap_clear(HashMapHandle handle)
+{
+	int i, ret;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if (0 < handle->shards) {
+		for (i=0, ret=OK; i<handle->shards; i++) {
+			MapShard *s = map_shard_lock(handle, i);
+			if (OK != HashMap_clear(s->map)) { ret = NG; }
+			map_shard_unlock(s);
+		}
+		goto catch_exit;
+	}
+
+	map_table_free(handle, &(handle->old));
+	handle->rehash_pos = 0;
+	handle->generation++;
+	memset(handle->table.ctrl, CTRL_EMPTY, handle->table.tblsz);
+	handle->count = 0;
+	handle->arena_used = 0;
+	handle->arena_dead = 0;
+	handle->deleted = 0;
+	handle->cache_bytes = 0;
+	handle->clock_hand = 0;
+	handle->sweep_pos = 0;
+	map_stats_rebuild(handle);
+	ret = OK;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_setAutoResize(HashMapHandle handle, bool enable, float max_load, float growth)
+ * @brief:	Configure Auto Resize Mode
+ * @note:	enable時、負荷率(登録数+墓標数)/テーブルサイズがmax_loadを超えるとHashMap_insert()で
+ *       	テーブルをgrowth倍に拡張して再構築する。max_loadはHashMap_shrink()でも使用する。
+ * @attention:	max_loadは(0, 1]、growthは1より大きい値を指定すること。
+ =========================================================================================*/
+int HashMap_setAutoResize(HashMapHandle handle, bool enable, float max_load, float growth)
+{
+	int ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	if ((max_load <= 0.0f) || (1.0f < max_load)) {
+		DIAG("error ! max load factor must be in (0, 1] ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (growth <= 1.0f) {
+		DIAG("error ! growth factor must be more than 1 ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	PRE_SHARD_EACH(handle, ret, catch_exit, HashMap_setAutoResize, enable, max_load, growth);
+
+	handle->resizable = enable;
+	handle->max_load = max_load;
+	handle->growth = growth;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_shrink(HashMapHandle handle)
+ * @brief:	Shrink Hash Table to Fit
+ * @note:	登録数がmax_loadに収まる最小のサイズでテーブルを再構築する。
+ *       	大量にeraseした後に呼び出すことで、メモリと墓標を回収できる。
+ * @attention:	自動リサイズモードでなくても使用できる。イテレータ位置は無効になる。
+ =========================================================================================*/
+int HashMap_shrink(HashMapHandle handle)
+{
+	int i, ret = OK;
+	double tblsz;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if (0 < handle->shards) {
+		for (i=0; i<handle->shards; i++) {
+			MapShard *s = map_shard_lock(handle, i);
+			if (OK != HashMap_shrink(s->map)) { ret = NG; }
+			map_shard_unlock(s);
+		}
+		goto catch_exit;
+	}
+
+	tblsz = (int)((double)handle->count / handle->max_load);
+	if ((tblsz * handle->max_load) < handle->count) { tblsz += 1.0; }
+	if (tblsz < 1.0) { tblsz = 1.0; }
+	tblsz = map_table_size(handle, (int)tblsz);
+	if ((handle->table.tblsz <= (int)tblsz) && (0 == handle->deleted)) { goto catch_exit; }
+	if (handle->table.tblsz < (int)tblsz) { tblsz = handle->table.tblsz; }
+
+	ret = map_rehash(handle, (int)tblsz);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_setIncrementalRehash(HashMapHandle handle, int step)
+ * @brief:	Configure Incremental Rehash
+ * @note:	step>0の時、テーブル拡張時に新旧テーブルを並存させ、insert/get/erase毎に
+ *       	旧テーブルのスロットをstep個ずつ移行する。1回の操作での停止時間を抑えられる。
+ *       	step=0の時は一括でリハッシュする(移行中であれば、ここで移行を完了させる)。
+ * @attention:	移行中は両方のテーブルを探索するため、一時的にメモリと探索コストが増える。
+ =========================================================================================*/
+int HashMap_setIncrementalRehash(HashMapHandle handle, int step)
+{
+	int ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	if (step < 0) {
+		DIAG("error ! rehash step must be 0 or more ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	PRE_SHARD_EACH(handle, ret, catch_exit, HashMap_setIncrementalRehash, step);
+
+	handle->rehash_step = step;
+	if (0 == step) { map_rehash_step(handle, INT_MAX); }
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_setSeed(HashMapHandle handle, uint64_t seed)
+ * @brief:	Set Seed of Built-in Hash Function
+ * @note:	マップ毎に異なるseedを与えることで、同じキー集合でも配置が変わる。
+ *       	登録済みのデータがある場合はハッシュ値を計算し直して再配置する。
+ *       	シャード付きハンドルでは各シャードのseedを変える。(シャードへの振り分けは変わらない)
+ * @attention:	hash関数をfookしている場合は使用できない。イテレータ位置は無効になる。
+ =========================================================================================*/
+int HashMap_setSeed(HashMapHandle handle, uint64_t seed)
+{
+	int i, ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if (NULL == handle->hash_full) {
+		DIAG("error ! seed is available only for built-in hash ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	PRE_SHARD_EACH(handle, ret, catch_exit, HashMap_setSeed, seed);
+
+	map_rehash_step(handle, INT_MAX);
+	handle->seed = seed;
+	if (0 == handle->count) { goto catch_exit; }
+
+	for (i=0; i<handle->table.tblsz; i++) {
+		HashData *p = &(handle->table.slots[i]);
+		if (CTRL_FULL & handle->table.ctrl[i]) { p->hash = map_hash(handle, map_key(handle, p), p->keylen, handle->table.tblsz); }
+	}
+	ret = map_rehash(handle, handle->table.tblsz);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_setCache(HashMapHandle handle, int max_entries, size_t max_bytes, void (* evict)(const char *key, size_t len, void *data, void *arg), void *arg)
+ * @brief:	Configure Cache Mode
+ * @note:	キャッシュモードでは、登録時に件数がmax_entries、バイト数がmax_bytesを超える場合や
+ *       	テーブルに空きが無い場合に、失敗する代わりにCLOCKで選んだキーを追い出す。
+ *       	バイト数はキー毎に(キー長 + cellsz)で数える。0はその上限を設けない。
+ *       	参照(get/peek/登録済みキーへのinsert等)されたキーは参照ビットを立て、
+ *       	CLOCKの針が一周するまで追い出されない。参照ビットはスロット毎に1byteで、
+ *       	キー毎のリストやメモリ確保は無い。
+ *       	追い出す前にevict(キー、キー長、データ、arg)を呼ぶ(NULL可)。
+ *       	追い出した件数はHashMap_stats()のevictionsで、ヒット/ミスはhits/missesで得られる。
+ *       	既に上限を超えている場合は、ここで追い出す。
+ *       	max_entries、max_bytesが共に0の場合はキャッシュモードを解除する。
+ *       	シャード付きハンドルでは、上限をシャード毎に等分(切り上げ)して追い出しもシャード毎に行う。
+ * @attention:	evictの中でマップを操作しないこと。
+ *           	キャッシュモードではインクリメンタルリハッシュを使わない。(一括でリハッシュする)
+ *           	1件でmax_bytesを超えるキーは登録できない。(HASHMAP_FULL)
+ =========================================================================================*/
+int HashMap_setCache(HashMapHandle handle, int max_entries, size_t max_bytes, void (* evict)(const char *key, size_t len, void *data, void *arg), void *arg)
+{
+	int i, ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if (max_entries < 0) {
+		DIAG("error ! max entries must be 0 or more ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	PRE_SHARD_EACH(handle, ret, catch_exit, HashMap_setCache, max_entries / handle->shards + (0 != max_entries % handle->shards),
+	               max_bytes / handle->shards + (0 != max_bytes % handle->shards), evict, arg);
+
+	map_rehash_step(handle, INT_MAX);
+
+	/*! leave cache mode */
+	if ((0 == max_entries) && (0 == max_bytes)) {
+		map_free(handle, handle->table.refs, handle->table.tblsz);
+		handle->table.refs = NULL;
+		handle->cache = false;
+		handle->evict = NULL;
+		handle->evict_arg = NULL;
+		goto catch_exit;
+	}
+
+	/*! reference bits, and bytes of registered keys */
+	if (NULL == handle->table.refs) {
+		handle->table.refs = (unsigned char *)map_alloc(handle, handle->table.tblsz);
+		if (NULL == handle->table.refs) {
+			DIAG("error ! memory alocate failed ! [%d byte] \n", handle->table.tblsz);
+			ret = NG;
+			goto catch_exit;
+		}
+		memset(handle->table.refs, 0, handle->table.tblsz);
+	}
+	if (false == handle->cache) {
+		handle->cache_bytes = 0;
+		for (i=0; i<handle->table.tblsz; i++) {
+			if (CTRL_FULL & handle->table.ctrl[i]) { handle->cache_bytes += (size_t)handle->table.slots[i].keylen + handle->cellsz; }
+		}
+		handle->clock_hand = 0;
+	}
+
+	handle->cache = true;
+	handle->cache_max = max_entries;
+	handle->cache_max_bytes = max_bytes;
+	handle->evict = evict;
+	handle->evict_arg = arg;
+	map_cache_evict(handle, 0, 0);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_setExpiry(HashMapHandle handle, bool enable, int sweep_step, uint64_t (* clock)(void *arg), void *arg)
+ * @brief:	Configure Expiry Mode (TTL)
+ * @note:	enable時、HashMap_insertTtl()/HashMap_expire()でキー毎に期限を付けられる。
+ *       	期限はスロット毎に8byteで、テーブルと並べて持つ。
+ *       	期限切れのキーはHashMap_get()等で見つからなかったものとし、その場で回収する。(lazy)
+ *       	sweep_step>0の時、登録毎にsweep_step個のスロットを巡回して期限切れのキーを回収する。
+ *       	HashMap_sweep()で任意の時に回収してもよい。いずれもテーブル全体を一度に走査しない。
+ *       	clockは時刻関数で、ttlと同じ単位の単調増加する値を返すこと。
+ *       	NULLの場合は単調増加するミリ秒を使う。
+ *       	disable時は期限をすべて捨てる。(期限切れのキーも残る)
+ * @attention:	回収されるまで、期限切れのキーもHashMap_size()やイテレータに現れる。
+ *           	期限モードのハンドルはHashMap_save()できない。HashMap_freeze()は期限切れのキーを除く。
+ =========================================================================================*/
+int HashMap_setExpiry(HashMapHandle handle, bool enable, int sweep_step, uint64_t (* clock)(void *arg), void *arg)
+{
+	int ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if (sweep_step < 0) {
+		DIAG("error ! sweep step must be 0 or more ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (0 < handle->shards) { handle->expiry = enable; }	/* checked before routing */
+	PRE_SHARD_EACH(handle, ret, catch_exit, HashMap_setExpiry, enable, sweep_step, clock, arg);
+
+	map_rehash_step(handle, INT_MAX);
+
+	if (false == enable) {
+		map_free(handle, handle->table.expires, sizeof(uint64_t) * handle->table.tblsz);
+		handle->table.expires = NULL;
+		handle->expiry = false;
+		handle->sweep_step = 0;
+		handle->clock = NULL;
+		handle->clock_arg = NULL;
+		goto catch_exit;
+	}
+
+	if (NULL == handle->table.expires) {
+		handle->table.expires = (uint64_t *)map_alloc(handle, sizeof(uint64_t) * handle->table.tblsz);
+		if (NULL == handle->table.expires) {
+			DIAG("error ! memory alocate failed ! [%zd byte] \n", sizeof(uint64_t) * handle->table.tblsz);
+			ret = NG;
+			goto catch_exit;
+		}
+		memset(handle->table.expires, 0, sizeof(uint64_t) * handle->table.tblsz);
+	}
+	handle->expiry = true;
+	handle->sweep_step = sweep_step;
+	handle->clock = clock;
+	handle->clock_arg = arg;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_insertTtl(HashMapHandle handle, char *key, void *data, uint64_t ttl)
+ * @brief:	Register Data with Time to Live
+ * @note:	HashMap_insert()と同じく登録し、現在時刻 + ttlを期限にする。ttl=0は期限無し。
+ *       	期限切れのキーが残っている場合は、登録し直す。
+ * @attention:	期限モード(HashMap_setExpiry)であること。
+ =========================================================================================*/
+int HashMap_insertTtl(HashMapHandle handle, char *key, void *data, uint64_t ttl)
+{
+	int ret, len;
+	EHashMapStatus status;
+	void *value;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+	PRE_KEY_CHECK(key, ret, NG, catch_exit);
+
+	if (false == handle->expiry) {
+		DIAG("error ! expiry mode is not enabled ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	len = strlen(key);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_insertTtl, key, data, ttl);
+	status = map_emplace(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), &value);
+	if (HASHMAP_OK == status) {
+		memcpy(value, data, handle->cellsz);
+		map_set_ttl(handle, value, ttl);
+	}
+	ret = map_status_report(status, key, len, __func__);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_expire(HashMapHandle handle, char *key, uint64_t ttl)
+ * @brief:	Set Time to Live of Registered Key
+ * @note:	登録済みのキーの期限を現在時刻 + ttlにする。ttl=0は期限を外す。
+ * @attention:	期限モード(HashMap_setExpiry)であること。期限切れのキーはNGを返す。
+ =========================================================================================*/
+int HashMap_expire(HashMapHandle handle, char *key, uint64_t ttl)
+{
+	int ret = OK;
+	int index, len;
+	HashTable *t;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+	PRE_KEY_CHECK(key, ret, NG, catch_exit);
+
+	if (false == handle->expiry) {
+		DIAG("error ! expiry mode is not enabled ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	len = strlen(key);
+	PRE_SHARD_ROUTE(handle, key, len, ret, catch_exit, HashMap_expire, key, ttl);
+	index = map_lookup(handle, key, len, map_hash(handle, key, len, handle->table.tblsz), &t);
+	if ((INVALID_CORD == index) || map_reclaim(handle, t, index)) {
+		ret = map_status_report(HASHMAP_NOT_FOUND, key, len, __func__);
+		goto catch_exit;
+	}
+	t->expires[index] = (0 == ttl) ? (0) : (map_now(handle) + ttl);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_sweep(HashMapHandle handle, int step)
+ * @brief:	Reclaim Expired Keys Incrementally
+ * @note:	前回の続きからstep個のスロットを調べ、期限切れのキーを削除する。
+ *       	タイマー等から定期的に呼ぶことで、参照されないまま期限切れになったキーも
+ *       	少しずつ回収できる。戻り値は回収した件数。
+ *       	シャード付きハンドルでは、stepを各シャードに等分(切り上げ)する。
+ * @attention:	走査中は何もしない。
+ =========================================================================================*/
+int HashMap_sweep(HashMapHandle handle, int step)
+{
+	int i, ret = 0;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	PRE_WRITE_CHECK(handle, ret, NG, catch_exit);
+
+	if (false == handle->expiry) {
+		DIAG("error ! expiry mode is not enabled ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	if (0 < handle->shards) {
+		for (i=0; i<handle->shards; i++) {
+			MapShard *s = map_shard_lock(handle, i);
+			ret += HashMap_sweep(s->map, step / handle->shards + (0 != step % handle->shards));
+			map_shard_unlock(s);
+		}
+		goto catch_exit;
+	}
+	ret = map_sweep(handle, step);
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_shardCount(HashMapHandle handle)
+ * @brief:	Get Number of Shards
+ * @note:	シャード付きハンドルでなければ0を返す。
+ * @attention:
+ =========================================================================================*/
+int HashMap_shardCount(HashMapHandle handle)
+{
+	int ret = 0;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, 0, catch_exit);
+
+	ret = handle->shards;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	HashMapHandle HashMap_shard(HashMapHandle handle, int index)
+ * @brief:	Get Inner Map of Sharded Handle
+ * @note:	index番目のシャードを通常のハンドルとして返す。シャード毎の保存(HashMap_save)、
+ *       	統計、設定の変更などに使う。
+ * @attention:	シャードのロックは取らない。他のスレッドが操作していない時に使うこと。
+ *           	返したハンドルをHashMap_free()しないこと。(handleと一緒に解放する)
+ =========================================================================================*/
+HashMapHandle HashMap_shard(HashMapHandle handle, int index)
+{
+	HashMapHandle ret = NULL;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
+
+	if ((index < 0) || (handle->shards <= index)) {
+		DIAG("error ! invalid shard index ! [%d] @%s() \n", index, __func__);
+		goto catch_exit;
+	}
+	ret = handle->shard[index].map;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_setTrace(HashMapHandle handle, bool enable, uint64_t slow_cycles, int sample_rate)
+ * @brief:	Configure Tracing
+ * @note:	enable時、insert/get/erase/リサイズの所要サイクルを操作毎に2の冪のヒストグラムで数える。
+ *       	get系でslow_cycles以上かかった検索を遅い検索とし、sample_rate回に1回、ハッシュ値と探索長を
+ *       	記録する。(最新HASHMAP_TRACE_SAMPLES個) sample_rate=0の場合は記録しない。
+ *       	結果はHashMap_trace()で取り出す。disable時は集計を捨てる。
+ *       	無効時の負荷は操作毎にポインタの比較1回。有効時はサイクルカウンタの読み出し2回。
+ *       	-DHASHMAP_USDTでビルドすると、USDTプローブ hashmap:slow_lookup(handle, hash, probe, cycles)、
+ *       	hashmap:resize(handle, old_tblsz, tblsz, cycles) も発火する。(有効時のみ)
+ *       	シャード付きハンドルでは各シャードに設定する。
+ * @attention:	getBatch/peek/bulkLoadは計測しない。リサイズの時間は同時にinsertの時間にも含まれる。
+ *           	インクリメンタルリハッシュの移行はリサイズではなく、その時の操作の時間に含まれる。
+ =========================================================================================*/
+int HashMap_setTrace(HashMapHandle handle, bool enable, uint64_t slow_cycles, int sample_rate)
+{
+	int ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	if (sample_rate < 0) {
+		DIAG("error ! sample rate must be 0 or more ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	PRE_SHARD_EACH(handle, ret, catch_exit, HashMap_setTrace, enable, slow_cycles, sample_rate);
+
+	if (false == enable) {
+		map_free(handle, handle->trace, sizeof(MapTrace));
+		handle->trace = NULL;
+		goto catch_exit;
+	}
+
+	if (NULL == handle->trace) {
+		handle->trace = (MapTrace *)map_alloc(handle, sizeof(MapTrace));
+		if (NULL == handle->trace) {
+			DIAG("error ! memory alocate failed ! [%zd byte] \n", sizeof(MapTrace));
+			ret = NG;
+			goto catch_exit;
+		}
+		memset(handle->trace, 0, sizeof(MapTrace));
+	}
+	handle->trace->slow_cycles = slow_cycles;
+	handle->trace->sample_rate = sample_rate;
+	handle->trace->countdown = sample_rate;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_trace(HashMapHandle handle, HashMapTrace *trace, bool reset)
+ * @brief:	Get Tracing
+ * @note:	HashMap_setTrace()以降の集計をtraceに返す。resetがtrueなら集計を0に戻す。
+ *       	トレースしていない場合はすべて0を返す。
+ *       	シャード付きハンドルは全シャードの合計。サンプルはシャード順に詰める。
+ * @attention:	
+ =========================================================================================*/
+int HashMap_trace(HashMapHandle handle, HashMapTrace *trace, bool reset)
+{
+	int i, j, ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	if (NULL == trace) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	memset(trace, 0, sizeof(HashMapTrace));
+	if (NULL != handle->trace) {
+		MapTrace *tr = handle->trace;
+		*trace = tr->data;
+		for (i=0; i<tr->data.samples; i++) {
+			trace->sample[i] = tr->data.sample[(tr->head - tr->data.samples + i + HASHMAP_TRACE_SAMPLES) % HASHMAP_TRACE_SAMPLES];
+		}
+		if (reset) {
+			memset(&(tr->data), 0, sizeof(HashMapTrace));
+			tr->head = 0;
+			tr->countdown = tr->sample_rate;
+		}
+	}
+
+	/*! sharded handle: sum of shards */
+	for (i=0; i<handle->shards; i++) {
+		HashMapTrace one;
+		MapShard *s = map_shard_lock(handle, i);
+		HashMap_trace(s->map, &one, reset);
+		map_shard_unlock(s);
+		for (j=0; j<HASHMAP_OP_NUM; j++) {
+			int b;
+			trace->ops[j] += one.ops[j];
+			trace->cycles[j] += one.cycles[j];
+			if (trace->max_cycles[j] < one.max_cycles[j]) { trace->max_cycles[j] = one.max_cycles[j]; }
+			for (b=0; b<HASHMAP_TRACE_HIST; b++) { trace->hist[j][b] += one.hist[j][b]; }
+		}
+		trace->slow += one.slow;
+		trace->sampled += one.sampled;
+		for (j=0; (j < one.samples) && (trace->samples < HASHMAP_TRACE_SAMPLES); j++) {
+			trace->sample[trace->samples++] = one.sample[j];
+		}
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_show(HashMapHandle handle)
+ * @brief:	Show Current Hash Table
+ * @note:	For Debug
+ * @attention:	
+ =========================================================================================*/
+int HashMap_show(HashMapHandle handle)
+{
+	int i, ret = OK;
+	HashData *p;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s = map_shard_lock(handle, i);
+		printf("[shard %d] \n", i);
+		HashMap_show(s->map);
+		map_shard_unlock(s);
+	}
+	for (i=0; i<handle->old.tblsz; i++) {
+		p = &(handle->old.slots[i]);
+		if (CTRL_FULL & handle->old.ctrl[i]) {
+			printf("[old %2d] data-addr:0x%08lX key:\"%.*s\" hash:%2d \n",
+			       i, (unsigned long)map_value(handle, &(handle->old), i), p->keylen, map_key(handle, p), map_home(handle, p->hash, handle->old.tblsz));
+		}
+	}
+	for (i=0; i<handle->table.tblsz; i++) {
+		p = &(handle->table.slots[i]);
+		if (CTRL_FULL & handle->table.ctrl[i]) {
+			printf("[%2d] data-addr:0x%08lX key:\"%.*s\" hash:%2d \n",
+			       i, (unsigned long)map_value(handle, &(handle->table), i), p->keylen, map_key(handle, p), map_home(handle, p->hash, handle->table.tblsz));
+		}
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_empty(HashMapHandle handle)
+ * @brief:	Check Hash Table is Empty
+ * @note:	return "true" or "false"
+ *       	登録数はinsert/eraseで更新しているので、テーブルは走査しない。
+ * @attention:	
+ =========================================================================================*/
+bool HashMap_empty(HashMapHandle handle)
+{
+	bool ret = true;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
+
+	ret = (0 == HashMap_size(handle));
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*========================================================================================
+ * @name:	int HashMap_maxsize(HashMapHandle handle)
+ * @brief:	Get Hash Table Max Size
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+int HashMap_maxsize(HashMapHandle handle)
+{
+	int i, ret;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+
+	ret = handle->table.tblsz;
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s = map_shard_lock(handle, i);
+		ret += s->map->table.tblsz;
+		map_shard_unlock(s);
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*========================================================================================
+ * @name:	int HashMap_size(HashMapHandle handle)
+ * @brief:	Get Hash Table Data Num
+ * @note:	登録数はinsert/eraseで更新しているので、テーブルは走査しない。
+ *       	シャード付きハンドルでは各シャードの登録数の合計。
+ * @attention:	
+ =========================================================================================*/
+int HashMap_size(HashMapHandle handle)
+{
+	int i, size = 0;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, size, NG, catch_exit);
+
+	size = handle->count;
+	for (i=0; i<handle->shards; i++) {
+		MapShard *s = map_shard_lock(handle, i);
+		size += s->map->count;
+		map_shard_unlock(s);
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return size;
+}
+
+
+/*========================================================================================
+ * @name:	void* HashMap_next(HashMapHandle handle)
+ * @brief:	Iterator
+ * @note:	インクリメンタルリハッシュ中は旧テーブル、新テーブルの順に走査する。
+ *       	走査中は移行を止めるので、同じ要素を二度返すことはない。
+ * @attention:	走査中にテーブルの拡張が必要になった場合は移行を完了させるため、走査位置は無効になる。
+ =========================================================================================*/
+void* HashMap_next(HashMapHandle handle)
+{
+	void *ret = NULL;
+	int end;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
+
+	/* iterator_pos of sharded handle is the shard being iterated */
+	while ((0 < handle->shards) && (NULL == ret) && (handle->iterator_pos < handle->shards)) {
+		ret = HashMap_next(handle->shard[handle->iterator_pos].map);
+		if ((NULL == ret) && (++handle->iterator_pos < handle->shards)) { HashMap_begin(handle->shard[handle->iterator_pos].map); }
+	}
+
+	end = handle->old.tblsz + handle->table.tblsz;
+	if (end > handle->iterator_pos) {
+		int i = map_iter_seek(handle, handle->iterator_pos, end);
+		if (i < end) { ret = map_iter_value(handle, i); }
+		handle->iterator_pos = (i < end) ? (i+1) : (end);
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*========================================================================================
+ * @name:	void HashMap_begin(HashMapHandle handle)
+ * @brief:	Reset Iterator
+ * @note:	
+ * @attention:	
+ =========================================================================================*/
+void HashMap_begin(HashMapHandle handle)
+{
+	bool ret;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
+
+	handle->iterator_pos = 0;
+	if (0 < handle->shards) { HashMap_begin(handle->shard[0].map); }
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return;
+}
+
+
+/*========================================================================================
+ * @name:	void HashMap_hasNext(HashMapHandle handle)
+ * @brief:	Check Hash Table End
+ * @note:	Return "true" or "false".
+ *       	見つけた位置を覚えておくので、続くHashMap_next()は探し直さない。
+ *       	末尾に達した場合は走査終了とみなし、止めていたインクリメンタルリハッシュを再開する。
+ * @attention:	
+ =========================================================================================*/
+bool HashMap_hasNext(HashMapHandle handle)
+{
+	bool ret = false;
+	int end;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
+
+	while ((0 < handle->shards) && (false == ret) && (handle->iterator_pos < handle->shards)) {
+		ret = HashMap_hasNext(handle->shard[handle->iterator_pos].map);
+		if ((false == ret) && (++handle->iterator_pos < handle->shards)) { HashMap_begin(handle->shard[handle->iterator_pos].map); }
+	}
+
+	end = handle->old.tblsz + handle->table.tblsz;
+	if (end > handle->iterator_pos) {
+		handle->iterator_pos = map_iter_seek(handle, handle->iterator_pos, end);
+		ret = (handle->iterator_pos < end);
+	}
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*========================================================================================
+ * @name:	int HashMap_iterInit(HashMapHandle handle, HashMapIter *iter)
+ * @brief:	Start External Iterator
+ * @note:	走査位置をhandleではなくiterに持つので、同じハンドルを複数のループで同時に走査できる。
+ *       	インクリメンタルリハッシュ中は、走査が終わるまで移行を止める。
+ *       	登録/削除/イテレーションをしない限り、複数スレッドから同時に走査してよい。
+ *       	シャード付きハンドルはシャードを順に走査する。(シャードのロックは取らない)
+ * @attention:	HashMap_iterNext()がfalseを返す前にループを抜ける場合はHashMap_iterEnd()を呼ぶこと。
+ =========================================================================================*/
+int HashMap_iterInit(HashMapHandle handle, HashMapIter *iter)
+{
+	int ret = OK;
+	LOG("Enter %s -> \n", __func__);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	if (NULL == iter) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	if (0 < handle->shards) {
+		HashMap_iterInit(handle->shard[0].map, iter);
+		iter->handle = handle;
+		goto catch_exit;
+	}
+
+	iter->handle = handle;
+	iter->pos = 0;
+	iter->generation = handle->generation;
+	iter->pinned = (NULL != handle->old.slots);
+	if (iter->pinned) { handle->iterators++; }
+	iter->shard = 0;
+	iter->key = NULL;
+	iter->keylen = 0;
+	iter->data = NULL;
+
+catch_exit:
+	LOG("Leave %s <- \n", __func__);
+	return ret;
+}
+
+
+/*========================================================================================
+ * @name:	bool HashMap_iterNext(HashMapIter *iter)
+ * @brief:	Advance External Iterator
+ * @note:	次の要素のキー(key, keylen)とデータ(data)をiterに設定してtrueを返す。
+ *       	末尾に達した場合はfalseを返し、イテレータを終了する。
+ *       	keyは'\0'で終端している。空きスロットは制御バイトをまとめて調べて読み飛ばす。
+ * @attention:	key、dataは次に登録/削除するまで有効。
+ *           	走査中の登録で移行やテーブルの拡張が起きた場合はfalseを返す(走査位置が無効になるため)。
+ *           	削除はしてもよいが、robinhoodエンジンでは要素を読み飛ばすことがある。
+ =========================================================================================*/
+bool HashMap_iterNext(HashMapIter *iter)
+{
+	bool ret = false;
+	HashMapHandle handle;
+	int end;
 	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
-	PRE_KEY_CHECK(key, ret, NULL, catch_exit);
+	if (NULL == iter) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+	handle = iter->handle;
+	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
 
-	hash_value = handle->hash(key, handle->tblsz);
-	index = map_find(handle, key, hash_value, NULL);
-	if (index == INVALID_CORD) {
-		fprintf(stderr, "error ! \"%s\" isn't registered on hash table ! @HashMap_get() \n", key);
-		ret = NULL;
-	} else {
-		ret = handle->hash_table[index].container;
+	if (0 < handle->shards) {
+		ret = map_shard_iter_next(iter);
+		goto catch_exit;
 	}
+	if (iter->generation != handle->generation) {
+		DIAG("error ! iterator is invalidated by rehash ! @%s() \n", __func__);
+		map_iter_release(iter);
+		goto catch_exit;
+	}
+
+	end = handle->old.tblsz + handle->table.tblsz;
+	if (end > iter->pos) { iter->pos = map_iter_seek(handle, iter->pos, end); }
+	if (end <= iter->pos) {
+		iter->pos = end;
+		map_iter_release(iter);
+		goto catch_exit;
+	}
+
+	iter->key = map_key(handle, map_iter_slot(handle, iter->pos));
+	iter->keylen = (size_t)map_iter_slot(handle, iter->pos)->keylen;
+	iter->data = map_iter_value(handle, iter->pos);
+	iter->pos++;
+	ret = true;
 
-	LOG("index=%d addr=0x%08lX \n", index, (unsigned long)(ret));
 catch_exit:
 	LOG("Leave %s <- \n", __func__);
 	return ret;
 }
 
 
-/*=========================================================================================
- * @name:	int HashMap_erase(HashMapHandle handle, char *key)
- * @brief:	Erase Hash Table Element
- * @note:	
- * @attention:	
+/*========================================================================================
+ * @name:	int HashMap_iterEnd(HashMapIter *iter)
+ * @brief:	End External Iterator
+ * @note:	止めていたインクリメンタルリハッシュを再開する。終了済みのイテレータに呼んでもよい。
+ * @attention:	ハンドルを解放した後に呼ばないこと。
  =========================================================================================*/
-int HashMap_erase(HashMapHandle handle, char *key)
+int HashMap_iterEnd(HashMapIter *iter)
 {
-	int ret, hash_value, index;
+	int ret = OK;
 	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
-	PRE_KEY_CHECK(key, ret, NG, catch_exit);
-
-	hash_value = handle->hash(key, handle->tblsz);
-	index = map_find(handle, key, hash_value, NULL);
-	if (index == INVALID_CORD) {
-		fprintf(stderr, "error ! \"%s\" isn't registered on hash table ! @HashMap_remove() \n", key);
+	if (NULL == iter) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
 		ret = NG;
-	} else {
-		/* erase(initialize) */
-		strcpy(handle->hash_table[index].key, INIT_KEY);
-		ret = OK;
-		LOG("erase key=\"%s\" index=%d \n", key, index);
+		goto catch_exit;
 	}
+	PRE_SAFE_CHECK(iter->handle, ret, NG, catch_exit);
+
+	map_iter_release(iter);
 
 catch_exit:
 	LOG("Leave %s <- \n", __func__);
@@ -398,22 +5026,33 @@ catch_exit:
 }
 
 
-/*=========================================================================================
- * @name:	int HashMap_clear(HashMapHandle handle)
- * @brief:	All Clear Hash Table (not free)
- * @note:	
- * @attention:	
+/*========================================================================================
+ * @name:	int HashMap_foreach(HashMapHandle handle, bool (* func)(const char *key, size_t len, void *data, void *arg), void *arg)
+ * @brief:	Call Function for Each Key
+ * @note:	全要素についてfuncを呼ぶ。funcがfalseを返したらそこで止める。
+ *       	argはそのままfuncに渡す。
+ * @attention:	funcの中で登録しないこと。(移行やテーブルの拡張が起きるとNGで止まる)
  =========================================================================================*/
-int HashMap_clear(HashMapHandle handle)
+int HashMap_foreach(HashMapHandle handle, bool (* func)(const char *key, size_t len, void *data, void *arg), void *arg)
 {
-	int i, ret;
+	int ret = OK;
+	HashMapIter iter;
 	LOG("Enter %s -> \n", __func__);
 	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	if (NULL == func) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
 
-	for (i=0; i<handle->tblsz; i++) {
-		strcpy(handle->hash_table[i].key, INIT_KEY);
+	HashMap_iterInit(handle, &iter);
+	while (HashMap_iterNext(&iter)) {
+		if (false == func(iter.key, iter.keylen, iter.data, arg)) {
+			map_iter_release(&iter);
+			goto catch_exit;
+		}
 	}
-	ret = OK;
+	if ((0 < handle->shards) ? (INVALID_CORD == iter.shard) : (iter.generation != handle->generation)) { ret = NG; }
 
 catch_exit:
 	LOG("Leave %s <- \n", __func__);
@@ -421,26 +5060,60 @@ catch_exit:
 }
 
 
-/*=========================================================================================
- * @name:	int HashMap_show(HashMapHandle handle)
- * @brief:	Show Current Hash Table
- * @note:	For Debug
- * @attention:	
+/*========================================================================================
+ * @name:	int HashMap_parallelForeach(HashMapHandle handle, bool (* func)(const char *key, size_t len, void *data, void *arg), void *arg, int nthreads)
+ * @brief:	Call Function for Each Key by Threads
+ * @note:	HashMap_foreach()のスロットの範囲をnthreads個に分けて、並列に走査する。
+ *       	funcがfalseを返したら、全てのスレッドが止まる。(既に呼ばれている分は止まらない)
+ *       	走査中はインクリメンタルリハッシュを止める。
+ *       	シャード付きハンドルでは、シャードをスレッドに分けて走査する。(スレッドはシャード数まで)
+ * @attention:	funcは複数のスレッドから同時に呼ばれる。呼ばれる順番は決まっていない。
+ *           	funcの中で登録/削除しないこと。
  =========================================================================================*/
-int HashMap_show(HashMapHandle handle)
+int HashMap_parallelForeach(HashMapHandle handle, bool (* func)(const char *key, size_t len, void *data, void *arg), void *arg, int nthreads)
 {
-	int i, ret = OK;
-	HashData *p;
+	int ret = OK;
+	int p, end, stop = 0;
+	MapScanWork works[WORKER_MAX];
 	LOG("Enter %s -> \n", __func__);
 	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
+	if (NULL == func) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (nthreads < 1) { nthreads = 1; }
+	if (WORKER_MAX < nthreads) { nthreads = WORKER_MAX; }
 
-	for (i=0; i<handle->tblsz; i++) {
-		p = &(handle->hash_table[i]);
-		if (0 != strcmp(p->key, INIT_KEY)) {
-			printf("[%2d] data-addr:0x%08lX key:\"%s\" hash:%2d \n",
-			       i, (unsigned long)(p->container), p->key, handle->hash(p->key, handle->tblsz));
+	/*! sharded handle: split shards into threads */
+	if (0 < handle->shards) {
+		MapShardWork shard_works[WORKER_MAX];
+		if (handle->shards < nthreads) { nthreads = handle->shards; }
+		for (p=0; p<nthreads; p++) {
+			memset(&shard_works[p], 0, sizeof(MapShardWork));
+			shard_works[p].handle = handle;
+			shard_works[p].func = func;
+			shard_works[p].arg = arg;
+			shard_works[p].lo = handle->shards * p / nthreads;
+			shard_works[p].hi = handle->shards * (p + 1) / nthreads;
+			shard_works[p].stop = &stop;
 		}
+		map_run_workers(map_shard_scan, shard_works, sizeof(MapShardWork), nthreads);
+		goto catch_exit;
+	}
+
+	end = handle->old.tblsz + handle->table.tblsz;
+	for (p=0; p<nthreads; p++) {
+		works[p].handle = handle;
+		works[p].func = func;
+		works[p].arg = arg;
+		works[p].lo = (int)((long long)end * p / nthreads);
+		works[p].hi = (int)((long long)end * (p + 1) / nthreads);
+		works[p].stop = &stop;
 	}
+	handle->iterators++;
+	map_run_workers(map_scan_worker, works, sizeof(MapScanWork), nthreads);
+	handle->iterators--;
 
 catch_exit:
 	LOG("Leave %s <- \n", __func__);
@@ -448,45 +5121,96 @@ catch_exit:
 }
 
 
-/*=========================================================================================
- * @name:	int HashMap_empty(HashMapHandle handle)
- * @brief:	Check Hash Table is Empty
- * @note:	return "true" or "false"
- * @attention:	
+/*========================================================================================
+ * @name:	int HashMap_optimum(HashMapHandle handle)
+ * @brief:	Check Hash Optimum Index
+ * @note:	ハッシュテーブル(関数)が最適化されているかの確認。
+ *       	無駄な探索をしている回数(全キーの探索長の合計)を返す。値が小さいほど最適化されている。
+ *       	登録/削除時に数えた値を返すだけなので、全キーを探索し直すことはない。
+ * @attention:	詳細はHashMap_stats()を使うこと。
  =========================================================================================*/
-bool HashMap_empty(HashMapHandle handle)
+int HashMap_optimum(HashMapHandle handle)
 {
-	bool ret = true;
-	int i;
+	int i, optimum_index = 0;
 	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
+	PRE_SAFE_CHECK(handle, optimum_index, INVALID_CORD, catch_exit);
 
-	for (i=0; i<handle->tblsz; i++) {
-		if (0 != strcmp(handle->hash_table[i].key, INIT_KEY)) {
-			ret = false;
-			break;
+	if (0 < handle->shards) {
+		for (i=0; i<handle->shards; i++) {
+			MapShard *s = map_shard_lock(handle, i);
+			int n = HashMap_optimum(s->map);
+			map_shard_unlock(s);
+			optimum_index = ((INT_MAX - optimum_index) < n) ? (INT_MAX) : (optimum_index + n);
 		}
+		goto catch_exit;
 	}
+	optimum_index = (INT_MAX < handle->probe_sum) ? (INT_MAX) : ((int)handle->probe_sum);
 
 catch_exit:
 	LOG("Leave %s <- \n", __func__);
-	return ret;
+	return optimum_index;
 }
 
 
-/*========================================================================================
- * @name:	int HashMap_maxsize(HashMapHandle handle)
- * @brief:	Get Hash Table Max Size
- * @note:	
- * @attention:	
+/*=========================================================================================
+ * @name:	int HashMap_stats(HashMapHandle handle, HashMapStats *stats)
+ * @brief:	Get Statistics Snapshot
+ * @note:	登録数、墓標数、負荷率、探索長(最大/平均/ヒストグラム)、リサイズ回数、
+ *       	参照のヒット/ミス回数、追い出した件数、回収した期限切れの件数をstatsにコピーする。いずれも随時数えている値で、
+ *       	テーブルを走査しないため運用中に呼んでよい。
+ *       	max_probeはHASHMAP_PROBE_HIST-1未満なら正確な値、それ以上は
+ *       	最後にテーブルを作り直してからの最大値。
+ *       	シャード付きハンドルでは全シャードの合計。(max_probeは最大、mean_probeは全キーの平均)
+ * @attention:	ヒット/ミスはHashMap_get()系とHashMap_getBatch()のみ数える。(HashMap_peekは数えない)
  =========================================================================================*/
-int HashMap_maxsize(HashMapHandle handle)
+int HashMap_stats(HashMapHandle handle, HashMapStats *stats)
 {
-	int ret;
+	int i, j, ret = OK;
 	LOG("Enter %s -> \n", __func__);
 	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
 
-	ret = handle->tblsz;
+	if (NULL == stats) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	stats->count = handle->count;
+	stats->deleted = handle->deleted;
+	stats->tblsz = handle->table.tblsz;
+	stats->load = (0 < handle->table.tblsz) ? ((float)handle->count / handle->table.tblsz) : (0.0f);
+	stats->max_probe = 0;
+	for (i=0; i<HASHMAP_PROBE_HIST; i++) {
+		stats->probe_hist[i] = handle->probe_hist[i];
+		if (0 < handle->probe_hist[i]) { stats->max_probe = i; }
+	}
+	if ((HASHMAP_PROBE_HIST - 1) == stats->max_probe) { stats->max_probe = handle->probe_peak; }
+	stats->mean_probe = (0 < handle->count) ? ((double)handle->probe_sum / handle->count) : (0.0);
+	stats->resizes = handle->resizes;
+	stats->hits = handle->hits;
+	stats->misses = handle->misses;
+	stats->evictions = handle->evictions;
+	stats->expirations = handle->expirations;
+
+	/*! sharded handle: sum of shards */
+	for (i=0; i<handle->shards; i++) {
+		HashMapStats one;
+		MapShard *s = map_shard_lock(handle, i);
+		HashMap_stats(s->map, &one);
+		map_shard_unlock(s);
+		if (0 < one.count) { stats->mean_probe = (stats->mean_probe * stats->count + one.mean_probe * one.count) / (stats->count + one.count); }
+		stats->count += one.count;
+		stats->deleted += one.deleted;
+		stats->tblsz += one.tblsz;
+		stats->load = (0 < stats->tblsz) ? ((float)stats->count / stats->tblsz) : (0.0f);
+		if (stats->max_probe < one.max_probe) { stats->max_probe = one.max_probe; }
+		for (j=0; j<HASHMAP_PROBE_HIST; j++) { stats->probe_hist[j] += one.probe_hist[j]; }
+		stats->resizes += one.resizes;
+		stats->hits += one.hits;
+		stats->misses += one.misses;
+		stats->evictions += one.evictions;
+		stats->expirations += one.expirations;
+	}
 
 catch_exit:
 	LOG("Leave %s <- \n", __func__);
@@ -494,51 +5218,177 @@ catch_exit:
 }
 
 
-/*========================================================================================
- * @name:	int HashMap_size(HashMapHandle handle)
- * @brief:	Get Hash Table Data Num
+/*=========================================================================================
+ * @name:	static uint64_t map_snap_align(uint64_t off)
+ * @brief:	Align Section Offset of Snapshot File
  * @note:	
- * @attention:	
+ * @attention:
  =========================================================================================*/
-int HashMap_size(HashMapHandle handle)
+static uint64_t map_snap_align(uint64_t off)
 {
-	int i, size = 0;
-	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, size, NG, catch_exit);
+	return (off + SNAP_ALIGN - 1) & ~(uint64_t)(SNAP_ALIGN - 1);
+}
 
-	for (i=0; i<handle->tblsz; i++) {
-		if (0 != strcmp(handle->hash_table[i].key, INIT_KEY)) {
-			size++;
-		}
-	}
 
-catch_exit:
-	LOG("Leave %s <- \n", __func__);
-	return size;
+/*=========================================================================================
+ * @name:	static uint32_t map_snap_hash_kind(int (* hash_fook)(char *key, int tblsz))
+ * @brief:	Hash Function Kind of Snapshot File
+ * @note:	0: wyhash(NULL含む), 1: crc32c, 2: fook
+ * @attention:	fookした関数同士は区別できない。
+ =========================================================================================*/
+static uint32_t map_snap_hash_kind(int (* hash_fook)(char *key, int tblsz))
+{
+	if ((NULL == hash_fook) || (HashMap_hashWyhash == hash_fook)) { return 0; }
+	if (HashMap_hashCrc32c == hash_fook) { return 1; }
+	return 2;
 }
 
 
-/*========================================================================================
- * @name:	void* HashMap_next(HashMapHandle handle)
- * @brief:	Iterator
- * @note:	
- * @attention:	
+/*=========================================================================================
+ * @name:	static int map_snap_write(FILE *fp, uint64_t *pos, uint64_t off, const void *data, size_t size)
+ * @brief:	Write Section of Snapshot File
+ * @note:	posからoffまでを0で埋めてからdataを書く。posは書いた後の位置に進める。
+ * @attention:
  =========================================================================================*/
-void* HashMap_next(HashMapHandle handle)
+static int map_snap_write(FILE *fp, uint64_t *pos, uint64_t off, const void *data, size_t size)
 {
-	void *ret = NULL;
+	static const char zero[SNAP_ALIGN];
+
+	if ((off - *pos) != fwrite(zero, 1, (size_t)(off - *pos), fp)) { return NG; }
+	if ((0 < size) && (size != fwrite(data, 1, size, fp))) { return NG; }
+	*pos = off + size;
+	return OK;
+}
+
+
+/*=========================================================================================
+ * @name:	static int map_snap_check(const MapSnapHeader *hdr, uint64_t file_size)
+ * @brief:	Validate Snapshot File Header
+ * @note:	形式、バージョン、アーキテクチャ、各セクションがファイルに収まっていることを確かめる。
+ * @attention:	スロットの中身はmap_snap_check_slots()で確かめる。
+ =========================================================================================*/
+static int map_snap_check(const MapSnapHeader *hdr, uint64_t file_size)
+{
+	uint64_t tblsz = (uint64_t)hdr->tblsz;
+
+	if (0 != memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic))) {
+		DIAG("error ! not a snapshot file ! \n");
+		return NG;
+	}
+	if ((SNAP_VERSION != hdr->version) || (SNAP_ORDER != hdr->order) || (sizeof(HashData) != hdr->slot_size)) {
+		DIAG("error ! snapshot version or architecture mismatch ! [version %u] \n", hdr->version);
+		return NG;
+	}
+	if ((HASHMAP_ENGINE_ROBINHOOD < hdr->engine) || (2 < hdr->hash_kind) || (0 == hdr->cellsz)
+	 || (hdr->tblsz <= 0) || (INT_MAX < hdr->tblsz) || (hdr->count < 0) || (hdr->tblsz < hdr->count)
+	 || (hdr->deleted < 0) || (hdr->tblsz < hdr->deleted)) {
+		DIAG("error ! broken snapshot header ! \n");
+		return NG;
+	}
+	if ((HASHMAP_ENGINE_SWISS == hdr->engine) && ((tblsz < CTRL_GROUP) || (0 != (tblsz & (tblsz - 1))))) {
+		DIAG("error ! broken snapshot header ! \n");
+		return NG;
+	}
+	if ((file_size != hdr->file_size) || (((uint64_t)-1 / tblsz) < hdr->cellsz)
+	 || (hdr->ctrl_off < sizeof(MapSnapHeader)) || (file_size - hdr->ctrl_off < tblsz)
+	 || (hdr->slots_off < hdr->ctrl_off + tblsz) || ((file_size - hdr->slots_off) / sizeof(HashData) < tblsz)
+	 || (hdr->values_off < hdr->slots_off + tblsz * sizeof(HashData)) || ((file_size - hdr->values_off) / hdr->cellsz < tblsz)
+	 || (hdr->arena_off < hdr->values_off + tblsz * hdr->cellsz) || (file_size - hdr->arena_off < hdr->arena_used)
+	 || (hdr->arena_used < hdr->arena_dead)
+	 || (0 != (hdr->slots_off % SNAP_ALIGN)) || (0 != (hdr->values_off % SNAP_ALIGN))) {
+		DIAG("error ! snapshot file is truncated or broken ! \n");
+		return NG;
+	}
+	return OK;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_save(HashMapHandle handle, const char *path)
+ * @brief:	Save Hash Table to File
+ * @note:	ヘッダ(形式、シード、統計)の後に、制御バイト、スロット、データ、キーアリーナを
+ *       	テーブルの並びのまま書き出す。キーはアリーナ上のオフセットで持つため、
+ *       	ファイルの内容はアドレスに依存しない。HashMap_load()で再ハッシュせずに使える。
+ *       	インクリメンタルリハッシュ中であれば、移行を終えてから書き出す。
+ * @attention:	データにポインタを含む場合、そのポインタは読み込み先では無効。
+ *           	シャード付きハンドルは保存できない。HashMap_shard()で得たシャード毎に保存すること。
+ *           	期限モードのハンドルは保存できない。(ファイルは期限を持たないため、
+ *           	期限切れや期限付きのキーが読み込み先で無期限になってしまう)
+ *           	同じアーキテクチャ(バイトオーダー、構造体サイズ)でのみ読み込める。
+ =========================================================================================*/
+int HashMap_save(HashMapHandle handle, const char *path)
+{
+	int ret = OK;
+	FILE *fp = NULL;
+	MapSnapHeader hdr;
+	uint64_t pos = 0, tblsz;
 	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, NULL, catch_exit);
+	PRE_SAFE_CHECK(handle, ret, NG, catch_exit);
 
-	if (handle->tblsz > handle->iterator_pos) {
-		int i;
-		for (i=handle->iterator_pos; i<handle->tblsz; i++) {
-			if (0 != strcmp(handle->hash_table[i].key, INIT_KEY)) {
-				ret = handle->hash_table[i].container;
-				break;
-			}
-		}
-		handle->iterator_pos = i+1;
+	if (NULL == path) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (0 < handle->shards) {
+		DIAG("error ! sharded handle can't be saved to one file, save each shard (HashMap_shard) ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (handle->frozen) {
+		DIAG("error ! frozen map cannot be saved ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if (handle->expiry) {
+		DIAG("error ! map in expiry mode cannot be saved, disable expiry first ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	map_rehash_step(handle, INT_MAX);
+	tblsz = (uint64_t)handle->table.tblsz;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.order = SNAP_ORDER;
+	hdr.slot_size = sizeof(HashData);
+	hdr.engine = (uint32_t)handle->engine;
+	hdr.hash_kind = map_snap_hash_kind(handle->hash);
+	hdr.probe_peak = (uint32_t)handle->probe_peak;
+	hdr.seed = handle->seed;
+	hdr.cellsz = handle->cellsz;
+	hdr.tblsz = handle->table.tblsz;
+	hdr.count = handle->count;
+	hdr.deleted = handle->deleted;
+	hdr.probe_sum = handle->probe_sum;
+	hdr.arena_used = handle->arena_used;
+	hdr.arena_dead = handle->arena_dead;
+	hdr.ctrl_off = map_snap_align(sizeof(hdr));
+	hdr.slots_off = map_snap_align(hdr.ctrl_off + tblsz);
+	hdr.values_off = map_snap_align(hdr.slots_off + tblsz * sizeof(HashData));
+	hdr.arena_off = map_snap_align(hdr.values_off + tblsz * handle->cellsz);
+	hdr.file_size = hdr.arena_off + hdr.arena_used;
+	memcpy(hdr.probe_hist, handle->probe_hist, sizeof(hdr.probe_hist));
+
+	fp = fopen(path, "wb");
+	if (NULL == fp) {
+		DIAG("error ! cannot open \"%s\" ! @%s() \n", path, __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+	if ((NG == map_snap_write(fp, &pos, 0, &hdr, sizeof(hdr)))
+	 || (NG == map_snap_write(fp, &pos, hdr.ctrl_off, handle->table.ctrl, (size_t)tblsz))
+	 || (NG == map_snap_write(fp, &pos, hdr.slots_off, handle->table.slots, (size_t)tblsz * sizeof(HashData)))
+	 || (NG == map_snap_write(fp, &pos, hdr.values_off, handle->table.values, (size_t)tblsz * handle->cellsz))
+	 || (NG == map_snap_write(fp, &pos, hdr.arena_off, handle->key_arena, (size_t)hdr.arena_used))) {
+		DIAG("error ! failed to write \"%s\" ! @%s() \n", path, __func__);
+		ret = NG;
+	}
+	if (0 != fclose(fp)) {
+		DIAG("error ! failed to write \"%s\" ! @%s() \n", path, __func__);
+		ret = NG;
 	}
 
 catch_exit:
@@ -547,78 +5397,316 @@ catch_exit:
 }
 
 
-/*========================================================================================
- * @name:	void HashMap_begin(HashMapHandle handle)
- * @brief:	Reset Iterator
- * @note:	
- * @attention:	
+/*=========================================================================================
+ * @name:	static int map_snap_check_slots(const MapSnapHeader *hdr, const char *base)
+ * @brief:	Validate Slots of Snapshot File
+ * @note:	制御バイトが未使用/墓標/使用中のいずれかで、件数がヘッダと合うことを確かめる。
+ *       	使用中のスロットは、キー長が正で、キーが'\0'終端込みでスロット内または
+ *       	キーアリーナの使用範囲内に収まることを確かめる。
+ *       	以降はmap_key()で得たキーを範囲の検査なしに使える。(走査、リハッシュ、凍結等)
+ * @attention:	hdrはmap_snap_check()済みであること。baseはファイルの先頭。
  =========================================================================================*/
-void HashMap_begin(HashMapHandle handle)
+static int map_snap_check_slots(const MapSnapHeader *hdr, const char *base)
 {
-	bool ret;
+	const unsigned char *ctrl = (const unsigned char *)(base + hdr->ctrl_off);
+	const HashData *slots = (const HashData *)(base + hdr->slots_off);
+	const char *arena = base + hdr->arena_off;
+	int64_t i, count = 0, deleted = 0;
+
+	for (i=0; i<hdr->tblsz; i++) {
+		const HashData *p = &slots[i];
+		if (CTRL_EMPTY == ctrl[i]) { continue; }
+		if (CTRL_DELETED == ctrl[i]) {
+			deleted++;
+			continue;
+		}
+		if (0 == (CTRL_FULL & ctrl[i])) { break; }
+		if (p->keylen <= 0) { break; }
+		if (p->keylen < KEY_INLINE_LEN) {
+			if ('\0' != p->key.buf[p->keylen]) { break; }
+		} else if ((hdr->arena_used <= p->key.offset) || ((hdr->arena_used - p->key.offset) <= (uint64_t)p->keylen)
+		        || ('\0' != arena[p->key.offset + p->keylen])) {
+			break;
+		}
+		count++;
+	}
+	if ((i < hdr->tblsz) || (count != hdr->count) || (deleted != hdr->deleted)) {
+		DIAG("error ! broken snapshot slots ! [slot %lld] \n", (long long)i);
+		return NG;
+	}
+	return OK;
+}
+
+
+/*=========================================================================================
+ * @name:	HashMapHandle HashMap_load(const char *path, int (* hash_fook)(char *key, int tblsz), EHashMapLoad mode)
+ * @brief:	Load Hash Table from File
+ * @note:	HashMap_save()したファイルをmmapし、テーブルとキーアリーナとしてそのまま使う。
+ *       	再ハッシュはしない。制御バイト、スロット、キーアリーナは読み込み時に一度だけ
+ *       	検査する(map_snap_check_slots参照)が、データのページは参照した分だけ読まれる。
+ *       	hash_fookは保存時と同じものを渡すこと(組み込みハッシュならNULLでよい)。
+ *       	HASHMAP_LOAD_READONLY: 参照専用。登録/削除等はNG(HASHMAP_READ_ONLY)になる。
+ *       	HASHMAP_LOAD_COW     : 書き換えたページだけがプロセス内にコピーされる(ファイルは
+ *       	                       変わらない)。リサイズやキーアリーナの拡張で、その部分は
+ *       	                       通常のメモリに移る。
+ * @attention:	READONLYではHashMap_get()の返すデータ領域に書き込まないこと。(SIGSEGV)
+ *           	mmapの無い環境ではNULLを返す。
+ =========================================================================================*/
+HashMapHandle HashMap_load(const char *path, int (* hash_fook)(char *key, int tblsz), EHashMapLoad mode)
+{
+	HashMapHandle handle = NULL;
+#ifdef HASHMAP_HAVE_MMAP
+	int fd = -1;
+	struct stat st;
+	char *base = MAP_FAILED;
+	MapSnapHeader hdr;
+	HashMapOption option = {HASHMAP_ENGINE_LINEAR, NULL, 0, false, NULL};
 	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
 
-	handle->iterator_pos = 0;
+	if ((NULL == path) || ((HASHMAP_LOAD_READONLY != mode) && (HASHMAP_LOAD_COW != mode))) {
+		DIAG("error ! invalid argument ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		DIAG("error ! cannot open \"%s\" ! @%s() \n", path, __func__);
+		goto catch_exit;
+	}
+	if ((0 != fstat(fd, &st)) || ((off_t)sizeof(MapSnapHeader) > st.st_size)) {
+		DIAG("error ! not a snapshot file ! \n");
+		goto catch_exit;
+	}
+	base = (char *)mmap(NULL, (size_t)st.st_size, (HASHMAP_LOAD_READONLY == mode) ? (PROT_READ) : (PROT_READ | PROT_WRITE), MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == base) {
+		DIAG("error ! mmap failed ! [%lld byte] @%s() \n", (long long)st.st_size, __func__);
+		goto catch_exit;
+	}
+	memcpy(&hdr, base, sizeof(hdr));
+	if (NG == map_snap_check(&hdr, (uint64_t)st.st_size)) { goto catch_exit; }
+	if (NG == map_snap_check_slots(&hdr, base)) { goto catch_exit; }
+	if (map_snap_hash_kind(hash_fook) != hdr.hash_kind) {
+		DIAG("error ! hash function differs from saved one ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+
+	/*! make handle, and replace table by mapped one */
+	option.engine = (EHashMapEngine)hdr.engine;
+	handle = HashMap_makeEx((size_t)hdr.cellsz, 1, hash_fook, &option);
+	if (NULL == handle) { goto catch_exit; }
+	map_table_free(handle, &(handle->table));
+
+	handle->map_base = base;
+	handle->map_size = (size_t)st.st_size;
+	handle->readonly = (HASHMAP_LOAD_READONLY == mode);
+	handle->seed = hdr.seed;
+	handle->table.tblsz = (int)hdr.tblsz;
+	handle->table.ctrl = (unsigned char *)(base + hdr.ctrl_off);
+	handle->table.slots = (HashData *)(base + hdr.slots_off);
+	handle->table.values = base + hdr.values_off;
+	handle->count = (int)hdr.count;
+	handle->deleted = (int)hdr.deleted;
+	handle->key_arena = (0 < hdr.arena_used) ? (base + hdr.arena_off) : (NULL);
+	handle->arena_size = (size_t)hdr.arena_used;
+	handle->arena_used = (size_t)hdr.arena_used;
+	handle->arena_dead = (size_t)hdr.arena_dead;
+	memcpy(handle->probe_hist, hdr.probe_hist, sizeof(handle->probe_hist));
+	handle->probe_sum = hdr.probe_sum;
+	handle->probe_peak = (int)hdr.probe_peak;
+	base = MAP_FAILED;
 
 catch_exit:
+	if (MAP_FAILED != base) { munmap(base, (size_t)st.st_size); }
+	if (0 <= fd) { close(fd); }
 	LOG("Leave %s <- \n", __func__);
-	return;
+#else
+	(void)path;
+	(void)hash_fook;
+	(void)mode;
+	DIAG("error ! HashMap_load is not supported on this platform ! \n");
+#endif
+	return handle;
 }
 
 
-/*========================================================================================
- * @name:	void HashMap_hasNext(HashMapHandle handle)
- * @brief:	Check Hash Table End
- * @note:	Return "true" or "false".
- * @attention:	
+/*=========================================================================================
+ * @name:	static int map_mphf_build(HashMapHandle handle, const uint64_t *h, int n, int *slot)
+ * @brief:	Build Minimal Perfect Hash
+ * @note:	PTHash風。キーをバケット(平均MPHF_LAMBDA個)に分け、大きいバケットから順に、
+ *       	属する全キーが空いている別々のスロットに入るパイロットを0から探す。
+ *       	スロット数はキー数と同じ(空きスロット無し)。
+ *       	slotには各キーの置き場所を返す。handle->pilots、bucketsを設定する。
+ * @attention:	hはhandle->mphf_seedで計算したhash_wyhash64()の値。
+ *           	64bitのハッシュ値が衝突した場合や、パイロットが見つからない場合はNGを返す。
+ *           	(シードを変えてやり直すこと)
  =========================================================================================*/
-bool HashMap_hasNext(HashMapHandle handle)
+static int map_mphf_build(HashMapHandle handle, const uint64_t *h, int n, int *slot)
 {
-	bool ret = false;
-	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, ret, false, catch_exit);
+	int ret = NG;
+	int i, j, k, b, size, max_size = 0;
+	int buckets = (n + MPHF_LAMBDA - 1) / MPHF_LAMBDA;
+	int *start = NULL, *order = NULL, *keys = NULL, *by_size = NULL;
+	unsigned char *taken = NULL;
+	uint32_t *pilots = NULL;
+	uint32_t pilot;
 
-	if (handle->tblsz > handle->iterator_pos) {
-		int i;
-		for (i=handle->iterator_pos; i<handle->tblsz; i++) {
-			if (0 != strcmp(handle->hash_table[i].key, INIT_KEY)) {
-				ret = true;
-				break;
+	start = (int *)calloc((size_t)buckets + 1, sizeof(int));
+	order = (int *)malloc(sizeof(int) * buckets);
+	keys = (int *)malloc(sizeof(int) * n);
+	taken = (unsigned char *)calloc((size_t)n, 1);
+	pilots = (uint32_t *)map_alloc(handle, sizeof(uint32_t) * buckets);
+	if ((NULL == start) || (NULL == order) || (NULL == keys) || (NULL == taken) || (NULL == pilots)) {
+		DIAG("error ! memory alocate failed ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+
+	/*! sort keys by bucket (counting sort) */
+	for (i=0; i<n; i++) { start[map_mphf_bucket(h[i], buckets) + 1]++; }
+	for (b=0; b<buckets; b++) {
+		if (max_size < start[b + 1]) { max_size = start[b + 1]; }
+		start[b + 1] += start[b];
+	}
+	for (b=0; b<buckets; b++) { order[b] = start[b]; }
+	for (i=0; i<n; i++) { keys[order[map_mphf_bucket(h[i], buckets)]++] = i; }
+
+	/*! sort buckets by size, larger first (counting sort) */
+	by_size = (int *)calloc((size_t)max_size + 2, sizeof(int));
+	if (NULL == by_size) {
+		DIAG("error ! memory alocate failed ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+	for (b=0; b<buckets; b++) { by_size[max_size - (start[b + 1] - start[b]) + 1]++; }
+	for (size=0; size<=max_size; size++) { by_size[size + 1] += by_size[size]; }
+	for (b=0; b<buckets; b++) { order[by_size[max_size - (start[b + 1] - start[b])]++] = b; }
+
+	/*! search pilot of each bucket */
+	for (k=0; k<buckets; k++) {
+		b = order[k];
+		size = start[b + 1] - start[b];
+		pilots[b] = 0;
+		if (0 == size) { continue; }
+		for (pilot=0; pilot<MPHF_MAX_PILOT; pilot++) {
+			for (j=0; j<size; j++) {
+				i = keys[start[b] + j];
+				slot[i] = map_mphf_slot(h[i], pilot, n);
+				if (taken[slot[i]]) { break; }
+				taken[slot[i]] = 1;
 			}
+			if (j == size) { break; }
+			while (0 < j--) { taken[slot[keys[start[b] + j]]] = 0; }
 		}
+		if (MPHF_MAX_PILOT == pilot) { goto catch_exit; }
+		pilots[b] = pilot;
 	}
 
+	map_free(handle, handle->pilots, sizeof(uint32_t) * handle->buckets);
+	handle->pilots = pilots;
+	handle->buckets = buckets;
+	pilots = NULL;
+	ret = OK;
+
 catch_exit:
-	LOG("Leave %s <- \n", __func__);
+	map_free(handle, pilots, sizeof(uint32_t) * buckets);
+	free(by_size);
+	free(taken);
+	free(keys);
+	free(order);
+	free(start);
 	return ret;
 }
 
 
-/*========================================================================================
- * @name:	int HashMap_optimum(HashMapHandle handle)
- * @brief:	Check Hash Optimum Index
- * @note:	ハッシュテーブル(関数)が最適化されているかの確認。
- *       	無駄な探索をしている回数を返す。値が小さいほど最適化されている。
- * @attention:	
+/*=========================================================================================
+ * @name:	HashMapHandle HashMap_freeze(HashMapHandle handle)
+ * @brief:	Make Read Only Hash Table by Perfect Hash
+ * @note:	handleの全キーから最小完全ハッシュ(map_mphf_build)を作り、キー数ちょうどの
+ *       	テーブルに詰めて並べた読み込み専用のハンドルを返す。handleはそのまま残る。
+ *       	参照はハッシュ1回、スロット1つ、キー比較1回で、探索しない。
+ *       	HashMap_get()系、HashMap_getBatch()、HashMap_peek()、イテレーション、
+ *       	HashMap_size()、HashMap_stats()は通常のハンドルと同じように使える。
+ *       	登録/削除等はNG(HASHMAP_READ_ONLY)になる。
+ *       	シャード付きハンドルはシャード毎に凍結する。(map_shard_freeze参照)
+ * @attention:	ハッシュは常に組み込みのwyhash(64bit)を使う。(fookしたhash関数は使わない)
+ *           	HashMap_save()はできない。
+ *           	期限切れのキーは入れない。期限付きのキーも凍結したマップでは期限が無くなる。
  =========================================================================================*/
-int HashMap_optimum(HashMapHandle handle)
+HashMapHandle HashMap_freeze(HashMapHandle handle)
 {
-	int i, optimum_index = 0;
+	HashMapHandle frozen = NULL;
+	HashMapOption option = {HASHMAP_ENGINE_LINEAR, NULL, 0, false, NULL};
+	uint64_t *h = NULL;
+	int *src = NULL, *slot = NULL;
+	int i, end, n = 0, retry;
+	bool ok = false;
 	LOG("Enter %s -> \n", __func__);
-	PRE_SAFE_CHECK(handle, optimum_index, INVALID_CORD, catch_exit);
+	PRE_SAFE_CHECK(handle, frozen, NULL, catch_exit);
 
-	for (i=0; i<handle->tblsz; i++) {
-		char *search_key = handle->hash_table[i].key;
-		int hash_value = handle->hash(search_key, handle->tblsz);
-		int miss_hit = 0;
-		if (0 == strcmp(search_key, INIT_KEY)) { continue; }
-		map_find(handle, search_key, hash_value, &miss_hit);
-		optimum_index += miss_hit;
+	if (0 < handle->shards) {
+		frozen = map_shard_freeze(handle);
+		ok = (NULL != frozen);
+		goto catch_exit;
+	}
+	option.allocator = &(handle->allocator);
+	frozen = HashMap_makeEx(handle->cellsz, 1, NULL, &option);
+	if (NULL == frozen) { goto catch_exit; }
+	map_table_free(frozen, &(frozen->table));
+	frozen->frozen = true;
+	frozen->readonly = true;
+	frozen->mphf_seed = handle->seed ^ 0x243f6a8885a308d3ull;
+
+	/*! collect keys */
+	h = (uint64_t *)malloc(sizeof(uint64_t) * (handle->count + 1));
+	src = (int *)malloc(sizeof(int) * (handle->count + 1));
+	slot = (int *)malloc(sizeof(int) * (handle->count + 1));
+	if ((NULL == h) || (NULL == src) || (NULL == slot)) {
+		DIAG("error ! memory alocate failed ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+	end = handle->old.tblsz + handle->table.tblsz;
+	for (i=map_iter_seek(handle, 0, end); (i < end) && (n < handle->count); i=map_iter_seek(handle, i + 1, end)) {
+		const HashTable *t = (i < handle->old.tblsz) ? &(handle->old) : &(handle->table);
+		if (map_expired(handle, t, (i < handle->old.tblsz) ? (i) : (i - handle->old.tblsz))) { continue; }	/* not reclaimed yet */
+		src[n++] = i;
+	}
+
+	if (0 < n) {
+		/*! build perfect hash (retry with another seed) */
+		for (retry=0; retry<MPHF_RETRY; retry++) {
+			for (i=0; i<n; i++) {
+				HashData *p = map_iter_slot(handle, src[i]);
+				h[i] = hash_wyhash64(map_key(handle, p), p->keylen, frozen->mphf_seed);
+			}
+			if (OK == map_mphf_build(frozen, h, n, slot)) { break; }
+			frozen->mphf_seed = hash_wyhash64((const char *)&(frozen->mphf_seed), sizeof(uint64_t), retry);
+		}
+		if (MPHF_RETRY == retry) {
+			DIAG("error ! failed to build perfect hash ! @%s() \n", __func__);
+			goto catch_exit;
+		}
+
+		/*! place keys and data */
+		if (NG == map_table_alloc(frozen, &(frozen->table), n)) { goto catch_exit; }
+		for (i=0; i<n; i++) {
+			HashData *p = map_iter_slot(handle, src[i]);
+			HashData *q = &(frozen->table.slots[slot[i]]);
+			if (NG == map_store_key(frozen, q, map_key(handle, p), p->keylen)) { goto catch_exit; }
+			q->hash = (unsigned int)h[i];
+			frozen->table.ctrl[slot[i]] = CTRL_FULL;
+			memcpy(map_value(frozen, &(frozen->table), slot[i]), map_iter_value(handle, src[i]), handle->cellsz);
+		}
 	}
+	frozen->count = n;
+	frozen->probe_hist[0] = n;
+	ok = true;
 
 catch_exit:
+	free(slot);
+	free(src);
+	free(h);
+	if ((false == ok) && (NULL != frozen)) {
+		map_cleanup(frozen, FULL_CLEANUP);
+		frozen = NULL;
+	}
 	LOG("Leave %s <- \n", __func__);
-	return optimum_index;
+	return frozen;
 }
-
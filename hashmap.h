@@ -3,17 +3,140 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define OK (1)
 #define NG (0)
 
 typedef struct tag_map_handle *HashMapHandle;
 
+/*! Table Engine */
+typedef enum {
+	HASHMAP_ENGINE_LINEAR = 0,            /* Linear probing. (default) */
+	HASHMAP_ENGINE_SWISS,                 /* Control bytes and SIMD group probing. */
+	HASHMAP_ENGINE_ROBINHOOD              /* Robin Hood displacement and backward-shift erase. */
+} EHashMapEngine;
+
+/*! Memory Allocator */
+typedef struct tag_map_allocator {
+	void *(* alloc)(void *ctx, size_t size);
+	void *(* realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+	void (* free)(void *ctx, void *ptr, size_t size);   /* size is the allocated size. */
+	void *ctx;                            /* Passed to each function as is. */
+} HashMapAllocator;
+
+/*! Result of HashMap_try*() */
+typedef enum {
+	HASHMAP_OK = 0,                       /* Succeeded. */
+	HASHMAP_NOT_FOUND,                    /* Key isn't registered. */
+	HASHMAP_EXISTS,                       /* Key is already registered. */
+	HASHMAP_FULL,                         /* No blank slot. */
+	HASHMAP_NO_MEMORY,                    /* Memory allocation failed. */
+	HASHMAP_INVALID,                      /* Invalid handle or key. */
+	HASHMAP_READ_ONLY                     /* Handle is loaded as read only. */
+} EHashMapStatus;
+
+/*! Statistics of HashMap_stats */
+#define HASHMAP_PROBE_HIST (32)
+typedef struct tag_map_stats {
+	int count;                            /* Registered keys. */
+	int deleted;                          /* Tombstones. */
+	int tblsz;                            /* Table size. (new table under incremental rehash) */
+	float load;                           /* count / tblsz */
+	int max_probe;                        /* Longest probe length. */
+	double mean_probe;                    /* Mean probe length. */
+	int probe_hist[HASHMAP_PROBE_HIST];   /* Keys by probe length. Last one counts longer keys too. */
+	unsigned long resizes;                /* Table size changes. */
+	unsigned long hits;                   /* Lookups found. */
+	unsigned long misses;                 /* Lookups not found. */
+	unsigned long evictions;              /* Keys evicted on cache mode. */
+	unsigned long expirations;            /* Expired keys reclaimed on expiry mode. */
+} HashMapStats;
+
+/*! Traced Operation (see HashMap_setTrace) */
+typedef enum {
+	HASHMAP_OP_INSERT = 0,                /* insert, tryInsert, getOrInsert, upsert, insertBatch ... */
+	HASHMAP_OP_GET,                       /* get, getBytes, tryGet. (not getBatch, peek) */
+	HASHMAP_OP_ERASE,                     /* erase, eraseBytes, tryErase. */
+	HASHMAP_OP_RESIZE,                    /* Table rebuild, or start of incremental rehash. */
+	HASHMAP_OP_NUM
+} EHashMapOp;
+
+/*! Slow Lookup Sampled by HashMap_setTrace */
+typedef struct tag_map_trace_sample {
+	unsigned int hash;                    /* Hash value of key on current table. */
+	int probe;                            /* Slots passed over. (swiss: groups and fragment false matches) */
+	bool hit;                             /* Key was found. */
+	uint64_t cycles;                      /* Latency. */
+} HashMapTraceSample;
+
+/*! Tracing of HashMap_trace */
+#define HASHMAP_TRACE_HIST    (32)
+#define HASHMAP_TRACE_SAMPLES (64)
+typedef struct tag_map_trace {
+	unsigned long ops[HASHMAP_OP_NUM];    /* Traced operations. */
+	uint64_t cycles[HASHMAP_OP_NUM];      /* Total latency. */
+	uint64_t max_cycles[HASHMAP_OP_NUM];  /* Longest latency. */
+	unsigned long hist[HASHMAP_OP_NUM][HASHMAP_TRACE_HIST]; /* [i] counts 2^i .. 2^(i+1)-1 cycles. Last one counts longer too. */
+	unsigned long slow;                   /* Lookups slower than slow_cycles. */
+	unsigned long sampled;                /* Slow lookups sampled. */
+	int samples;                          /* Valid entries of sample. */
+	HashMapTraceSample sample[HASHMAP_TRACE_SAMPLES]; /* Last sampled lookups. Oldest first. */
+} HashMapTrace;
+
+/*! Mode of HashMap_load */
+typedef enum {
+	HASHMAP_LOAD_READONLY = 0,            /* Serve lookups from the mapping. Mutation fails. */
+	HASHMAP_LOAD_COW                      /* Private writable mapping. Pages are copied on write. */
+} EHashMapLoad;
+
+/*! External iterator of HashMap_iterNext */
+typedef struct tag_map_iter {
+	HashMapHandle handle;                 /* Iterated handle. */
+	int pos;                              /* Next slot position. (internal) */
+	unsigned int generation;              /* Table layout at HashMap_iterInit. (internal) */
+	bool pinned;                          /* Incremental rehash is paused. (internal) */
+	int shard;                            /* Shard being iterated on sharded handle. (internal) */
+	const char *key;                      /* Current key. '\0' terminated. */
+	size_t keylen;                        /* Length of current key. */
+	void *data;                           /* Current data. */
+} HashMapIter;
+
+/*! Options of HashMap_makeEx */
+typedef struct tag_map_option {
+	EHashMapEngine engine;                /* Probing engine. */
+	const HashMapAllocator *allocator;    /* NULL means malloc/realloc/free. */
+	int shards;                           /* Inner maps of sharded handle. (power of 2) 0 or 1 means plain handle. */
+	bool locked;                          /* Each shard has its own mutex. (sharded handle only) */
+	const HashMapAllocator *shard_allocators; /* Allocator of each shard. (shards entries) NULL means allocator. */
+} HashMapOption;
+
 HashMapHandle HashMap_make(const size_t cellsz, const int tblsz, int (* hash_func)(char *key, int tblsz));
+HashMapHandle HashMap_makeEx(const size_t cellsz, const int tblsz, int (* hash_func)(char *key, int tblsz), const HashMapOption *option);
 int HashMap_free(HashMapHandle handle);
 int HashMap_insert(HashMapHandle handle, char *key, void *data);
 void* HashMap_get(HashMapHandle handle, char *key);
 int HashMap_erase(HashMapHandle handle, char *key);
+int HashMap_insertBytes(HashMapHandle handle, const void *key, size_t len, void *data);
+void* HashMap_getBytes(HashMapHandle handle, const void *key, size_t len);
+int HashMap_eraseBytes(HashMapHandle handle, const void *key, size_t len);
+EHashMapStatus HashMap_tryInsert(HashMapHandle handle, char *key, void *data);
+EHashMapStatus HashMap_tryGet(HashMapHandle handle, char *key, void **data);
+EHashMapStatus HashMap_tryErase(HashMapHandle handle, char *key);
+EHashMapStatus HashMap_tryInsertBytes(HashMapHandle handle, const void *key, size_t len, void *data);
+EHashMapStatus HashMap_tryGetBytes(HashMapHandle handle, const void *key, size_t len, void **data);
+EHashMapStatus HashMap_tryEraseBytes(HashMapHandle handle, const void *key, size_t len);
+void* HashMap_getOrInsert(HashMapHandle handle, char *key, bool *inserted);
+int HashMap_upsert(HashMapHandle handle, char *key, void (* update)(void *data, bool inserted, void *arg), void *arg);
+int HashMap_insertOrAssign(HashMapHandle handle, char *key, void *data);
+int HashMap_peek(HashMapHandle handle, char *key, void *data, bool (* stale)(void *arg), void *arg);
+int HashMap_getBatch(HashMapHandle handle, char **keys, int num, void **results);
+int HashMap_insertBatch(HashMapHandle handle, char **keys, void **data, int num);
+int HashMap_bulkLoad(HashMapHandle handle, char **keys, void **data, int num, int nthreads);
 int HashMap_clear(HashMapHandle handle);
 int HashMap_show(HashMapHandle handle);
 bool HashMap_empty(HashMapHandle handle);
@@ -22,7 +145,35 @@ int HashMap_size(HashMapHandle handle);
 void* HashMap_next(HashMapHandle handle);
 void HashMap_begin(HashMapHandle handle);
 bool HashMap_hasNext(HashMapHandle handle);
+int HashMap_iterInit(HashMapHandle handle, HashMapIter *iter);
+bool HashMap_iterNext(HashMapIter *iter);
+int HashMap_iterEnd(HashMapIter *iter);
+int HashMap_foreach(HashMapHandle handle, bool (* func)(const char *key, size_t len, void *data, void *arg), void *arg);
+int HashMap_parallelForeach(HashMapHandle handle, bool (* func)(const char *key, size_t len, void *data, void *arg), void *arg, int nthreads);
 int HashMap_optimum(HashMapHandle handle);
+int HashMap_stats(HashMapHandle handle, HashMapStats *stats);
+int HashMap_save(HashMapHandle handle, const char *path);
+HashMapHandle HashMap_load(const char *path, int (* hash_func)(char *key, int tblsz), EHashMapLoad mode);
+HashMapHandle HashMap_freeze(HashMapHandle handle);
+int HashMap_setAutoResize(HashMapHandle handle, bool enable, float max_load, float growth);
+int HashMap_shrink(HashMapHandle handle);
+int HashMap_setIncrementalRehash(HashMapHandle handle, int step);
+int HashMap_setSeed(HashMapHandle handle, uint64_t seed);
+int HashMap_setCache(HashMapHandle handle, int max_entries, size_t max_bytes, void (* evict)(const char *key, size_t len, void *data, void *arg), void *arg);
+int HashMap_setExpiry(HashMapHandle handle, bool enable, int sweep_step, uint64_t (* clock)(void *arg), void *arg);
+int HashMap_insertTtl(HashMapHandle handle, char *key, void *data, uint64_t ttl);
+int HashMap_expire(HashMapHandle handle, char *key, uint64_t ttl);
+int HashMap_sweep(HashMapHandle handle, int step);
+int HashMap_shardCount(HashMapHandle handle);
+HashMapHandle HashMap_shard(HashMapHandle handle, int index);
+int HashMap_setTrace(HashMapHandle handle, bool enable, uint64_t slow_cycles, int sample_rate);
+int HashMap_trace(HashMapHandle handle, HashMapTrace *trace, bool reset);
+int HashMap_hashWyhash(char *key, int tblsz);
+int HashMap_hashCrc32c(char *key, int tblsz);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 
@@ -0,0 +1,615 @@
+#ifndef __HASHMAP_HPP__
+#define __HASHMAP_HPP__
+
+/*=========================================================================================
+ * hashmap.hpp
+ *
+ * Header only C++ front-end. hashmap::HashMap<K, V, Hash, Equal>
+ * Same layout and probing as the swiss engine of hashmap.c (control bytes,
+ * CTRL_GROUP slots tested at once, triangular group probing), specialized at compile time:
+ *   - Hash and Equal are inlined. (no hash function pointer)
+ *   - Key and value are stored in the slot as they are. (no void * and memcpy(cellsz))
+ *   - Move only values can be stored.
+ *   - Fixed size keys are hashed and compared with their width known at compile time.
+ * C++17 or later.
+ =========================================================================================*/
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace hashmap {
+
+namespace detail {
+
+constexpr unsigned char CTRL_EMPTY = 0x00;     /*! Never used slot. Terminates probing. */
+constexpr unsigned char CTRL_DELETED = 0x01;   /*! Tombstone. Probing continues. */
+constexpr unsigned char CTRL_FULL = 0x80;      /*! Occupied. Low 7 bits hold hash fragment. */
+constexpr int CTRL_GROUP = 16;                 /*! Slots tested at once. */
+
+
+/*=========================================================================================
+ * @name:	uint64_t wy_mum(uint64_t a, uint64_t b)
+ * @brief:	64x64->128bit Multiply and Fold
+ * @note:	hashmap.cのhash_wy_mum()と同じ。
+ * @attention:
+ =========================================================================================*/
+inline uint64_t wy_mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), lo, hi;
+	uint64_t c = t < rl;
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	return lo ^ hi;
+#endif
+}
+
+inline uint64_t rd8(const uint8_t *p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+inline uint64_t rd4(const uint8_t *p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+
+/*=========================================================================================
+ * @name:	uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+ * @brief:	wyhash (64bit)
+ * @note:	hashmap.cのhash_wyhash64()と同じ値を返す。
+ *       	インライン展開されるので、lenがコンパイル時に決まる場合は分岐が消える。
+ * @attention:
+ =========================================================================================*/
+inline uint64_t wyhash(const void *key, size_t len, uint64_t seed)
+{
+	constexpr uint64_t wyp[4] = {
+		0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+	};
+	const uint8_t *p = static_cast<const uint8_t *>(key);
+	uint64_t a, b;
+	size_t i = len;
+
+	seed ^= wy_mum(seed ^ wyp[0], wyp[1]);
+	if (len <= 16) {
+		if (4 <= len) {
+			a = (rd4(p) << 32) | rd4(p + ((len >> 3) << 2));
+			b = (rd4(p + len - 4) << 32) | rd4(p + len - 4 - ((len >> 3) << 2));
+		} else if (0 < len) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (48 < i) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wy_mum(rd8(p) ^ wyp[1], rd8(p + 8) ^ seed);
+				see1 = wy_mum(rd8(p + 16) ^ wyp[2], rd8(p + 24) ^ see1);
+				see2 = wy_mum(rd8(p + 32) ^ wyp[3], rd8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (48 < i);
+			seed ^= see1 ^ see2;
+		}
+		while (16 < i) {
+			seed = wy_mum(rd8(p) ^ wyp[1], rd8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = rd8(p + i - 16);
+		b = rd8(p + i - 8);
+	}
+	return wy_mum(wy_mum(a ^ wyp[1], b ^ seed) ^ wyp[0] ^ (uint64_t)len, wyp[1]);
+}
+
+
+#if defined(__SSE2__)
+inline unsigned int group_match(const unsigned char *ctrl, unsigned char c)
+{
+	__m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+}
+
+inline unsigned int group_full(const unsigned char *ctrl)
+{
+	return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl)));
+}
+#else
+inline unsigned int group_match(const unsigned char *ctrl, unsigned char c)
+{
+	unsigned int bits = 0;
+	for (int i=0; i<CTRL_GROUP; i++) {
+		if (c == ctrl[i]) { bits |= 1u << i; }
+	}
+	return bits;
+}
+
+inline unsigned int group_full(const unsigned char *ctrl)
+{
+	unsigned int bits = 0;
+	for (int i=0; i<CTRL_GROUP; i++) {
+		if (CTRL_FULL & ctrl[i]) { bits |= 1u << i; }
+	}
+	return bits;
+}
+#endif
+
+inline int ctz(unsigned int bits)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(bits);
+#else
+	int n = 0;
+	while (0 == (bits & 1u)) { bits >>= 1; n++; }
+	return n;
+#endif
+}
+
+} /* namespace detail */
+
+
+/*=========================================================================================
+ * @name:	template <class K> struct Hash
+ * @brief:	Default Hash
+ * @note:	整数、列挙型、ポインタは1回の乗算で混ぜる。
+ *       	パディングの無い固定長の型(std::has_unique_object_representations)は、
+ *       	sizeof(K)byteをwyhashに通す。(長さはコンパイル時に決まる)
+ *       	std::string、std::string_viewは文字列をwyhashに通す。
+ * @attention:	それ以外の型は特殊化するか、HashMapのHashに関数オブジェクトを渡すこと。
+ =========================================================================================*/
+template <class K, class Enable = void>
+struct Hash;
+
+template <class K>
+struct Hash<K, std::enable_if_t<std::is_integral_v<K> || std::is_enum_v<K> || std::is_pointer_v<K>>> {
+	uint64_t operator()(const K &key) const noexcept
+	{
+		uint64_t x;
+		if constexpr (std::is_pointer_v<K>) {
+			x = (uint64_t)reinterpret_cast<uintptr_t>(key);
+		} else {
+			x = (uint64_t)key;
+		}
+		return detail::wy_mum(x ^ 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull);
+	}
+};
+
+template <class K>
+struct Hash<K, std::enable_if_t<!std::is_integral_v<K> && !std::is_enum_v<K> && !std::is_pointer_v<K> &&
+                                std::has_unique_object_representations_v<K>>> {
+	uint64_t operator()(const K &key) const noexcept
+	{
+		return detail::wyhash(&key, sizeof(K), 0);
+	}
+};
+
+template <>
+struct Hash<std::string_view> {
+	uint64_t operator()(std::string_view key) const noexcept
+	{
+		return detail::wyhash(key.data(), key.size(), 0);
+	}
+};
+
+template <>
+struct Hash<std::string> {
+	uint64_t operator()(const std::string &key) const noexcept
+	{
+		return detail::wyhash(key.data(), key.size(), 0);
+	}
+};
+
+
+/*=========================================================================================
+ * @name:	template <class K> struct Equal
+ * @brief:	Default Key Compare
+ * @note:	パディングの無い固定長の構造体はsizeof(K)byteのmemcmpで比較する。
+ *       	(長さが定数なので、数回のロードと比較に展開される)
+ *       	それ以外はoperator==を使う。
+ * @attention:
+ =========================================================================================*/
+template <class K, class Enable = void>
+struct Equal {
+	bool operator()(const K &a, const K &b) const { return a == b; }
+};
+
+template <class K>
+struct Equal<K, std::enable_if_t<std::is_class_v<K> && std::has_unique_object_representations_v<K>>> {
+	bool operator()(const K &a, const K &b) const noexcept
+	{
+		return 0 == std::memcmp(&a, &b, sizeof(K));
+	}
+};
+
+
+/*=========================================================================================
+ * @name:	template <class K, class V, class H, class E> class HashMap
+ * @brief:	Typed Hash Map
+ * @note:	C APIと同じ名前の操作を持つ。(insert/get/erase/getOrInsert/insertOrAssign)
+ *       	テーブルサイズはCTRL_GROUP以上の2のべき乗。(登録数 + 墓標数)が7/8を超えると
+ *       	2倍に拡張する。(墓標が多い場合は同じサイズで作り直す)
+ *       	メモリ確保に失敗した場合はstd::bad_allocを投げる。
+ * @attention:	登録/削除でテーブルを作り直すと、get()等で得たポインタとイテレータは無効になる。
+ =========================================================================================*/
+template <class K, class V, class H = Hash<K>, class E = Equal<K>>
+class HashMap {
+public:
+	struct Slot {
+		K key;
+		V value;
+	};
+
+	class iterator {
+	public:
+		iterator(HashMap *map, size_t index) : map_(map), index_(index) {}
+		Slot &operator*() const { return map_->slots_[index_]; }
+		Slot *operator->() const { return &(map_->slots_[index_]); }
+		iterator &operator++()
+		{
+			index_ = map_->seek(index_ + 1);
+			return *this;
+		}
+		bool operator==(const iterator &other) const { return index_ == other.index_; }
+		bool operator!=(const iterator &other) const { return index_ != other.index_; }
+
+	private:
+		HashMap *map_;
+		size_t index_;
+	};
+
+	explicit HashMap(size_t capacity = 0, const H &hash = H(), const E &equal = E())
+		: hash_(hash), equal_(equal)
+	{
+		allocate(table_size(capacity));
+	}
+
+	~HashMap()
+	{
+		destroy();
+	}
+
+	HashMap(const HashMap &) = delete;
+	HashMap &operator=(const HashMap &) = delete;
+
+	HashMap(HashMap &&other) noexcept
+		: hash_(std::move(other.hash_)), equal_(std::move(other.equal_)), ctrl_(other.ctrl_), slots_(other.slots_),
+		  tblsz_(other.tblsz_), count_(other.count_), deleted_(other.deleted_)
+	{
+		other.ctrl_ = nullptr;
+		other.slots_ = nullptr;
+		other.tblsz_ = other.count_ = other.deleted_ = 0;
+	}
+
+	HashMap &operator=(HashMap &&other) noexcept
+	{
+		if (this != &other) {
+			destroy();
+			hash_ = std::move(other.hash_);
+			equal_ = std::move(other.equal_);
+			ctrl_ = other.ctrl_;
+			slots_ = other.slots_;
+			tblsz_ = other.tblsz_;
+			count_ = other.count_;
+			deleted_ = other.deleted_;
+			other.ctrl_ = nullptr;
+			other.slots_ = nullptr;
+			other.tblsz_ = other.count_ = other.deleted_ = 0;
+		}
+		return *this;
+	}
+
+	/*! Register. Returns false if key is already registered. */
+	bool insert(const K &key, V value)
+	{
+		std::pair<V *, bool> r = emplace(key, std::move(value));
+		return r.second;
+	}
+
+	/*! Data of key, or nullptr. */
+	V *get(const K &key)
+	{
+		size_t i = find(key, hash_(key));
+		return (npos == i) ? nullptr : &(slots_[i].value);
+	}
+
+	const V *get(const K &key) const
+	{
+		size_t i = find(key, hash_(key));
+		return (npos == i) ? nullptr : &(slots_[i].value);
+	}
+
+	bool contains(const K &key) const
+	{
+		return npos != find(key, hash_(key));
+	}
+
+	/*! Data of key. Registers V(args...) if not registered. (second is true if registered) */
+	template <class... Args>
+	std::pair<V *, bool> getOrInsert(const K &key, Args &&...args)
+	{
+		return emplace(key, std::forward<Args>(args)...);
+	}
+
+	/*! Register, or overwrite data. Returns true if registered. */
+	bool insertOrAssign(const K &key, V value)
+	{
+		uint64_t h = hash_(key);
+		size_t i = find(key, h);
+		if (npos != i) {
+			slots_[i].value = std::move(value);
+			return false;
+		}
+		occupy(key, h, std::move(value));
+		return true;
+	}
+
+	V &operator[](const K &key)
+	{
+		return *(emplace(key).first);
+	}
+
+	/*! Returns false if key is not registered. */
+	bool erase(const K &key)
+	{
+		size_t i = find(key, hash_(key));
+		if (npos == i) { return false; }
+		remove_at(i);
+		return true;
+	}
+
+	void clear()
+	{
+		for (size_t i=seek(0); i<tblsz_; i=seek(i + 1)) {
+			slots_[i].~Slot();
+		}
+		if (nullptr != ctrl_) { std::memset(ctrl_, detail::CTRL_EMPTY, tblsz_); }
+		count_ = 0;
+		deleted_ = 0;
+	}
+
+	/*! Grow table to hold n keys without rehash. */
+	void reserve(size_t n)
+	{
+		size_t size = table_size(n);
+		if (size > tblsz_) { rehash(size); }
+	}
+
+	/*! Shrink table to fit, and drop tombstones. */
+	void shrink()
+	{
+		rehash(table_size(count_));
+	}
+
+	size_t size() const { return count_; }
+	bool empty() const { return 0 == count_; }
+	size_t maxsize() const { return tblsz_; }
+
+	/*! Call func(const K &, V &) for each key. */
+	template <class F>
+	void foreach(F &&func)
+	{
+		for (size_t i=seek(0); i<tblsz_; i=seek(i + 1)) {
+			func(static_cast<const K &>(slots_[i].key), slots_[i].value);
+		}
+	}
+
+	iterator begin() { return iterator(this, seek(0)); }
+	iterator end() { return iterator(this, tblsz_); }
+
+private:
+	static constexpr size_t npos = (size_t)-1;
+
+	/*=========================================================================================
+	 * @name:	static size_t table_size(size_t n)
+	 * @brief:	Table Size for n Keys
+	 * @note:	n個を7/8以下の負荷率で入れられる、CTRL_GROUP以上の2のべき乗。
+	 * @attention:
+	 =========================================================================================*/
+	static size_t table_size(size_t n)
+	{
+		size_t size = detail::CTRL_GROUP;
+		while (size * 7 / 8 < n) { size *= 2; }
+		return size;
+	}
+
+	static unsigned char h2(uint64_t h) { return (unsigned char)(detail::CTRL_FULL | (h >> 57)); }
+
+	/*=========================================================================================
+	 * @name:	size_t find(const K &key, uint64_t h) const
+	 * @brief:	Find Key
+	 * @note:	hashmap.cのmap_find_swiss()と同じ。ホーム位置のグループから三角数の間隔で
+	 *       	グループを辿り、未使用スロットを含むグループで見つからなければ、その先には無い。
+	 * @attention:	見つからない場合はnposを返す。
+	 =========================================================================================*/
+	size_t find(const K &key, uint64_t h) const
+	{
+		size_t groups = tblsz_ / detail::CTRL_GROUP;
+		size_t g = (size_t)h & (groups - 1);
+		unsigned char tag = h2(h);
+
+		for (size_t n=1; n<=groups; n++) {
+			const unsigned char *ctrl = &ctrl_[g * detail::CTRL_GROUP];
+			unsigned int bits = detail::group_match(ctrl, tag);
+			while (0 != bits) {
+				size_t i = g * detail::CTRL_GROUP + detail::ctz(bits);
+				if (equal_(slots_[i].key, key)) { return i; }
+				bits &= bits - 1;
+			}
+			if (0 != detail::group_match(ctrl, detail::CTRL_EMPTY)) { break; }
+			g = (g + n) & (groups - 1);
+		}
+		return npos;
+	}
+
+	/*=========================================================================================
+	 * @name:	size_t find_blank(uint64_t h) const
+	 * @brief:	Find Blank Slot
+	 * @note:	find()と同じ順にグループを辿り、最初の空き(未使用または墓標)を返す。
+	 * @attention:	テーブルに空きがあること。
+	 =========================================================================================*/
+	size_t find_blank(uint64_t h) const
+	{
+		size_t groups = tblsz_ / detail::CTRL_GROUP;
+		size_t g = (size_t)h & (groups - 1);
+
+		for (size_t n=1; ; n++) {
+			unsigned int bits = ~detail::group_full(&ctrl_[g * detail::CTRL_GROUP]) & 0xFFFFu;
+			if (0 != bits) { return g * detail::CTRL_GROUP + detail::ctz(bits); }
+			g = (g + n) & (groups - 1);
+		}
+	}
+
+	/*=========================================================================================
+	 * @name:	template <class... Args> std::pair<V *, bool> emplace(const K &key, Args &&...args)
+	 * @brief:	Find or Register Key
+	 * @note:	hashmap.cのmap_emplace()と同じ。探索は一度だけ。
+	 * @attention:
+	 =========================================================================================*/
+	template <class... Args>
+	std::pair<V *, bool> emplace(const K &key, Args &&...args)
+	{
+		uint64_t h = hash_(key);
+		size_t i = find(key, h);
+		if (npos != i) { return std::pair<V *, bool>(&(slots_[i].value), false); }
+		return std::pair<V *, bool>(occupy(key, h, std::forward<Args>(args)...), true);
+	}
+
+	template <class... Args>
+	V *occupy(const K &key, uint64_t h, Args &&...args)
+	{
+		size_t i;
+
+		if (0 == tblsz_) {
+			/* moved-from map has no table */
+			rehash(table_size(0));
+		} else if ((count_ + deleted_ + 1) > (tblsz_ * 7 / 8)) {
+			/* tombstones only: rebuild on same size */
+			rehash(((count_ + 1) > (tblsz_ * 7 / 16)) ? (tblsz_ * 2) : (tblsz_));
+		}
+		i = find_blank(h);
+		::new (static_cast<void *>(&slots_[i])) Slot{key, V(std::forward<Args>(args)...)};
+		if (detail::CTRL_DELETED == ctrl_[i]) { deleted_--; }
+		ctrl_[i] = h2(h);
+		count_++;
+		return &(slots_[i].value);
+	}
+
+	/*=========================================================================================
+	 * @name:	void remove_at(size_t i)
+	 * @brief:	Remove Slot
+	 * @note:	hashmap.cのmap_remove_at()と同じ。同じグループに未使用スロットがあれば、
+	 *       	そのグループを通り過ぎた探索列は無いので、墓標を残さず未使用に戻す。
+	 * @attention:
+	 =========================================================================================*/
+	void remove_at(size_t i)
+	{
+		size_t g = i & ~(size_t)(detail::CTRL_GROUP - 1);
+		slots_[i].~Slot();
+		if (0 != detail::group_match(&ctrl_[g], detail::CTRL_EMPTY)) {
+			ctrl_[i] = detail::CTRL_EMPTY;
+		} else {
+			ctrl_[i] = detail::CTRL_DELETED;
+			deleted_++;
+		}
+		count_--;
+	}
+
+	/*=========================================================================================
+	 * @name:	size_t seek(size_t i) const
+	 * @brief:	Seek Occupied Slot
+	 * @note:	i以降の最初の使用中スロットを返す。無ければtblsz_を返す。
+	 *       	制御バイトをCTRL_GROUP個ずつ調べ、スロット本体は読まない。
+	 * @attention:
+	 =========================================================================================*/
+	size_t seek(size_t i) const
+	{
+		for (; (i + detail::CTRL_GROUP) <= tblsz_; i+=detail::CTRL_GROUP) {
+			unsigned int bits = detail::group_full(&ctrl_[i]);
+			if (0 != bits) { return i + detail::ctz(bits); }
+		}
+		for (; i<tblsz_; i++) {
+			if (detail::CTRL_FULL & ctrl_[i]) { return i; }
+		}
+		return tblsz_;
+	}
+
+	/* members are replaced only after both arrays are allocated (old table is kept on std::bad_alloc) */
+	void allocate(size_t size)
+	{
+		unsigned char *ctrl = static_cast<unsigned char *>(::operator new(size));
+		Slot *slots;
+		try {
+			slots = static_cast<Slot *>(::operator new(sizeof(Slot) * size, std::align_val_t(alignof(Slot))));
+		} catch (...) {
+			::operator delete(ctrl);
+			throw;
+		}
+		std::memset(ctrl, detail::CTRL_EMPTY, size);
+		ctrl_ = ctrl;
+		slots_ = slots;
+		tblsz_ = size;
+	}
+
+	void destroy()
+	{
+		if (nullptr == ctrl_) { return; }
+		if constexpr (!std::is_trivially_destructible_v<Slot>) {
+			for (size_t i=seek(0); i<tblsz_; i=seek(i + 1)) {
+				slots_[i].~Slot();
+			}
+		}
+		::operator delete(slots_, std::align_val_t(alignof(Slot)));
+		::operator delete(ctrl_);
+		ctrl_ = nullptr;
+		slots_ = nullptr;
+	}
+
+	/*=========================================================================================
+	 * @name:	void rehash(size_t size)
+	 * @brief:	Rebuild Table
+	 * @note:	新しいテーブルにキーとデータをムーブする。墓標は無くなる。
+	 * @attention:	失敗した場合(std::bad_alloc)は元のテーブルのまま。
+	 =========================================================================================*/
+	void rehash(size_t size)
+	{
+		unsigned char *old_ctrl = ctrl_;
+		Slot *old_slots = slots_;
+		size_t old_size = tblsz_;
+
+		allocate(size);
+		for (size_t i=0; i<old_size; i++) {
+			if (0 == (detail::CTRL_FULL & old_ctrl[i])) { continue; }
+			uint64_t h = hash_(old_slots[i].key);
+			size_t j = find_blank(h);
+			::new (static_cast<void *>(&slots_[j])) Slot{std::move(old_slots[i].key), std::move(old_slots[i].value)};
+			ctrl_[j] = h2(h);
+			old_slots[i].~Slot();
+		}
+		deleted_ = 0;
+		::operator delete(old_slots, std::align_val_t(alignof(Slot)));
+		::operator delete(old_ctrl);
+	}
+
+	H hash_;
+	E equal_;
+	unsigned char *ctrl_ = nullptr;       /* Control bytes. (CTRL_EMPTY/CTRL_DELETED/CTRL_FULL|fragment) */
+	Slot *slots_ = nullptr;               /* Key and data. Constructed only if ctrl is full. */
+	size_t tblsz_ = 0;                    /* Table size. */
+	size_t count_ = 0;                    /* Number of registered keys. */
+	size_t deleted_ = 0;                  /* Number of tombstones. */
+};
+
+} /* namespace hashmap */
+
+#endif
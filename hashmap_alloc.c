@@ -0,0 +1,432 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "hashmap.h"
+#include "hashmap_alloc.h"
+
+
+#define ALLOC_ALIGN     (16)                /*! Alignment of every returned block. */
+#define ARENA_MIN_CHUNK (4096)              /*! Minimum chunk size of bump arena. */
+#define ALIGN_UP(n)     (((n) + (ALLOC_ALIGN - 1)) & ~((size_t)ALLOC_ALIGN - 1))
+
+
+/*! Bump Arena Chunk */
+typedef struct tag_arena_chunk {
+	struct tag_arena_chunk *next;         /* Previous (older) chunk. */
+	size_t size;                          /* Usable size. */
+	size_t used;                          /* Used size. */
+} ArenaChunk;
+
+#define ARENA_HEADER    ALIGN_UP(sizeof(ArenaChunk))
+
+/*! Bump Arena */
+struct tag_map_arena {
+	ArenaChunk *head;                     /* Current chunk. Allocate from here. */
+	size_t chunksz;                       /* Default chunk size. */
+	char *last;                           /* Last allocated block. (for realloc/free in place) */
+}; /* HashMapArena define */
+
+
+/*! Slab of Fixed-size Pool */
+typedef struct tag_pool_slab {
+	struct tag_pool_slab *next;           /* Next slab. */
+} PoolSlab;
+
+#define POOL_HEADER     ALIGN_UP(sizeof(PoolSlab))
+
+/*! Fixed-size Pool */
+struct tag_map_pool {
+	size_t objsz;                         /* Object size. Larger requests go to malloc. */
+	int slabnum;                          /* Number of objects per slab. */
+	void *freelist;                       /* Free objects. (first word is next pointer) */
+	PoolSlab *slabs;                      /* Allocated slabs. */
+}; /* HashMapPool define */
+
+
+static char *arena_base(ArenaChunk *chunk);
+static void *arena_alloc(void *ctx, size_t size);
+static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void arena_free(void *ctx, void *ptr, size_t size);
+static void *pool_alloc(void *ctx, size_t size);
+static void *pool_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void pool_free(void *ctx, void *ptr, size_t size);
+
+
+
+/*=========================================================================================
+ * @name:	static char *arena_base(ArenaChunk *chunk)
+ * @brief:	Get First Block Address of Chunk
+ * @note:
+ * @attention:
+ =========================================================================================*/
+static char *arena_base(ArenaChunk *chunk)
+{
+	return (char *)chunk + ARENA_HEADER;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *arena_alloc(void *ctx, size_t size)
+ * @brief:	Allocate from Bump Arena
+ * @note:	現在のチャンクの末尾から切り出すだけ。足りなければ新しいチャンクを確保する
+ *       	(chunkszより大きい要求はその大きさのチャンクを作る)。
+ * @attention:
+ =========================================================================================*/
+static void *arena_alloc(void *ctx, size_t size)
+{
+	HashMapArena arena = (HashMapArena)ctx;
+	ArenaChunk *chunk = arena->head;
+	char *ret;
+
+	size = ALIGN_UP(size);
+	if ((NULL == chunk) || ((chunk->size - chunk->used) < size)) {
+		size_t chunksz = (size < arena->chunksz) ? (arena->chunksz) : (size);
+		chunk = (ArenaChunk *)malloc(ARENA_HEADER + chunksz);
+		if (NULL == chunk) {
+			fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", ARENA_HEADER + chunksz);
+			return NULL;
+		}
+		chunk->next = arena->head;
+		chunk->size = chunksz;
+		chunk->used = 0;
+		arena->head = chunk;
+	}
+
+	ret = arena_base(chunk) + chunk->used;
+	chunk->used += size;
+	arena->last = ret;
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+ * @brief:	Reallocate on Bump Arena
+ * @note:	直前に確保したブロックであれば、その場で伸縮する。
+ *       	それ以外は新しく切り出してコピーする(古いブロックはリセットまで残る)。
+ * @attention:
+ =========================================================================================*/
+static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	HashMapArena arena = (HashMapArena)ctx;
+	ArenaChunk *chunk = arena->head;
+	char *ret;
+
+	if ((ptr == arena->last) && (NULL != chunk)) {
+		size_t offset = (size_t)(arena->last - arena_base(chunk));
+		if (ALIGN_UP(new_size) <= (chunk->size - offset)) {
+			chunk->used = offset + ALIGN_UP(new_size);
+			return ptr;
+		}
+	}
+
+	ret = (char *)arena_alloc(ctx, new_size);
+	if (NULL != ret) {
+		memcpy(ret, ptr, (old_size < new_size) ? (old_size) : (new_size));
+	}
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void arena_free(void *ctx, void *ptr, size_t size)
+ * @brief:	Free on Bump Arena
+ * @note:	直前に確保したブロックだけ巻き戻す。それ以外はHashMap_arenaReset()まで残る。
+ * @attention:
+ =========================================================================================*/
+static void arena_free(void *ctx, void *ptr, size_t size)
+{
+	HashMapArena arena = (HashMapArena)ctx;
+	(void)size;
+
+	if ((ptr == arena->last) && (NULL != arena->head)) {
+		arena->head->used = (size_t)(arena->last - arena_base(arena->head));
+		arena->last = NULL;
+	}
+}
+
+
+/*=========================================================================================
+ * @name:	HashMapArena HashMap_arenaMake(size_t chunksz)
+ * @brief:	Make Bump Arena
+ * @note:	chunkszずつmallocして先頭から切り出すだけのアロケータ。個別のfreeはほぼ何もせず、
+ *       	HashMap_arenaReset()/HashMap_arenaFree()でまとめて解放する。
+ *       	リクエスト毎に作っては捨てる短命なマップ向け。chunkszが0の場合は4KBとする。
+ * @attention:
+ =========================================================================================*/
+HashMapArena HashMap_arenaMake(size_t chunksz)
+{
+	HashMapArena arena;
+
+	arena = (HashMapArena)malloc(sizeof(struct tag_map_arena));
+	if (NULL == arena) {
+		fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(struct tag_map_arena));
+		goto catch_exit;
+	}
+	arena->head = NULL;
+	arena->chunksz = (chunksz < ARENA_MIN_CHUNK) ? (ARENA_MIN_CHUNK) : (ALIGN_UP(chunksz));
+	arena->last = NULL;
+
+catch_exit:
+	return arena;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_arenaReset(HashMapArena arena)
+ * @brief:	Release All Blocks on Bump Arena
+ * @note:	最新のチャンクだけ残して空にし、他のチャンクは解放する。
+ * @attention:	このアリーナで作ったHashMapHandleはすべて無効になる(HashMap_free()も不要)。
+ =========================================================================================*/
+int HashMap_arenaReset(HashMapArena arena)
+{
+	int ret = OK;
+	ArenaChunk *chunk;
+
+	if (NULL == arena) {
+		fprintf(stderr, "error ! arena is NULL ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	if (NULL == arena->head) { goto catch_exit; }
+	chunk = arena->head->next;
+	while (NULL != chunk) {
+		ArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->head->next = NULL;
+	arena->head->used = 0;
+	arena->last = NULL;
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_arenaFree(HashMapArena arena)
+ * @brief:	Free Bump Arena
+ * @note:
+ * @attention:	このアリーナで作ったHashMapHandleはすべて無効になる。
+ =========================================================================================*/
+int HashMap_arenaFree(HashMapArena arena)
+{
+	int ret = OK;
+
+	if (NULL == arena) {
+		fprintf(stderr, "error ! arena is NULL ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	while (NULL != arena->head) {
+		ArenaChunk *next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+	free(arena);
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_arenaAllocator(HashMapArena arena, HashMapAllocator *allocator)
+ * @brief:	Get Allocator of Bump Arena
+ * @note:	HashMapOption.allocatorに渡す。
+ * @attention:
+ =========================================================================================*/
+int HashMap_arenaAllocator(HashMapArena arena, HashMapAllocator *allocator)
+{
+	int ret = OK;
+
+	if ((NULL == arena) || (NULL == allocator)) {
+		fprintf(stderr, "error ! arena or allocator is NULL ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	allocator->alloc = arena_alloc;
+	allocator->realloc = arena_realloc;
+	allocator->free = arena_free;
+	allocator->ctx = arena;
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *pool_alloc(void *ctx, size_t size)
+ * @brief:	Allocate from Fixed-size Pool
+ * @note:	objsz以下の要求は空きリストから返す。空きが無ければslabnum個分のスラブを確保して
+ *       	空きリストに積む。objszより大きい要求はmallocに任せる。
+ * @attention:
+ =========================================================================================*/
+static void *pool_alloc(void *ctx, size_t size)
+{
+	HashMapPool pool = (HashMapPool)ctx;
+	void *ret;
+
+	if (pool->objsz < size) {
+		return malloc(size);
+	}
+
+	if (NULL == pool->freelist) {
+		int i;
+		char *obj;
+		PoolSlab *slab = (PoolSlab *)malloc(POOL_HEADER + pool->objsz * pool->slabnum);
+		if (NULL == slab) {
+			fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", POOL_HEADER + pool->objsz * pool->slabnum);
+			return NULL;
+		}
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		obj = (char *)slab + POOL_HEADER;
+		for (i=0; i<pool->slabnum; i++) {
+			*(void **)(obj + pool->objsz * i) = pool->freelist;
+			pool->freelist = obj + pool->objsz * i;
+		}
+	}
+
+	ret = pool->freelist;
+	pool->freelist = *(void **)ret;
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *pool_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+ * @brief:	Reallocate on Fixed-size Pool
+ * @note:	新旧どちらもobjsz以下であれば同じブロックをそのまま使う。
+ * @attention:
+ =========================================================================================*/
+static void *pool_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	HashMapPool pool = (HashMapPool)ctx;
+	void *ret;
+
+	if ((old_size <= pool->objsz) && (new_size <= pool->objsz)) {
+		return ptr;
+	}
+	if ((pool->objsz < old_size) && (pool->objsz < new_size)) {
+		return realloc(ptr, new_size);
+	}
+
+	ret = pool_alloc(ctx, new_size);
+	if (NULL != ret) {
+		memcpy(ret, ptr, (old_size < new_size) ? (old_size) : (new_size));
+		pool_free(ctx, ptr, old_size);
+	}
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void pool_free(void *ctx, void *ptr, size_t size)
+ * @brief:	Free on Fixed-size Pool
+ * @note:	objsz以下のブロックは空きリストに戻す。スラブ自体はHashMap_poolFree()まで残る。
+ * @attention:
+ =========================================================================================*/
+static void pool_free(void *ctx, void *ptr, size_t size)
+{
+	HashMapPool pool = (HashMapPool)ctx;
+
+	if (pool->objsz < size) {
+		free(ptr);
+		return;
+	}
+	*(void **)ptr = pool->freelist;
+	pool->freelist = ptr;
+}
+
+
+/*=========================================================================================
+ * @name:	HashMapPool HashMap_poolMake(size_t objsz, int slabnum)
+ * @brief:	Make Fixed-size Slab Pool
+ * @note:	objszバイトのブロックをslabnum個ずつまとめて確保し、使い回すアロケータ。
+ *       	ハンドルや小さいテーブルを頻繁に作り直す用途向け。
+ *       	objszより大きい要求(大きいテーブル等)はmalloc/freeに任せる。
+ * @attention:	スレッドセーフではない。
+ =========================================================================================*/
+HashMapPool HashMap_poolMake(size_t objsz, int slabnum)
+{
+	HashMapPool pool = NULL;
+
+	if ((0 == objsz) || (slabnum <= 0)) {
+		fprintf(stderr, "error ! object size and slab num must be more than 0 ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+
+	pool = (HashMapPool)malloc(sizeof(struct tag_map_pool));
+	if (NULL == pool) {
+		fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(struct tag_map_pool));
+		goto catch_exit;
+	}
+	pool->objsz = ALIGN_UP((objsz < sizeof(void *)) ? (sizeof(void *)) : (objsz));
+	pool->slabnum = slabnum;
+	pool->freelist = NULL;
+	pool->slabs = NULL;
+
+catch_exit:
+	return pool;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_poolFree(HashMapPool pool)
+ * @brief:	Free Fixed-size Slab Pool
+ * @note:
+ * @attention:	objszより大きいブロックはプールで管理していないため解放されない。
+ *           	先にHashMap_free()でマップを解放すること。
+ =========================================================================================*/
+int HashMap_poolFree(HashMapPool pool)
+{
+	int ret = OK;
+
+	if (NULL == pool) {
+		fprintf(stderr, "error ! pool is NULL ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	while (NULL != pool->slabs) {
+		PoolSlab *next = pool->slabs->next;
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+	free(pool);
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_poolAllocator(HashMapPool pool, HashMapAllocator *allocator)
+ * @brief:	Get Allocator of Fixed-size Slab Pool
+ * @note:	HashMapOption.allocatorに渡す。
+ * @attention:
+ =========================================================================================*/
+int HashMap_poolAllocator(HashMapPool pool, HashMapAllocator *allocator)
+{
+	int ret = OK;
+
+	if ((NULL == pool) || (NULL == allocator)) {
+		fprintf(stderr, "error ! pool or allocator is NULL ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	allocator->alloc = pool_alloc;
+	allocator->realloc = pool_realloc;
+	allocator->free = pool_free;
+	allocator->ctx = pool;
+
+catch_exit:
+	return ret;
+}
@@ -0,0 +1,18 @@
+#ifndef __HASHMAP_ALLOC_H__
+#define __HASHMAP_ALLOC_H__
+
+#include <stdio.h>
+#include "hashmap.h"
+
+typedef struct tag_map_arena *HashMapArena;
+typedef struct tag_map_pool *HashMapPool;
+
+HashMapArena HashMap_arenaMake(size_t chunksz);
+int HashMap_arenaReset(HashMapArena arena);
+int HashMap_arenaFree(HashMapArena arena);
+int HashMap_arenaAllocator(HashMapArena arena, HashMapAllocator *allocator);
+HashMapPool HashMap_poolMake(size_t objsz, int slabnum);
+int HashMap_poolFree(HashMapPool pool);
+int HashMap_poolAllocator(HashMapPool pool, HashMapAllocator *allocator);
+
+#endif
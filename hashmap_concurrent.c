@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "hashmap.h"
+#include "hashmap_concurrent.h"
+
+
+#define CACHE_LINE      (64)                /*! Stripes are aligned to avoid false sharing. */
+#define RETIRE_ALIGN    (16)                /*! Block header size. Keeps 16 byte alignment. */
+#define READ_RETRY      (64)                /*! Optimistic read attempts before taking the lock. */
+#define DEFAULT_STRIPES (64)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX()     __builtin_ia32_pause()
+#else
+#define CPU_RELAX()     do { } while (0)
+#endif
+
+
+/*! Header of Every Block on Stripe Allocator */
+typedef struct tag_retire_block {
+	struct tag_retire_block *next;        /* Next retired block. */
+	size_t size;                          /* Requested size. */
+} RetireBlock;
+
+#define RETIRE_HEADER   (((sizeof(RetireBlock) + RETIRE_ALIGN - 1) / RETIRE_ALIGN) * RETIRE_ALIGN)
+
+
+/*! Stripe (One Lock and One Map) */
+typedef struct tag_map_stripe {
+	unsigned int seq;                     /* Sequence. Odd while a writer is modifying map. */
+	int readers;                          /* Number of optimistic readers in progress. */
+	pthread_mutex_t lock;                 /* Writer lock. */
+	HashMapHandle map;                    /* Map of this stripe. */
+	RetireBlock *retired;                 /* Blocks freed while readers were in progress. */
+	HashMapAllocator base;                /* Allocator to get memory actually. */
+} __attribute__((aligned(CACHE_LINE))) MapStripe;
+
+
+/*! Concurrent Map */
+struct tag_map_concurrent {
+	int stripes;                          /* Number of stripes. (power of 2) */
+	MapStripe *stripe;                    /* Stripes. */
+}; /* HashMapConcurrent define */
+
+
+/*! Argument of HashMap_peek stale check */
+typedef struct tag_read_ticket {
+	MapStripe *stripe;
+	unsigned int seq;                     /* Sequence observed at read start. */
+} ReadTicket;
+
+
+static void *cmap_std_alloc(void *ctx, size_t size);
+static void *cmap_std_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void cmap_std_free(void *ctx, void *ptr, size_t size);
+static void *stripe_alloc(void *ctx, size_t size);
+static void *stripe_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static void stripe_free(void *ctx, void *ptr, size_t size);
+static void stripe_reclaim(MapStripe *s);
+static void stripe_write_begin(MapStripe *s);
+static void stripe_write_end(MapStripe *s);
+static bool stripe_stale(void *arg);
+static MapStripe *cmap_stripe(HashMapConcurrent cmap, const char *key);
+
+
+
+/*=========================================================================================
+ * @name:	static void *cmap_std_alloc(void *ctx, size_t size)
+ * @brief:	Default Base Allocator (malloc)
+ * @note:
+ * @attention:
+ =========================================================================================*/
+static void *cmap_std_alloc(void *ctx, size_t size)
+{
+	(void)ctx;
+	return malloc(size);
+}
+
+
+/*=========================================================================================
+ * @name:	static void *cmap_std_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+ * @brief:	Default Base Allocator (realloc)
+ * @note:	ストライプのアロケータはreallocを使わないが、vtableを埋めるために用意する。
+ * @attention:
+ =========================================================================================*/
+static void *cmap_std_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	(void)ctx;
+	(void)old_size;
+	return realloc(ptr, new_size);
+}
+
+
+/*=========================================================================================
+ * @name:	static void cmap_std_free(void *ctx, void *ptr, size_t size)
+ * @brief:	Default Base Allocator (free)
+ * @note:
+ * @attention:
+ =========================================================================================*/
+static void cmap_std_free(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
+
+
+/*=========================================================================================
+ * @name:	static void *stripe_alloc(void *ctx, size_t size)
+ * @brief:	Allocate on Stripe
+ * @note:	ブロックの前にRetireBlockを置き、解放を遅延する時のリストに使う。
+ * @attention:
+ =========================================================================================*/
+static void *stripe_alloc(void *ctx, size_t size)
+{
+	MapStripe *s = (MapStripe *)ctx;
+	RetireBlock *block;
+
+	block = (RetireBlock *)s->base.alloc(s->base.ctx, RETIRE_HEADER + size);
+	if (NULL == block) { return NULL; }
+	block->next = NULL;
+	block->size = size;
+	return (char *)block + RETIRE_HEADER;
+}
+
+
+/*=========================================================================================
+ * @name:	static void *stripe_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+ * @brief:	Reallocate on Stripe
+ * @note:	読み出し中のスレッドが古いブロックを見ている可能性があるため、その場では伸ばさず、
+ *       	新しいブロックにコピーして古いブロックはstripe_free()に回す。
+ * @attention:
+ =========================================================================================*/
+static void *stripe_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	void *ret = stripe_alloc(ctx, new_size);
+
+	if ((NULL != ret) && (NULL != ptr)) {
+		memcpy(ret, ptr, (old_size < new_size) ? (old_size) : (new_size));
+		stripe_free(ctx, ptr, old_size);
+	}
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	static void stripe_free(void *ctx, void *ptr, size_t size)
+ * @brief:	Free on Stripe
+ * @note:	楽観的な読み出しが進行中であれば解放せずリストに繋ぎ、次の書き込み時に解放する。
+ *       	書き込み側はseqを奇数にした後でreadersを見る。読み出し側はreadersを増やした後で
+ *       	seqを見る。どちらもseq_cstなので、readersが0に見えた時点で、以降の読み出しは
+ *       	奇数のseqを見て待つ(このブロックには触れない)。
+ * @attention:	書き込み中(ロック保持、seqが奇数)に呼ばれること。
+ =========================================================================================*/
+static void stripe_free(void *ctx, void *ptr, size_t size)
+{
+	MapStripe *s = (MapStripe *)ctx;
+	RetireBlock *block = (RetireBlock *)((char *)ptr - RETIRE_HEADER);
+	(void)size;
+
+	if (0 == __atomic_load_n(&s->readers, __ATOMIC_SEQ_CST)) {
+		s->base.free(s->base.ctx, block, RETIRE_HEADER + block->size);
+		return;
+	}
+	block->next = s->retired;
+	s->retired = block;
+}
+
+
+/*=========================================================================================
+ * @name:	static void stripe_reclaim(MapStripe *s)
+ * @brief:	Free Retired Blocks
+ * @note:	読み出しが進行中でなければ、遅延していたブロックをまとめて解放する。
+ * @attention:	書き込み中(ロック保持、seqが奇数)に呼ばれること。
+ =========================================================================================*/
+static void stripe_reclaim(MapStripe *s)
+{
+	if (NULL == s->retired) { return; }
+	if (0 != __atomic_load_n(&s->readers, __ATOMIC_SEQ_CST)) { return; }
+
+	while (NULL != s->retired) {
+		RetireBlock *next = s->retired->next;
+		s->base.free(s->base.ctx, s->retired, RETIRE_HEADER + s->retired->size);
+		s->retired = next;
+	}
+}
+
+
+/*=========================================================================================
+ * @name:	static void stripe_write_begin(MapStripe *s)
+ * @brief:	Begin Write on Stripe
+ * @note:	ロックを取り、seqを奇数にする。読み出し側は奇数の間は待ち、偶数に戻った後で
+ *       	値が変わっていれば読み直す。
+ * @attention:
+ =========================================================================================*/
+static void stripe_write_begin(MapStripe *s)
+{
+	pthread_mutex_lock(&s->lock);
+	__atomic_fetch_add(&s->seq, 1, __ATOMIC_SEQ_CST);
+	stripe_reclaim(s);
+}
+
+
+/*=========================================================================================
+ * @name:	static void stripe_write_end(MapStripe *s)
+ * @brief:	End Write on Stripe
+ * @note:	seqを偶数に戻してロックを離す。
+ * @attention:
+ =========================================================================================*/
+static void stripe_write_end(MapStripe *s)
+{
+	__atomic_fetch_add(&s->seq, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&s->lock);
+}
+
+
+/*=========================================================================================
+ * @name:	static bool stripe_stale(void *arg)
+ * @brief:	Check Stripe is Modified after Read Start
+ * @note:	HashMap_peek()に渡す。ハンドルを写した後でseqが変わっていれば、写した内容は
+ *       	書き込み途中のものなので探索しない。
+ * @attention:
+ =========================================================================================*/
+static bool stripe_stale(void *arg)
+{
+	ReadTicket *ticket = (ReadTicket *)arg;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (ticket->seq != __atomic_load_n(&ticket->stripe->seq, __ATOMIC_RELAXED));
+}
+
+
+/*=========================================================================================
+ * @name:	static MapStripe *cmap_stripe(HashMapConcurrent cmap, const char *key)
+ * @brief:	Select Stripe of Key
+ * @note:	ストライプ内のマップとは別のハッシュ(FNV-1a + fmix32)で選ぶ。同じハッシュを使うと、
+ *       	同じストライプのキーはホーム位置の下位ビットが揃ってしまうため。
+ * @attention:
+ =========================================================================================*/
+static MapStripe *cmap_stripe(HashMapConcurrent cmap, const char *key)
+{
+	uint32_t h = 2166136261u;
+
+	while ('\0' != *key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return &(cmap->stripe[h & (uint32_t)(cmap->stripes - 1)]);
+}
+
+
+/*=========================================================================================
+ * @name:	HashMapConcurrent HashMap_concurrentMake(const size_t cellsz, const int tblsz, const int stripes, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option)
+ * @brief:	Make Thread-safe Hash Table
+ * @note:	キーをstripes個(2のべき乗に切り上げ、0ならDEFAULT_STRIPES)のストライプに振り分け、
+ *       	ストライプ毎にロックとマップを持つ。書き込みはストライプのロックを取る。
+ *       	HashMap_concurrentGet()はロックを取らずにseqlockで楽観的に読む。
+ *       	tblszは全体のサイズで、ストライプ毎に等分する。各マップは自動リサイズモードにする。
+ *       	hash_fook、optionはHashMap_makeEx()と同じ。option->allocatorを指定した場合は、
+ *       	各ストライプが解放を遅延するためのアロケータの下で使う。
+ *       	option->shards、locked、shard_allocatorsは無視する。(ストライプはシャード付きにしない)
+ * @attention:	値はコピーで受け渡す(ポインタは返さない)。
+ =========================================================================================*/
+HashMapConcurrent HashMap_concurrentMake(const size_t cellsz, const int tblsz, const int stripes, int (* hash_fook)(char *key, int tblsz), const HashMapOption *option)
+{
+	HashMapConcurrent cmap = NULL;
+	HashMapOption opt = {HASHMAP_ENGINE_LINEAR, NULL, 0, false, NULL};
+	int i, n = 1;
+	void *mem;
+
+	if ((stripes < 0) || (tblsz <= 0)) {
+		fprintf(stderr, "error ! table size must be more than 0 and stripes 0 or more ! @%s() \n", __func__);
+		goto catch_exit;
+	}
+	while (n < ((0 == stripes) ? (DEFAULT_STRIPES) : (stripes))) { n *= 2; }
+	if (NULL != option) { opt = *option; }
+	/* stripes are plain handles: inner shards would free outside stripe_free */
+	opt.shards = 0;
+	opt.locked = false;
+	opt.shard_allocators = NULL;
+
+	cmap = (HashMapConcurrent)malloc(sizeof(struct tag_map_concurrent));
+	if (NULL == cmap) {
+		fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(struct tag_map_concurrent));
+		goto catch_exit;
+	}
+	if (0 != posix_memalign(&mem, CACHE_LINE, sizeof(MapStripe) * n)) {
+		fprintf(stderr, "error ! memory alocate failed ! [%zd byte] \n", sizeof(MapStripe) * n);
+		free(cmap);
+		cmap = NULL;
+		goto catch_exit;
+	}
+	cmap->stripe = (MapStripe *)mem;
+	cmap->stripes = n;
+
+	for (i=0; i<n; i++) {
+		MapStripe *s = &(cmap->stripe[i]);
+		HashMapAllocator allocator = {stripe_alloc, stripe_realloc, stripe_free, s};
+		s->seq = 0;
+		s->readers = 0;
+		s->retired = NULL;
+		s->base.alloc = cmap_std_alloc;
+		s->base.realloc = cmap_std_realloc;
+		s->base.free = cmap_std_free;
+		s->base.ctx = NULL;
+		if ((NULL != option) && (NULL != option->allocator)) { s->base = *(option->allocator); }
+		pthread_mutex_init(&s->lock, NULL);
+
+		opt.allocator = &allocator;
+		s->map = HashMap_makeEx(cellsz, (tblsz / n < 1) ? (1) : (tblsz / n), hash_fook, &opt);
+		if (NULL == s->map) {
+			pthread_mutex_destroy(&s->lock);
+			cmap->stripes = i;
+			HashMap_concurrentFree(cmap);
+			cmap = NULL;
+			goto catch_exit;
+		}
+		HashMap_setAutoResize(s->map, true, 0.75f, 2.0f);
+	}
+
+catch_exit:
+	return cmap;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_concurrentFree(HashMapConcurrent cmap)
+ * @brief:	Free Thread-safe Hash Table
+ * @note:
+ * @attention:	他のスレッドが使用していないこと。
+ =========================================================================================*/
+int HashMap_concurrentFree(HashMapConcurrent cmap)
+{
+	int i, ret = OK;
+
+	if (NULL == cmap) {
+		fprintf(stderr, "error ! HashMapConcurrent is NULL ! @%s() \n", __func__);
+		ret = NG;
+		goto catch_exit;
+	}
+
+	for (i=0; i<cmap->stripes; i++) {
+		MapStripe *s = &(cmap->stripe[i]);
+		if (NULL != s->map) { HashMap_free(s->map); }
+		stripe_reclaim(s);
+		pthread_mutex_destroy(&s->lock);
+	}
+	free(cmap->stripe);
+	free(cmap);
+
+catch_exit:
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_concurrentInsert(HashMapConcurrent cmap, char *key, void *data)
+ * @brief:	Register Data on Thread-safe Hash Table
+ * @note:	ストライプのロックを取ってHashMap_tryInsert()する。失敗してもログは出さない。
+ * @attention:
+ =========================================================================================*/
+int HashMap_concurrentInsert(HashMapConcurrent cmap, char *key, void *data)
+{
+	int ret;
+	MapStripe *s;
+
+	if ((NULL == cmap) || (NULL == key)) {
+		fprintf(stderr, "error ! HashMapConcurrent or key is NULL ! @%s() \n", __func__);
+		return NG;
+	}
+
+	s = cmap_stripe(cmap, key);
+	stripe_write_begin(s);
+	ret = (HASHMAP_OK == HashMap_tryInsert(s->map, key, data)) ? (OK) : (NG);
+	stripe_write_end(s);
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_concurrentGet(HashMapConcurrent cmap, char *key, void *data)
+ * @brief:	Copy Data from Thread-safe Hash Table
+ * @note:	ロックを取らずに読む(seqlock)。readersを増やしてからseqを読み、偶数であれば
+ *       	HashMap_peek()でdataにコピーし、seqが変わっていなければ確定する。
+ *       	変わっていれば読み直し、READ_RETRY回失敗した場合はロックを取って読む。
+ *       	readersが0でない間は書き込み側がメモリを解放しない(stripe_free参照)。
+ * @attention:	失敗(未登録)時もdataは書き換わりうる。
+ *           	C11のメモリモデル上は書き込みと競合する読み出しだが、seqで検証して捨てる。
+ =========================================================================================*/
+int HashMap_concurrentGet(HashMapConcurrent cmap, char *key, void *data)
+{
+	int i, ret = NG;
+	bool done = false;
+	MapStripe *s;
+	ReadTicket ticket;
+
+	if ((NULL == cmap) || (NULL == key) || (NULL == data)) {
+		fprintf(stderr, "error ! HashMapConcurrent, key or data is NULL ! @%s() \n", __func__);
+		return NG;
+	}
+
+	s = cmap_stripe(cmap, key);
+	ticket.stripe = s;
+	__atomic_fetch_add(&s->readers, 1, __ATOMIC_SEQ_CST);
+	for (i=0; i<READ_RETRY; i++) {
+		ticket.seq = __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST);
+		if (ticket.seq & 1u) {
+			CPU_RELAX();
+			continue;
+		}
+		ret = HashMap_peek(s->map, key, data, stripe_stale, &ticket);
+		if (false == stripe_stale(&ticket)) {
+			done = true;
+			break;
+		}
+	}
+	__atomic_fetch_sub(&s->readers, 1, __ATOMIC_SEQ_CST);
+
+	if (false == done) {
+		pthread_mutex_lock(&s->lock);
+		ret = HashMap_peek(s->map, key, data, NULL, NULL);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_concurrentErase(HashMapConcurrent cmap, char *key)
+ * @brief:	Erase Data on Thread-safe Hash Table
+ * @note:	ストライプのロックを取ってHashMap_tryErase()する。失敗してもログは出さない。
+ * @attention:
+ =========================================================================================*/
+int HashMap_concurrentErase(HashMapConcurrent cmap, char *key)
+{
+	int ret;
+	MapStripe *s;
+
+	if ((NULL == cmap) || (NULL == key)) {
+		fprintf(stderr, "error ! HashMapConcurrent or key is NULL ! @%s() \n", __func__);
+		return NG;
+	}
+
+	s = cmap_stripe(cmap, key);
+	stripe_write_begin(s);
+	ret = (HASHMAP_OK == HashMap_tryErase(s->map, key)) ? (OK) : (NG);
+	stripe_write_end(s);
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_concurrentClear(HashMapConcurrent cmap)
+ * @brief:	All Clear Thread-safe Hash Table (not free)
+ * @note:	ストライプ毎にロックを取って空にする。全体として一瞬で空になるわけではない。
+ * @attention:
+ =========================================================================================*/
+int HashMap_concurrentClear(HashMapConcurrent cmap)
+{
+	int i, ret = OK;
+
+	if (NULL == cmap) {
+		fprintf(stderr, "error ! HashMapConcurrent is NULL ! @%s() \n", __func__);
+		return NG;
+	}
+
+	for (i=0; i<cmap->stripes; i++) {
+		MapStripe *s = &(cmap->stripe[i]);
+		stripe_write_begin(s);
+		if (NG == HashMap_clear(s->map)) { ret = NG; }
+		stripe_write_end(s);
+	}
+
+	return ret;
+}
+
+
+/*=========================================================================================
+ * @name:	int HashMap_concurrentSize(HashMapConcurrent cmap)
+ * @brief:	Get Thread-safe Hash Table Data Num
+ * @note:	ストライプ毎にロックを取って合計する。並行して書き込まれている場合は概算になる。
+ * @attention:
+ =========================================================================================*/
+int HashMap_concurrentSize(HashMapConcurrent cmap)
+{
+	int i, size = 0;
+
+	if (NULL == cmap) {
+		fprintf(stderr, "error ! HashMapConcurrent is NULL ! @%s() \n", __func__);
+		return NG;
+	}
+
+	for (i=0; i<cmap->stripes; i++) {
+		MapStripe *s = &(cmap->stripe[i]);
+		pthread_mutex_lock(&s->lock);
+		size += HashMap_size(s->map);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	return size;
+}
@@ -0,0 +1,18 @@
+#ifndef __HASHMAP_CONCURRENT_H__
+#define __HASHMAP_CONCURRENT_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "hashmap.h"
+
+typedef struct tag_map_concurrent *HashMapConcurrent;
+
+HashMapConcurrent HashMap_concurrentMake(const size_t cellsz, const int tblsz, const int stripes, int (* hash_func)(char *key, int tblsz), const HashMapOption *option);
+int HashMap_concurrentFree(HashMapConcurrent cmap);
+int HashMap_concurrentInsert(HashMapConcurrent cmap, char *key, void *data);
+int HashMap_concurrentGet(HashMapConcurrent cmap, char *key, void *data);
+int HashMap_concurrentErase(HashMapConcurrent cmap, char *key);
+int HashMap_concurrentClear(HashMapConcurrent cmap);
+int HashMap_concurrentSize(HashMapConcurrent cmap);
+
+#endif
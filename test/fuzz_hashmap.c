@@ -0,0 +1,316 @@
+/*=========================================================================================
+ * fuzz_hashmap.c
+ *
+ * Random operations against a reference model, on every engine and on
+ * combinations of hash, resize, key type, API and allocator.
+ * The model is a plain array indexed by key number, so it is trivially right.
+ *
+ *   make test
+ *   ./test/fuzz_hashmap [ops] [seed]
+ =========================================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "hashmap.h"
+#include "hashmap_alloc.h"
+
+
+#define KEY_NUM     (3000)
+
+/*! Configuration bits */
+#define F_RESIZE    (1 << 0)              /* Auto resize. */
+#define F_SHRINK    (1 << 1)              /* Mass erase and shrink now and then. */
+#define F_INCREMENT (1 << 2)              /* Incremental rehash. */
+#define F_CRC       (1 << 3)              /* HashMap_hashCrc32c hook. */
+#define F_FNV       (1 << 4)              /* User hash hook. */
+#define F_BYTES     (1 << 5)              /* Binary keys. (*Bytes API) */
+#define F_TRY       (1 << 6)              /* try* API. */
+#define F_EMPLACE   (1 << 7)              /* getOrInsert / insertOrAssign. */
+#define F_ARENA     (1 << 8)              /* Arena allocator. */
+#define F_POOL      (1 << 9)              /* Pool allocator. */
+#define F_CACHE     (1 << 10)             /* Cache mode. Evicted keys leave the model. */
+#define F_SHARD     (1 << 11)             /* Sharded handle. (8 shards, locked) */
+
+
+static const int configs[] = {
+	0,
+	F_RESIZE,
+	F_RESIZE | F_SHRINK,
+	F_RESIZE | F_INCREMENT,
+	F_RESIZE | F_INCREMENT | F_SHRINK,
+	F_CRC,
+	F_RESIZE | F_CRC | F_INCREMENT,
+	F_FNV,
+	F_RESIZE | F_FNV | F_INCREMENT,
+	F_BYTES,
+	F_RESIZE | F_BYTES | F_SHRINK,
+	F_TRY,
+	F_RESIZE | F_TRY | F_INCREMENT,
+	F_RESIZE | F_BYTES | F_TRY | F_INCREMENT,
+	F_EMPLACE,
+	F_RESIZE | F_EMPLACE,
+	F_RESIZE | F_ARENA,
+	F_RESIZE | F_POOL | F_INCREMENT,
+	F_RESIZE | F_BYTES | F_FNV | F_POOL,
+	F_CACHE,
+	F_RESIZE | F_CACHE | F_TRY,
+	F_RESIZE | F_CACHE | F_EMPLACE,
+	F_CACHE | F_BYTES | F_ARENA,
+	F_SHARD,
+	F_RESIZE | F_SHARD | F_INCREMENT,
+	F_RESIZE | F_SHARD | F_BYTES | F_FNV,
+	F_RESIZE | F_SHARD | F_CACHE | F_TRY,
+	F_RESIZE | F_SHARD | F_EMPLACE | F_POOL,
+};
+
+
+typedef struct {
+	int flags;
+	HashMapHandle map;
+	char key[128];
+	int keylen;
+	int value[KEY_NUM];                   /* Reference model. */
+	bool present[KEY_NUM];
+	int live;
+} Fuzz;
+
+
+static uint64_t rng_state;
+
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32_t)(rng_state >> 16);
+}
+
+
+static int hash_fnv(char *key, int tblsz)
+{
+	uint32_t h = 2166136261u;
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return (int)(h % (uint32_t)tblsz);
+}
+
+
+static void make_key(Fuzz *f, int k)
+{
+	if (f->flags & F_BYTES) {
+		int pad = k % 50;
+		f->keylen = sprintf(f->key, "u%c%d", 0, k * 7);
+		memset(f->key + f->keylen, 'x', pad);
+		f->keylen += pad;
+	} else if (0 == k % 4) {
+		f->keylen = sprintf(f->key, "a/long/key/for/the/arena/%06d", k * 7);
+	} else {
+		f->keylen = sprintf(f->key, "user:%06d", k * 7);
+	}
+}
+
+
+/* Key number of evicted key. (first digits of key / 7) */
+static void fuzz_evict(const char *key, size_t len, void *data, void *arg)
+{
+	Fuzz *f = (Fuzz *)arg;
+	size_t i = 0;
+	int k;
+
+	(void)data;
+	while ((i < len) && ((key[i] < '0') || ('9' < key[i]))) { i++; }
+	k = atoi(&key[i]) / 7;
+	if (!f->present[k]) { printf("evicted key %d is not registered \n", k); exit(1); }
+	f->present[k] = false;
+	f->live--;
+}
+
+
+static bool fuzz_insert(Fuzz *f, int k, int v)
+{
+	make_key(f, k);
+	if (f->flags & F_EMPLACE) {
+		bool inserted;
+		int *p = HashMap_getOrInsert(f->map, f->key, &inserted);
+		if ((NULL == p) || !inserted) { return false; }
+		if (0 != *p) { printf("getOrInsert: data is not zero filled \n"); exit(1); }
+		if (k & 1) {
+			*p = v;
+		} else {
+			HashMap_insertOrAssign(f->map, f->key, &v);
+		}
+		return true;
+	}
+	if ((f->flags & F_TRY) && (f->flags & F_BYTES)) { return (HASHMAP_OK == HashMap_tryInsertBytes(f->map, f->key, f->keylen, &v)); }
+	if (f->flags & F_TRY) { return (HASHMAP_OK == HashMap_tryInsert(f->map, f->key, &v)); }
+	if (f->flags & F_BYTES) { return (OK == HashMap_insertBytes(f->map, f->key, f->keylen, &v)); }
+	return (OK == HashMap_insert(f->map, f->key, &v));
+}
+
+
+static int *fuzz_get(Fuzz *f, int k)
+{
+	make_key(f, k);
+	if (f->flags & F_TRY) {
+		void *p = (void *)1;
+		EHashMapStatus st = (f->flags & F_BYTES) ? HashMap_tryGetBytes(f->map, f->key, f->keylen, &p) : HashMap_tryGet(f->map, f->key, &p);
+		if ((HASHMAP_OK == st) != (NULL != p)) { printf("tryGet: status and data disagree \n"); exit(1); }
+		return p;
+	}
+	if (f->flags & F_BYTES) { return HashMap_getBytes(f->map, f->key, f->keylen); }
+	return HashMap_get(f->map, f->key);
+}
+
+
+static bool fuzz_erase(Fuzz *f, int k)
+{
+	make_key(f, k);
+	if ((f->flags & F_TRY) && (f->flags & F_BYTES)) { return (HASHMAP_OK == HashMap_tryEraseBytes(f->map, f->key, f->keylen)); }
+	if (f->flags & F_TRY) { return (HASHMAP_OK == HashMap_tryErase(f->map, f->key)); }
+	if (f->flags & F_BYTES) { return (OK == HashMap_eraseBytes(f->map, f->key, f->keylen)); }
+	return (OK == HashMap_erase(f->map, f->key));
+}
+
+
+static int fuzz_iterate(Fuzz *f)
+{
+	HashMapIter iter;
+	int n = 0;
+
+	HashMap_iterInit(f->map, &iter);
+	while (HashMap_iterNext(&iter)) {
+		fuzz_get(f, rng() % KEY_NUM);	/* lookups must not disturb the walk */
+		n++;
+	}
+	return n;
+}
+
+
+static int fuzz_check_all(Fuzz *f)
+{
+	int k;
+
+	for (k=0; k<KEY_NUM; k++) {
+		int *p = fuzz_get(f, k);
+		if (f->present[k] != (NULL != p)) { return k; }
+		if ((NULL != p) && (f->value[k] != *p)) { return k; }
+	}
+	return -1;
+}
+
+
+static int fuzz_run(int engine, int flags, int ops, uint64_t seed)
+{
+	static Fuzz f;
+	HashMapAllocator allocator;
+	HashMapArena arena = HashMap_arenaMake(0);
+	HashMapPool pool = HashMap_poolMake(256, 8);
+	HashMapOption option = {(EHashMapEngine)engine, NULL};
+	int (* hash)(char *key, int tblsz) = (flags & F_CRC) ? HashMap_hashCrc32c : (flags & F_FNV) ? hash_fnv : NULL;
+	HashMapHandle frozen;
+	int i, k, ret = 0;
+
+	memset(&f, 0, sizeof(f));
+	f.flags = flags;
+	rng_state = seed;
+	if (flags & F_ARENA) {
+		HashMap_arenaAllocator(arena, &allocator);
+		option.allocator = &allocator;
+	} else if (flags & F_POOL) {
+		HashMap_poolAllocator(pool, &allocator);
+		option.allocator = &allocator;
+	}
+	if (flags & F_SHARD) {
+		option.shards = 8;
+		option.locked = true;
+	}
+	f.map = HashMap_makeEx(sizeof(int), (flags & F_RESIZE) ? 16 : 4096, hash, &option);
+	if (flags & F_RESIZE) { HashMap_setAutoResize(f.map, true, 0.7f, 1.5f); }
+	if (flags & F_INCREMENT) { HashMap_setIncrementalRehash(f.map, 1); }
+	if (flags & F_CACHE) { HashMap_setCache(f.map, KEY_NUM / 3, 0, fuzz_evict, &f); }
+
+	for (i=0; i<ops; i++) {
+		uint32_t op = rng() % 8;
+		k = rng() % KEY_NUM;
+		if (op < 3) {
+			int v = (int)rng();
+			bool ok = fuzz_insert(&f, k, v);
+			if (f.present[k] && ok) { printf("op %d: inserted registered key %d \n", i, k); ret = 1; break; }
+			if (!f.present[k] && !ok && (flags & F_RESIZE)) { printf("op %d: insert failed on resizable map \n", i); ret = 1; break; }
+			if (ok) {
+				f.present[k] = true;
+				f.value[k] = v;
+				f.live++;
+			}
+		} else if (op < 6) {
+			int *p = fuzz_get(&f, k);
+			if ((f.present[k] != (NULL != p)) || ((NULL != p) && (f.value[k] != *p))) { printf("op %d: get mismatch on key %d \n", i, k); ret = 1; break; }
+		} else {
+			bool ok = fuzz_erase(&f, k);
+			if (ok != f.present[k]) { printf("op %d: erase mismatch on key %d \n", i, k); ret = 1; break; }
+			if (ok) {
+				f.present[k] = false;
+				f.live--;
+			}
+		}
+
+		if ((flags & F_CACHE) && (KEY_NUM / 3 < f.live)) { printf("op %d: cache holds %d keys \n", i, f.live); ret = 1; break; }
+		if ((0 == i % 1000) && (HashMap_size(f.map) != f.live)) { printf("op %d: size %d, expected %d \n", i, HashMap_size(f.map), f.live); ret = 1; break; }
+		if ((0 == i % 10007) && (fuzz_iterate(&f) != f.live)) { printf("op %d: iteration mismatch \n", i); ret = 1; break; }
+		if ((NULL == hash) && (ops / 3 == i)) { HashMap_setSeed(f.map, seed); }
+		if ((flags & F_SHRINK) && (0 == i % 50000)) {
+			for (k=0; k<KEY_NUM; k+=2) {
+				if (f.present[k] && fuzz_erase(&f, k)) {
+					f.present[k] = false;
+					f.live--;
+				}
+			}
+			if (OK != HashMap_shrink(f.map)) { printf("op %d: shrink failed \n", i); ret = 1; break; }
+		}
+	}
+
+	if ((0 == ret) && (0 <= (k = fuzz_check_all(&f)))) { printf("final mismatch on key %d \n", k); ret = 1; }
+	if ((0 == ret) && (fuzz_iterate(&f) != f.live)) { printf("final iteration mismatch \n"); ret = 1; }
+
+	/* frozen copy must answer the same */
+	frozen = HashMap_freeze(f.map);
+	if ((0 == ret) && (NULL != frozen)) {
+		HashMapHandle live = f.map;
+		f.map = frozen;
+		if (0 <= (k = fuzz_check_all(&f))) { printf("frozen mismatch on key %d \n", k); ret = 1; }
+		f.map = live;
+	} else if (0 == ret) {
+		printf("freeze failed \n");
+		ret = 1;
+	}
+
+	HashMap_free(frozen);
+	HashMap_free(f.map);
+	HashMap_arenaFree(arena);
+	HashMap_poolFree(pool);
+	return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+	int ops = (1 < argc) ? atoi(argv[1]) : 200000;
+	uint64_t seed = (2 < argc) ? strtoull(argv[2], NULL, 0) : 88172645463325252ull;
+	int engine, c, failed = 0, runs = 0;
+
+	for (engine=0; engine<3; engine++) {
+		for (c=0; c<(int)(sizeof(configs) / sizeof(configs[0])); c++) {
+			runs++;
+			if (0 != fuzz_run(engine, configs[c], ops, seed + c)) {
+				printf("FAIL engine=%d flags=0x%x seed=%llu \n", engine, configs[c], (unsigned long long)(seed + c));
+				failed++;
+			}
+		}
+	}
+	printf("%d runs, %d failed \n", runs, failed);
+	return (0 == failed) ? 0 : 1;
+}
@@ -0,0 +1,881 @@
+/*=========================================================================================
+ * test_hashmap.c
+ *
+ * Correctness test of each API on every engine.
+ * Prints failed checks and exits with non-zero status if any.
+ *
+ *   make test
+ =========================================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "hashmap.h"
+#include "hashmap_alloc.h"
+#include "hashmap_concurrent.h"
+
+
+static int failed = 0;
+static int checked = 0;
+
+#define CHECK(cond)                                                                   \
+do {                                                                                  \
+	checked++;                                                                        \
+	if (!(cond)) {                                                                    \
+		failed++;                                                                     \
+		printf("FAIL %s:%d %s (engine=%d) \n", __FILE__, __LINE__, #cond, engine);   \
+	}                                                                                 \
+} while (0)
+
+
+static const char *engine_name[] = {"linear", "swiss", "robinhood"};
+
+
+static int hash_fnv(char *key, int tblsz)
+{
+	uint32_t h = 2166136261u;
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return (int)(h % (uint32_t)tblsz);
+}
+
+
+static void make_key(char *buf, int i)
+{
+	if (0 == i % 3) {
+		sprintf(buf, "a/rather/long/key/number/%d", i);
+	} else {
+		sprintf(buf, "k%d", i);
+	}
+}
+
+
+static HashMapHandle make_map(int engine, int tblsz, int (* hash)(char *key, int tblsz))
+{
+	HashMapOption option = {(EHashMapEngine)engine, NULL};
+	return HashMap_makeEx(sizeof(int), tblsz, hash, &option);
+}
+
+
+static void test_basic(int engine)
+{
+	HashMapHandle map = make_map(engine, 64, NULL);
+	int v = 10, *p;
+
+	CHECK(NULL != map);
+	CHECK(HashMap_empty(map));
+	CHECK(OK == HashMap_insert(map, "apple", &v));
+	CHECK(NG == HashMap_insert(map, "apple", &v));
+	CHECK(NG == HashMap_insert(map, "", &v));
+	p = HashMap_get(map, "apple");
+	CHECK((NULL != p) && (10 == *p));
+	CHECK(NULL == HashMap_get(map, "banana"));
+	CHECK(1 == HashMap_size(map));
+	CHECK(HASHMAP_EXISTS == HashMap_tryInsert(map, "apple", &v));
+	CHECK(HASHMAP_NOT_FOUND == HashMap_tryGet(map, "banana", NULL));
+	CHECK(HASHMAP_OK == HashMap_tryGet(map, "apple", (void **)&p));
+	CHECK(HASHMAP_NOT_FOUND == HashMap_tryErase(map, "banana"));
+	CHECK(OK == HashMap_erase(map, "apple"));
+	CHECK(NG == HashMap_erase(map, "apple"));
+	CHECK(0 == HashMap_size(map));
+
+	/* binary keys */
+	CHECK(OK == HashMap_insertBytes(map, "a\0b", 3, &v));
+	CHECK(NULL == HashMap_getBytes(map, "a\0c", 3));
+	CHECK(NULL != HashMap_getBytes(map, "a\0b", 3));
+	CHECK(OK == HashMap_eraseBytes(map, "a\0b", 3));
+	CHECK(HASHMAP_OK == HashMap_tryInsertBytes(map, "a\0b", 3, &v));
+	CHECK(HASHMAP_EXISTS == HashMap_tryInsertBytes(map, "a\0b", 3, &v));
+	CHECK(HASHMAP_NOT_FOUND == HashMap_tryGetBytes(map, "a\0c", 3, NULL));
+	CHECK((HASHMAP_OK == HashMap_tryGetBytes(map, "a\0b", 3, (void **)&p)) && (10 == *p));
+	CHECK(HASHMAP_OK == HashMap_tryEraseBytes(map, "a\0b", 3));
+	CHECK(HASHMAP_NOT_FOUND == HashMap_tryEraseBytes(map, "a\0b", 3));
+	CHECK(HASHMAP_INVALID == HashMap_tryGetBytes(map, "", 0, NULL));
+
+	/* table full without auto resize */
+	{
+		char key[64];
+		int i, ok = 0;
+		for (i=0; i<100; i++) {
+			make_key(key, i);
+			if (HASHMAP_OK == HashMap_tryInsert(map, key, &i)) { ok++; }
+		}
+		CHECK(ok == HashMap_size(map));
+		CHECK(ok <= HashMap_maxsize(map));
+		make_key(key, 100);
+		CHECK(HASHMAP_FULL == HashMap_tryInsert(map, key, &v));
+		CHECK(OK == HashMap_clear(map));
+		CHECK(0 == HashMap_size(map));
+	}
+	HashMap_free(map);
+}
+
+
+static void count_up(void *data, bool inserted, void *arg)
+{
+	(void)arg;
+	*(int *)data = inserted ? 1 : (*(int *)data + 1);
+}
+
+
+static void test_upsert(int engine)
+{
+	HashMapHandle map = make_map(engine, 64, NULL);
+	bool inserted;
+	int v = 7, *p;
+
+	p = HashMap_getOrInsert(map, "x", &inserted);
+	CHECK((NULL != p) && inserted && (0 == *p));
+	p = HashMap_getOrInsert(map, "x", &inserted);
+	CHECK((NULL != p) && !inserted);
+	CHECK(OK == HashMap_upsert(map, "y", count_up, NULL));
+	CHECK(OK == HashMap_upsert(map, "y", count_up, NULL));
+	p = HashMap_get(map, "y");
+	CHECK((NULL != p) && (2 == *p));
+	CHECK(OK == HashMap_insertOrAssign(map, "y", &v));
+	p = HashMap_get(map, "y");
+	CHECK((NULL != p) && (7 == *p));
+	HashMap_free(map);
+}
+
+
+static void test_resize(int engine, int step, int (* hash)(char *key, int tblsz))
+{
+	HashMapHandle map = make_map(engine, 16, hash);
+	HashMapStats stats;
+	char key[64];
+	int i, n = 5000, *p, ok = 1;
+
+	CHECK(OK == HashMap_setAutoResize(map, true, 0.8f, 2.0f));
+	CHECK(OK == HashMap_setIncrementalRehash(map, step));
+	for (i=0; i<n; i++) {
+		make_key(key, i);
+		if (OK != HashMap_insert(map, key, &i)) { ok = 0; }
+	}
+	CHECK(ok);
+	for (i=0; i<n; i+=2) {
+		make_key(key, i);
+		if (OK != HashMap_erase(map, key)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(OK == HashMap_shrink(map));
+	for (i=0; i<n; i++) {
+		make_key(key, i);
+		p = HashMap_get(map, key);
+		if ((0 == i % 2) != (NULL == p)) { ok = 0; }
+		if ((NULL != p) && (i != *p)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(n / 2 == HashMap_size(map));
+	CHECK(OK == HashMap_stats(map, &stats));
+	CHECK(n / 2 == stats.count);
+	CHECK(0 < stats.resizes);
+	CHECK(stats.load <= 0.8f);
+	if (NULL == hash) {
+		CHECK(OK == HashMap_setSeed(map, 12345));
+		make_key(key, 1);
+		p = HashMap_get(map, key);
+		CHECK((NULL != p) && (1 == *p));
+	}
+	HashMap_free(map);
+}
+
+
+static bool count_key(const char *key, size_t len, void *data, void *arg)
+{
+	(void)data;
+	if (strlen(key) == len) { __atomic_fetch_add((int *)arg, 1, __ATOMIC_RELAXED); }
+	return true;
+}
+
+
+static void test_iterate(int engine)
+{
+	HashMapHandle map = make_map(engine, 16, NULL);
+	HashMapIter a, b;
+	char key[64];
+	int i, n = 1000, na = 0, nb = 0, legacy = 0, each = 0, ok = 1;
+
+	HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+	HashMap_setIncrementalRehash(map, 1);
+	for (i=0; i<n; i++) {
+		make_key(key, i);
+		HashMap_insert(map, key, &i);
+	}
+
+	/* nested external iterators with lookups between steps */
+	CHECK(OK == HashMap_iterInit(map, &a));
+	while (HashMap_iterNext(&a)) {
+		int *p = HashMap_get(map, (char *)a.key);
+		if ((NULL == p) || (p != a.data) || (strlen(a.key) != a.keylen)) { ok = 0; }
+		if (0 == na++) {
+			HashMap_iterInit(map, &b);
+			while (HashMap_iterNext(&b)) { nb++; }
+		}
+	}
+	CHECK(ok);
+	CHECK(n == na);
+	CHECK(n == nb);
+
+	HashMap_begin(map);
+	while (HashMap_hasNext(map)) {
+		if (NULL != HashMap_next(map)) { legacy++; }
+	}
+	CHECK(n == legacy);
+
+	CHECK(OK == HashMap_foreach(map, count_key, &each));
+	CHECK(n == each);
+	each = 0;
+	CHECK(OK == HashMap_parallelForeach(map, count_key, &each, 4));
+	CHECK(n == each);
+	HashMap_free(map);
+}
+
+
+static void test_batch(int engine)
+{
+	HashMapHandle map = make_map(engine, 16, NULL);
+	HashMapHandle bulk = make_map(engine, 16, NULL);
+	char key[300][64], *keys[300];
+	void *data[300], *results[300];
+	int values[300], i, ok = 1;
+
+	HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+	HashMap_setAutoResize(bulk, true, 0.8f, 2.0f);
+	for (i=0; i<300; i++) {
+		make_key(key[i], i % 250);	/* last 50 keys are duplicates */
+		keys[i] = key[i];
+		values[i] = i;
+		data[i] = &values[i];
+	}
+	CHECK(250 == HashMap_insertBatch(map, keys, data, 300));
+	CHECK(250 == HashMap_bulkLoad(bulk, keys, data, 300, 4));
+	CHECK(250 == HashMap_size(bulk));
+	CHECK(300 == HashMap_getBatch(bulk, keys, 300, results));
+	for (i=0; i<300; i++) {
+		int *p = HashMap_get(map, keys[i]);
+		if ((NULL == p) || (NULL == results[i]) || (*p != *(int *)results[i]) || (*p != i % 250)) { ok = 0; }
+	}
+	CHECK(ok);
+	HashMap_free(map);
+	HashMap_free(bulk);
+}
+
+
+/* Fill section [from, to) of snapshot with c. Offsets are read from the header (see MapSnapHeader). */
+static void corrupt_snapshot(const char *path, long from_at, long to_at, int c)
+{
+	FILE *fp = fopen(path, "r+b");
+	uint64_t from = 0, to = 0;
+
+	if (NULL == fp) { return; }
+	if ((0 == fseek(fp, from_at, SEEK_SET)) && (1 == fread(&from, sizeof(from), 1, fp))
+	 && (0 == fseek(fp, to_at, SEEK_SET)) && (1 == fread(&to, sizeof(to), 1, fp)) && (0 == fseek(fp, (long)from, SEEK_SET))) {
+		for (; from<to; from++) { fputc(c, fp); }
+	}
+	fclose(fp);
+}
+
+
+static void test_snapshot(int engine)
+{
+	HashMapHandle map = make_map(engine, 16, NULL);
+	HashMapHandle load, frozen;
+	char key[64], path[64];
+	int i, n = 2000, v = 1, ok = 1;
+
+	HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+	for (i=0; i<n; i++) {
+		make_key(key, i);
+		HashMap_insert(map, key, &i);
+	}
+	sprintf(path, "/tmp/test_hashmap_%d.snap", (int)getpid());
+	CHECK(OK == HashMap_save(map, path));
+	load = HashMap_load(path, NULL, HASHMAP_LOAD_READONLY);
+	CHECK(NULL != load);
+	frozen = HashMap_freeze(map);
+	CHECK(NULL != frozen);
+	for (i=0; i<n; i++) {
+		int *p, *q;
+		make_key(key, i);
+		p = (NULL != load) ? HashMap_get(load, key) : NULL;
+		q = (NULL != frozen) ? HashMap_get(frozen, key) : NULL;
+		if ((NULL == p) || (NULL == q) || (i != *p) || (i != *q)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(NULL == HashMap_get(frozen, "missing"));
+	CHECK(HASHMAP_READ_ONLY == HashMap_tryInsert(load, "new", &v));
+	CHECK(HASHMAP_READ_ONLY == HashMap_tryInsert(frozen, "new", &v));
+	CHECK(n == HashMap_size(frozen));
+	HashMap_free(load);
+	HashMap_free(frozen);
+
+	/* broken slots are rejected on load (ctrl_off at 96, slots_off at 104, values_off at 112) */
+	corrupt_snapshot(path, 104, 112, 0xFF);	/* negative key length */
+	CHECK(NULL == HashMap_load(path, NULL, HASHMAP_LOAD_READONLY));
+	CHECK(OK == HashMap_save(map, path));
+	corrupt_snapshot(path, 104, 112, 0x7F);	/* key out of arena */
+	CHECK(NULL == HashMap_load(path, NULL, HASHMAP_LOAD_COW));
+	CHECK(OK == HashMap_save(map, path));
+	corrupt_snapshot(path, 96, 104, 0x7F);	/* unknown control byte */
+	CHECK(NULL == HashMap_load(path, NULL, HASHMAP_LOAD_READONLY));
+	CHECK(OK == HashMap_save(map, path));
+
+	load = HashMap_load(path, NULL, HASHMAP_LOAD_COW);
+	CHECK(NULL != load);
+	CHECK(OK == HashMap_insert(load, "new", &v));
+	CHECK(n + 1 == HashMap_size(load));
+	HashMap_free(load);
+	unlink(path);
+	HashMap_free(map);
+}
+
+
+static void test_allocator(int engine)
+{
+	HashMapArena arena = HashMap_arenaMake(0);
+	HashMapPool pool = HashMap_poolMake(256, 8);
+	HashMapAllocator allocator[2];
+	char key[64];
+	int a, i, ok = 1;
+
+	HashMap_arenaAllocator(arena, &allocator[0]);
+	HashMap_poolAllocator(pool, &allocator[1]);
+	for (a=0; a<2; a++) {
+		HashMapOption option = {(EHashMapEngine)engine, &allocator[a]};
+		HashMapHandle map = HashMap_makeEx(sizeof(int), 16, NULL, &option);
+		HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+		for (i=0; i<1000; i++) {
+			make_key(key, i);
+			if (OK != HashMap_insert(map, key, &i)) { ok = 0; }
+		}
+		for (i=0; i<1000; i+=3) {
+			make_key(key, i);
+			if (OK != HashMap_erase(map, key)) { ok = 0; }
+		}
+		CHECK(666 == HashMap_size(map));
+		HashMap_free(map);
+	}
+	CHECK(ok);
+	HashMap_arenaFree(arena);
+	HashMap_poolFree(pool);
+}
+
+
+static void *count_alloc(void *ctx, size_t size)
+{
+	(*(int *)ctx)++;
+	return malloc(size);
+}
+
+
+static void *count_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	(void)old_size;
+	(*(int *)ctx)++;
+	return realloc(ptr, new_size);
+}
+
+
+static void count_free(void *ctx, void *ptr, size_t size)
+{
+	(void)size;
+	(*(int *)ctx)++;
+	free(ptr);
+}
+
+
+static void test_concurrent(int engine)
+{
+	HashMapOption option = {(EHashMapEngine)engine, NULL};
+	HashMapConcurrent cmap = HashMap_concurrentMake(sizeof(int), 64, 4, NULL, &option);
+	HashMapAllocator shard_alloc[4];
+	char key[64];
+	int i, v, calls = 0, ok = 1;
+
+	CHECK(NULL != cmap);
+	for (i=0; i<500; i++) {
+		make_key(key, i);
+		if (OK != HashMap_concurrentInsert(cmap, key, &i)) { ok = 0; }
+	}
+	for (i=0; i<500; i++) {
+		make_key(key, i);
+		if ((OK != HashMap_concurrentGet(cmap, key, &v)) || (i != v)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(500 == HashMap_concurrentSize(cmap));
+	CHECK(OK == HashMap_concurrentErase(cmap, "k1"));
+	CHECK(NG == HashMap_concurrentGet(cmap, "k1", &v));
+	CHECK(OK == HashMap_concurrentClear(cmap));
+	CHECK(0 == HashMap_concurrentSize(cmap));
+	HashMap_concurrentFree(cmap);
+
+	/* sharding options are ignored: stripes stay plain handles */
+	for (i=0; i<4; i++) {
+		shard_alloc[i].alloc = count_alloc;
+		shard_alloc[i].realloc = count_realloc;
+		shard_alloc[i].free = count_free;
+		shard_alloc[i].ctx = &calls;
+	}
+	option.shards = 4;
+	option.locked = true;
+	option.shard_allocators = shard_alloc;
+	cmap = HashMap_concurrentMake(sizeof(int), 64, 4, NULL, &option);
+	CHECK(NULL != cmap);
+	for (i=0; i<500; i++) {
+		make_key(key, i);
+		if (OK != HashMap_concurrentInsert(cmap, key, &i)) { ok = 0; }
+	}
+	for (i=0; i<500; i++) {
+		make_key(key, i);
+		if ((OK != HashMap_concurrentGet(cmap, key, &v)) || (i != v)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(OK == HashMap_concurrentErase(cmap, "k1"));
+	CHECK(499 == HashMap_concurrentSize(cmap));
+	HashMap_concurrentFree(cmap);
+	CHECK(0 == calls);
+}
+
+
+static void count_evict(const char *key, size_t len, void *data, void *arg)
+{
+	(void)data;
+	if (strlen(key) == len) { (*(int *)arg)++; }
+}
+
+
+static bool sum_bytes(const char *key, size_t len, void *data, void *arg)
+{
+	(void)key;
+	(void)data;
+	*(size_t *)arg += len + sizeof(int);
+	return true;
+}
+
+
+static void test_cache(int engine)
+{
+	HashMapHandle map = make_map(engine, 1000, NULL);
+	HashMapStats stats;
+	char key[256];
+	int i, v = 1, evicted = 0, ok = 1;
+	size_t bytes;
+
+	/* entry limit: referenced keys survive one sweep of the clock */
+	CHECK(OK == HashMap_setCache(map, 100, 0, count_evict, &evicted));
+	for (i=0; i<100; i++) {
+		make_key(key, i);
+		if (OK != HashMap_insert(map, key, &i)) { ok = 0; }
+	}
+	for (i=0; i<50; i++) {
+		make_key(key, i);
+		if (NULL == HashMap_get(map, key)) { ok = 0; }
+	}
+	for (i=100; i<150; i++) {
+		make_key(key, i);
+		if (HASHMAP_OK != HashMap_tryInsert(map, key, &i)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(100 == HashMap_size(map));
+	CHECK(50 == evicted);
+	for (i=0; i<50; i++) {
+		make_key(key, i);
+		if (HASHMAP_OK != HashMap_tryGet(map, key, NULL)) { ok = 0; }
+	}
+	CHECK(ok);
+	HashMap_stats(map, &stats);
+	CHECK(50 == stats.evictions);
+
+	/* lowering the limit evicts at once */
+	CHECK(OK == HashMap_setCache(map, 10, 0, count_evict, &evicted));
+	CHECK(10 == HashMap_size(map));
+	CHECK(140 == evicted);
+
+	/* byte limit (keylen + sizeof(int) per key) */
+	CHECK(OK == HashMap_setCache(map, 0, 200, NULL, NULL));
+	for (i=0; i<300; i++) {
+		make_key(key, i);
+		HashMap_tryInsert(map, key, &i);
+		bytes = 0;
+		HashMap_foreach(map, sum_bytes, &bytes);
+		if (200 < bytes) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(0 < HashMap_size(map));
+	memset(key, 'x', 250);
+	key[250] = '\0';
+	CHECK(HASHMAP_FULL == HashMap_tryInsert(map, key, &v));
+
+	/* full table evicts instead of failing, until cache mode is left */
+	HashMap_free(map);
+	map = make_map(engine, 32, NULL);
+	CHECK(OK == HashMap_setCache(map, 1000, 0, NULL, NULL));
+	for (i=0; i<200; i++) {
+		make_key(key, i);
+		if (HASHMAP_OK != HashMap_tryInsert(map, key, &i)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(HashMap_maxsize(map) == HashMap_size(map));
+	CHECK(OK == HashMap_setCache(map, 0, 0, NULL, NULL));
+	make_key(key, 200);
+	CHECK(HASHMAP_FULL == HashMap_tryInsert(map, key, &v));
+	HashMap_free(map);
+}
+
+
+static uint64_t fake_clock(void *arg)
+{
+	return *(uint64_t *)arg;
+}
+
+
+static void test_expiry(int engine)
+{
+	HashMapHandle map = make_map(engine, 64, NULL);
+	HashMapHandle frozen;
+	HashMapStats stats;
+	uint64_t now = 1000;
+	char key[64], path[64];
+	int i, n, v = 7, ok = 1;
+
+	HashMap_setAutoResize(map, true, 0.75f, 2.0f);
+	CHECK(NG == HashMap_insertTtl(map, "k1", &v, 10));
+	CHECK(OK == HashMap_setExpiry(map, true, 0, fake_clock, &now));
+
+	/* lazy expiry on access */
+	for (i=0; i<200; i++) {
+		make_key(key, i);
+		if (OK != HashMap_insertTtl(map, key, &i, (i & 1) ? 10 : 0)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(OK == HashMap_expire(map, "k2", 5));
+	CHECK(OK == HashMap_expire(map, "k5", 0));
+	now += 9;
+	CHECK(NULL == HashMap_get(map, "k2"));
+	CHECK(NULL != HashMap_get(map, "k1"));
+	now += 1;
+	CHECK(NULL == HashMap_get(map, "k1"));
+	CHECK(NULL != HashMap_get(map, "k5"));
+	CHECK(NG == HashMap_expire(map, "k11", 10));
+	CHECK(NG == HashMap_erase(map, "k7"));
+	CHECK(196 == HashMap_size(map));
+
+	/* expired key can be registered again */
+	CHECK(OK == HashMap_insert(map, "k13", &v));
+	CHECK((NULL != HashMap_get(map, "k13")) && (7 == *(int *)HashMap_get(map, "k13")));
+
+	/* sweeper reclaims the rest a few slots at a time */
+	for (i=0; (i < 1000) && (101 < HashMap_size(map)); i++) {
+		if (16 < HashMap_sweep(map, 16)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(101 == HashMap_size(map));
+	HashMap_stats(map, &stats);
+	CHECK(100 == stats.expirations);
+
+	/* sweep on insert keeps memory bounded */
+	CHECK(OK == HashMap_setExpiry(map, true, 8, fake_clock, &now));
+	CHECK(OK == HashMap_clear(map));
+	for (i=0; i<5000; i++) {
+		make_key(key, i);
+		HashMap_insertTtl(map, key, &i, 50);
+		now++;
+	}
+	CHECK(HashMap_size(map) < 500);
+
+	/* bulk load over expired long keys (sweep is not run by workers) */
+	for (n=1; n<=4; n+=3) {
+		char bkey[1000][64], *keys[1000];
+		void *data[1000];
+		CHECK(OK == HashMap_setExpiry(map, true, 64, fake_clock, &now));
+		CHECK(OK == HashMap_clear(map));
+		for (i=0; i<1000; i++) {
+			sprintf(key, "an/expired/rather/long/key/number/%d", i);
+			HashMap_insertTtl(map, key, &i, 5);
+		}
+		now += 10;
+		for (i=0; i<1000; i++) {
+			sprintf(bkey[i], "a/bulk/loaded/rather/long/key/%d", i);
+			keys[i] = bkey[i];
+			data[i] = &v;
+		}
+		CHECK(1000 == HashMap_bulkLoad(map, keys, data, 1000, n));
+		for (i=0, ok=1; i<1000; i++) {
+			int *p = HashMap_get(map, bkey[i]);
+			if ((NULL == p) || (7 != *p)) { ok = 0; }
+		}
+		CHECK(ok);
+		CHECK(NULL == HashMap_get(map, "an/expired/rather/long/key/number/3"));
+	}
+
+	/* expired keys are not frozen, and expiry mode is not saved */
+	CHECK(OK == HashMap_insertTtl(map, "gone", &v, 5));
+	now += 10;
+	frozen = HashMap_freeze(map);
+	CHECK(NULL != frozen);
+	CHECK((NULL != frozen) && (NULL == HashMap_get(frozen, "gone")));
+	CHECK((NULL != frozen) && (1000 == HashMap_size(frozen)));
+	HashMap_free(frozen);
+	sprintf(path, "/tmp/test_hashmap_%d.snap", (int)getpid());
+	CHECK(NG == HashMap_save(map, path));
+	CHECK(OK == HashMap_setExpiry(map, false, 0, NULL, NULL));
+	CHECK(NG == HashMap_expire(map, "k1", 10));
+	HashMap_free(map);
+}
+
+
+static void *shard_upsert(void *arg)
+{
+	HashMapHandle map = (HashMapHandle)arg;
+	char key[64];
+	int i;
+
+	for (i=0; i<1000; i++) {
+		make_key(key, i % 100);
+		HashMap_upsert(map, key, count_up, NULL);
+	}
+	return NULL;
+}
+
+
+static void *shard_peek(void *arg)
+{
+	HashMapHandle map = (HashMapHandle)arg;
+	char key[64];
+	int i, v;
+
+	for (i=0; i<1000; i++) {
+		make_key(key, i % 100);
+		if ((OK == HashMap_peek(map, key, &v, NULL, NULL)) && ((v < 1) || (40 < v))) { return arg; }
+	}
+	return NULL;
+}
+
+
+static void test_shard(int engine)
+{
+	HashMapOption option = {(EHashMapEngine)engine, NULL, 8, true, NULL};
+	HashMapHandle map = HashMap_makeEx(sizeof(int), 64, NULL, &option);
+	HashMapHandle frozen;
+	HashMapIter iter;
+	HashMapStats stats;
+	pthread_t th[6];
+	void *bad;
+	char key[300][64], *keys[300], path[64];
+	void *data[300], *results[300];
+	int values[300], i, n = 2000, each = 0, iterated = 0, evicted = 0, ok = 1;
+
+	CHECK(NULL != map);
+	CHECK(8 == HashMap_shardCount(map));
+	HashMap_setAutoResize(map, true, 0.8f, 2.0f);
+	for (i=0; i<n; i++) {
+		make_key(key[0], i);
+		if (OK != HashMap_insert(map, key[0], &i)) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK(n == HashMap_size(map));
+	for (i=0; i<n; i++) {
+		int *p, *q;
+		make_key(key[0], i);
+		p = HashMap_get(map, key[0]);
+		q = HashMap_getBytes(map, key[0], strlen(key[0]));
+		if ((NULL == p) || (p != q) || (i != *p)) { ok = 0; }
+	}
+	CHECK(ok);
+	for (i=0; i<8; i++) { CHECK(0 < HashMap_size(HashMap_shard(map, i))); }
+	CHECK(NULL == HashMap_shard(map, 8));
+	CHECK(OK == HashMap_erase(map, "k1"));
+	CHECK(NG == HashMap_erase(map, "k1"));
+	CHECK(HASHMAP_NOT_FOUND == HashMap_tryGet(map, "k1", NULL));
+	CHECK(n - 1 == HashMap_size(map));
+
+	/* iteration covers every shard */
+	CHECK(OK == HashMap_iterInit(map, &iter));
+	while (HashMap_iterNext(&iter)) { iterated++; }
+	CHECK(n - 1 == iterated);
+	CHECK(OK == HashMap_foreach(map, count_key, &each));
+	CHECK(n - 1 == each);
+	each = 0;
+	CHECK(OK == HashMap_parallelForeach(map, count_key, &each, 4));
+	CHECK(n - 1 == each);
+	HashMap_stats(map, &stats);
+	CHECK(n - 1 == stats.count);
+
+	/* snapshot is per shard, freeze keeps the routing */
+	sprintf(path, "/tmp/test_hashmap_%d.snap", (int)getpid());
+	CHECK(NG == HashMap_save(map, path));
+	frozen = HashMap_freeze(map);
+	CHECK(NULL != frozen);
+	for (i=2; i<n; i++) {
+		int *p;
+		make_key(key[0], i);
+		p = (NULL != frozen) ? HashMap_get(frozen, key[0]) : NULL;
+		if ((NULL == p) || (i != *p)) { ok = 0; }
+	}
+	CHECK(ok);
+	HashMap_free(frozen);
+
+	/* batch */
+	CHECK(OK == HashMap_clear(map));
+	CHECK(0 == HashMap_size(map));
+	for (i=0; i<300; i++) {
+		make_key(key[i], i % 250);
+		keys[i] = key[i];
+		values[i] = i;
+		data[i] = &values[i];
+	}
+	CHECK(250 == HashMap_bulkLoad(map, keys, data, 300, 4));
+	CHECK(OK == HashMap_clear(map));
+	CHECK(250 == HashMap_insertBatch(map, keys, data, 300));
+	CHECK(300 == HashMap_getBatch(map, keys, 300, results));
+	for (i=0; i<300; i++) {
+		if ((NULL == results[i]) || (i % 250 != *(int *)results[i])) { ok = 0; }
+	}
+	CHECK(ok);
+	keys[7] = "not/registered";
+	keys[8] = NULL;
+	CHECK(298 == HashMap_getBatch(map, keys, 300, results));
+	CHECK((NULL == results[7]) && (NULL == results[8]));
+	CHECK((NULL != results[9]) && (9 == *(int *)results[9]) && (NULL != results[299]) && (49 == *(int *)results[299]));
+
+	/* upsert from several threads, and peek under shard lock */
+	CHECK(OK == HashMap_clear(map));
+	for (i=0; i<6; i++) { pthread_create(&th[i], NULL, (i < 4) ? shard_upsert : shard_peek, map); }
+	for (i=0; i<6; i++) {
+		pthread_join(th[i], &bad);
+		if (NULL != bad) { ok = 0; }
+	}
+	for (i=0; i<100; i++) {
+		int *p;
+		make_key(key[0], i);
+		p = HashMap_get(map, key[0]);
+		if ((NULL == p) || (40 != *p)) { ok = 0; }
+	}
+	CHECK(ok);
+
+	/* entry budget is split over the shards */
+	CHECK(OK == HashMap_clear(map));
+	CHECK(OK == HashMap_setCache(map, 200, 0, count_evict, &evicted));
+	for (i=0; i<n; i++) {
+		make_key(key[0], i);
+		HashMap_insert(map, key[0], &i);
+	}
+	CHECK(HashMap_size(map) <= 200);
+	CHECK(n == HashMap_size(map) + evicted);
+	HashMap_free(map);
+}
+
+
+static void test_trace(int engine)
+{
+	HashMapOption option = {(EHashMapEngine)engine, NULL, 4, false, NULL};
+	HashMapHandle map = make_map(engine, 16, NULL);
+	HashMapHandle sharded = HashMap_makeEx(sizeof(int), 64, NULL, &option);
+	HashMapTrace trace;
+	HashMapStats stats;
+	unsigned long total;
+	char key[64];
+	int i, b, ok = 1;
+
+	/* disabled: nothing is counted */
+	HashMap_insert(map, "k0", &ok);
+	CHECK(OK == HashMap_trace(map, &trace, false));
+	CHECK(0 == trace.ops[HASHMAP_OP_INSERT]);
+	CHECK(NG == HashMap_setTrace(map, true, 0, -1));
+	CHECK(OK == HashMap_erase(map, "k0"));
+
+	/* every lookup is slow, sample all */
+	CHECK(OK == HashMap_setTrace(map, true, 0, 1));
+	HashMap_setAutoResize(map, true, 0.75f, 2.0f);
+	for (i=0; i<1000; i++) {
+		make_key(key, i);
+		HashMap_insert(map, key, &i);
+	}
+	for (i=0; i<1100; i++) {
+		make_key(key, i);
+		HashMap_tryGet(map, key, NULL);
+	}
+	HashMap_tryGet(map, "k500", NULL);	/* newest sample is a hit after misses */
+	for (i=0; i<10; i++) {
+		make_key(key, i);
+		HashMap_erase(map, key);
+	}
+	CHECK(OK == HashMap_trace(map, &trace, false));
+	HashMap_stats(map, &stats);
+	CHECK(1000 == trace.ops[HASHMAP_OP_INSERT]);
+	CHECK(1101 == trace.ops[HASHMAP_OP_GET]);
+	CHECK(10 == trace.ops[HASHMAP_OP_ERASE]);
+	CHECK(stats.resizes == trace.ops[HASHMAP_OP_RESIZE]);
+	for (i=0; i<HASHMAP_OP_NUM; i++) {
+		for (total=0, b=0; b<HASHMAP_TRACE_HIST; b++) { total += trace.hist[i][b]; }
+		if ((total != trace.ops[i]) || (trace.cycles[i] < trace.max_cycles[i])) { ok = 0; }
+	}
+	CHECK(ok);
+	CHECK((1101 == trace.slow) && (1101 == trace.sampled));
+	CHECK(HASHMAP_TRACE_SAMPLES == trace.samples);
+	CHECK(trace.sample[HASHMAP_TRACE_SAMPLES - 1].hit && !trace.sample[HASHMAP_TRACE_SAMPLES - 2].hit);
+	for (i=0; i<trace.samples; i++) {
+		if (trace.sample[i].probe < 0) { ok = 0; }
+	}
+	CHECK(ok);
+
+	/* 1 in 10, then none slow */
+	CHECK(OK == HashMap_trace(map, &trace, true));
+	CHECK(OK == HashMap_setTrace(map, true, 0, 10));
+	for (i=0; i<100; i++) { HashMap_tryGet(map, "k500", NULL); }
+	CHECK(OK == HashMap_trace(map, &trace, true));
+	CHECK((100 == trace.ops[HASHMAP_OP_GET]) && (100 == trace.slow) && (10 == trace.sampled) && (0 == trace.ops[HASHMAP_OP_INSERT]));
+	CHECK(OK == HashMap_setTrace(map, true, UINT64_MAX, 1));
+	for (i=0; i<100; i++) { HashMap_tryGet(map, "k500", NULL); }
+	CHECK(OK == HashMap_trace(map, &trace, false));
+	CHECK((100 == trace.ops[HASHMAP_OP_GET]) && (0 == trace.slow) && (0 == trace.samples));
+	CHECK(OK == HashMap_setTrace(map, false, 0, 0));
+	HashMap_tryGet(map, "k500", NULL);
+	CHECK(OK == HashMap_trace(map, &trace, false));
+	CHECK(0 == trace.ops[HASHMAP_OP_GET]);
+
+	/* sharded handle sums shards */
+	CHECK(OK == HashMap_setTrace(sharded, true, 0, 1));
+	for (i=0; i<200; i++) {
+		make_key(key, i);
+		HashMap_insert(sharded, key, &i);
+		HashMap_get(sharded, key);
+	}
+	CHECK(OK == HashMap_trace(sharded, &trace, false));
+	CHECK((200 == trace.ops[HASHMAP_OP_INSERT]) && (200 == trace.ops[HASHMAP_OP_GET]));
+	CHECK((200 == trace.sampled) && (HASHMAP_TRACE_SAMPLES == trace.samples));
+	HashMap_free(sharded);
+	HashMap_free(map);
+}
+
+
+int main(void)
+{
+	int engine;
+
+	for (engine=0; engine<3; engine++) {
+		test_basic(engine);
+		test_upsert(engine);
+		test_resize(engine, 0, NULL);
+		test_resize(engine, 2, NULL);
+		test_resize(engine, 0, hash_fnv);
+		test_resize(engine, 2, HashMap_hashCrc32c);
+		test_iterate(engine);
+		test_batch(engine);
+		test_snapshot(engine);
+		test_allocator(engine);
+		test_concurrent(engine);
+		test_cache(engine);
+		test_expiry(engine);
+		test_shard(engine);
+		test_trace(engine);
+		printf("%-9s done \n", engine_name[engine]);
+	}
+	printf("%d checks, %d failed \n", checked, failed);
+	return (0 == failed) ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/*=========================================================================================
+ * test_hashmap_cpp.cpp
+ *
+ * hashmap.hpp: random operations against std::unordered_map, with integer,
+ * fixed size struct, std::string and move only (std::unique_ptr) data.
+ *
+ *   make test
+ *   ./test/test_hashmap_cpp [ops] [seed]
+ =========================================================================================*/
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include "hashmap.hpp"
+
+
+#define KEY_NUM     (3000)
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	checks++; \
+	if (!(cond)) { \
+		failures++; \
+		printf("FAIL %s:%d: %s \n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+
+/* Slots of hashmap.hpp are the only over-aligned allocations here: fail them on demand. */
+static bool fail_aligned_new = false;
+
+void *operator new(std::size_t size, std::align_val_t align)
+{
+	void *p;
+	size_t a = ((size_t)align < sizeof(void *)) ? sizeof(void *) : (size_t)align;
+	if (fail_aligned_new || (0 != posix_memalign(&p, a, (0 == size) ? 1 : size))) { throw std::bad_alloc(); }
+	return p;
+}
+
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { free(p); }
+
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32_t)(rng_state >> 16);
+}
+
+
+struct Point {
+	int32_t x;
+	int32_t y;
+};
+
+struct PointHash {
+	size_t operator()(const Point &p) const { return std::hash<int64_t>()(((int64_t)p.x << 32) | (uint32_t)p.y); }
+};
+
+struct PointEqual {
+	bool operator()(const Point &a, const Point &b) const { return (a.x == b.x) && (a.y == b.y); }
+};
+
+
+/* Key k for each key type. */
+static uint64_t make_key(uint64_t *, int k) { return (uint64_t)k * 0x9E3779B97F4A7C15ull; }
+static Point make_key(Point *, int k) { return Point{k, -k * 7}; }
+static std::string make_key(std::string *, int k)
+{
+	return ((0 == k % 4) ? std::string("a/long/key/for/the/arena/") : std::string("user:")) + std::to_string(k * 7);
+}
+
+
+template <class K, class RefHash, class RefEqual>
+static void fuzz(int ops, uint64_t seed)
+{
+	hashmap::HashMap<K, int> map;
+	std::unordered_map<K, int, RefHash, RefEqual> ref;
+	K *tag = nullptr;
+
+	rng_state = seed;
+	for (int i=0; i<ops; i++) {
+		uint32_t op = rng() % 10;
+		K key = make_key(tag, rng() % KEY_NUM);
+		int v = (int)rng();
+
+		if (op < 3) {
+			CHECK(map.insert(key, v) == ref.emplace(key, v).second);
+		} else if (op < 4) {
+			CHECK(map.insertOrAssign(key, v) == (0 == ref.count(key)));
+			ref[key] = v;
+		} else if (op < 5) {
+			std::pair<int *, bool> r = map.getOrInsert(key);
+			bool inserted = (0 == ref.count(key));
+			CHECK(r.second == inserted);
+			CHECK(!inserted || (0 == *r.first));
+			*r.first = v;
+			ref[key] = v;
+		} else if (op < 8) {
+			auto it = ref.find(key);
+			int *p = map.get(key);
+			CHECK((it == ref.end()) == (nullptr == p));
+			if ((nullptr != p) && (it != ref.end())) { CHECK(it->second == *p); }
+		} else {
+			CHECK(map.erase(key) == (1 == ref.erase(key)));
+		}
+
+		if (0 == i % 1000) { CHECK(map.size() == ref.size()); }
+		if (0 == i % 50000) {
+			/* mass erase, then shrink */
+			for (int k=0; k<KEY_NUM; k+=2) {
+				K ek = make_key(tag, k);
+				CHECK(map.erase(ek) == (1 == ref.erase(ek)));
+			}
+			map.shrink();
+		}
+	}
+
+	size_t n = 0;
+	for (auto &slot : map) {
+		auto it = ref.find(slot.key);
+		CHECK((it != ref.end()) && (it->second == slot.value));
+		n++;
+	}
+	CHECK(n == ref.size());
+	for (auto &kv : ref) {
+		const int *p = static_cast<const hashmap::HashMap<K, int> &>(map).get(kv.first);
+		CHECK((nullptr != p) && (kv.second == *p));
+	}
+}
+
+
+static void test_move_only(void)
+{
+	hashmap::HashMap<int, std::unique_ptr<std::string>> map(4);
+	std::unique_ptr<std::string> p(new std::string("moved"));
+
+	CHECK(map.insert(1, std::move(p)));
+	CHECK(nullptr == p);
+	CHECK(!map.insert(1, std::unique_ptr<std::string>(new std::string("dup"))));
+	for (int i=2; i<1000; i++) {	/* several rehashes move the values */
+		map.insertOrAssign(i, std::unique_ptr<std::string>(new std::string(std::to_string(i))));
+	}
+	CHECK(1000 - 1 == map.size());
+	CHECK("moved" == **map.get(1));
+	CHECK("999" == **map.get(999));
+	map[5].reset(new std::string("five"));
+	CHECK("five" == **map.get(5));
+	CHECK(map.getOrInsert(2000).second);
+	CHECK(nullptr == *map.get(2000));
+	CHECK(map.erase(2));
+	CHECK(nullptr == map.get(2));
+
+	hashmap::HashMap<int, std::unique_ptr<std::string>> other(std::move(map));
+	CHECK(0 == map.size());
+	CHECK("moved" == **other.get(1));
+
+	/* moved-from map is a valid empty map */
+	CHECK(nullptr == map.get(1));
+	CHECK(!map.erase(1));
+	CHECK(map.begin() == map.end());
+	map.clear();
+	CHECK(map.insert(3, std::unique_ptr<std::string>(new std::string("three"))));
+	map[4].reset(new std::string("four"));
+	CHECK((2 == map.size()) && ("three" == **map.get(3)) && ("four" == **map.get(4)));
+	other = std::move(map);
+	CHECK((2 == other.size()) && ("four" == **other.get(4)));
+	for (int i=0; i<100; i++) { map[i].reset(new std::string(std::to_string(i))); }
+	CHECK((100 == map.size()) && ("99" == **map.get(99)));
+
+	other.clear();
+	CHECK(other.empty());
+	CHECK(other.insert(1, nullptr));
+}
+
+
+static void test_foreach(void)
+{
+	hashmap::HashMap<std::string, int> map;
+	long sum = 0;
+	int n = 0;
+
+	for (int i=0; i<500; i++) { map[std::to_string(i)] = i; }
+	map.foreach([&](const std::string &key, int &value) {
+		CHECK(std::to_string(value) == key);
+		sum += value;
+		n++;
+	});
+	CHECK(500 == n);
+	CHECK(499L * 500 / 2 == sum);
+
+	map.reserve(100000);
+	CHECK(100000 <= map.maxsize() * 7 / 8);
+	CHECK(500 == map.size());
+	CHECK(250 == *map.get("250"));
+}
+
+
+static void test_bad_alloc(void)
+{
+	hashmap::HashMap<int, std::string> map;
+	bool thrown = false;
+	int n = 0;
+
+	while ((map.size() + 1) <= (map.maxsize() * 7 / 8)) {
+		map.insert(n, std::to_string(n));
+		n++;
+	}
+	fail_aligned_new = true;
+	try {
+		map.insert(n, std::to_string(n));	/* needs rehash */
+	} catch (const std::bad_alloc &) {
+		thrown = true;
+	}
+	fail_aligned_new = false;
+	CHECK(thrown);
+
+	/* old table is kept */
+	CHECK((size_t)n == map.size());
+	CHECK(nullptr == map.get(n));
+	for (int i=0; i<n; i++) { CHECK((nullptr != map.get(i)) && (std::to_string(i) == *map.get(i))); }
+	CHECK(map.insert(n, std::to_string(n)));
+	CHECK((size_t)n + 1 == map.size());
+}
+
+
+int main(int argc, char **argv)
+{
+	int ops = (1 < argc) ? atoi(argv[1]) : 200000;
+	uint64_t seed = (2 < argc) ? strtoull(argv[2], NULL, 0) : 88172645463325252ull;
+
+	fuzz<uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>>(ops, seed);
+	fuzz<Point, PointHash, PointEqual>(ops, seed + 1);
+	fuzz<std::string, std::hash<std::string>, std::equal_to<std::string>>(ops, seed + 2);
+	test_move_only();
+	test_foreach();
+	test_bad_alloc();
+
+	printf("%d checks, %d failed \n", checks, failures);
+	return (0 == failures) ? 0 : 1;
+}